@@ -0,0 +1,106 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+
+extern "C" {
+#include "ptable.h"
+}
+
+/*
+ * Churns one shard-sized page table the way a full cache does, erasing the
+ * oldest page for every page inserted, and reports lookup cost per round.
+ * With tombstones left behind by every erase the cost grows round after
+ * round; here it should stay flat.
+ *
+ * Usage: bench_ptable [pages] [rounds]
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct table_deleter {
+  void operator()(ptable_t* t) const { std::free(t); }
+};
+
+auto make_table(uint32_t pages) -> std::unique_ptr<ptable_t, table_deleter> {
+  size_t size = (ptable_size(pages) + 63) & ~size_t{63};
+  void* mem = std::aligned_alloc(64, size);
+  if (mem == nullptr) {
+    throw std::bad_alloc();
+  }
+  ptable_init(mem, pages);
+  return std::unique_ptr<ptable_t, table_deleter>(static_cast<ptable_t*>(mem));
+}
+
+auto key_of(uint64_t n) -> page_key_t {
+  return page_key_t{.dev = 1, .ino = 2 + (n % 7), .page_no = n};
+}
+
+auto ns_per(clock_type::duration d, uint64_t n) -> double {
+  return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) /
+         static_cast<double>(n);
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int try {
+  uint32_t pages = (argc > 1) ? std::stoul(argv[1]) : 4096;
+  int rounds = (argc > 2) ? std::stoi(argv[2]) : 16;
+
+  auto table = make_table(pages);
+  std::deque<uint64_t> live;
+  uint64_t next = 0;
+
+  for (; next < pages; ++next) {
+    ptable_insert(table.get(), key_of(next), static_cast<int32_t>(next));
+    live.push_back(next);
+  }
+
+  std::cout << "round\tchurn\thit_ns\tmiss_ns\ttombstones\n";
+  volatile int64_t sink = 0;
+  for (int round = 0; round < rounds; ++round) {
+    uint64_t churn = uint64_t{64} * pages;
+    for (uint64_t i = 0; i < churn; ++i, ++next) {
+      ptable_erase(table.get(), key_of(live.front()));
+      live.pop_front();
+      ptable_insert(table.get(), key_of(next), static_cast<int32_t>(next));
+      live.push_back(next);
+    }
+
+    constexpr int passes = 16;
+    auto start = clock_type::now();
+    for (int p = 0; p < passes; ++p) {
+      for (uint64_t n : live) {
+        sink = sink + ptable_find(table.get(), key_of(n));
+      }
+    }
+    auto hit = clock_type::now() - start;
+
+    start = clock_type::now();
+    for (int p = 0; p < passes; ++p) {
+      for (uint64_t n = 0; n < pages; ++n) {
+        sink = sink + ptable_find(table.get(), key_of(next + n));
+      }
+    }
+    auto miss = clock_type::now() - start;
+
+    std::cout << round << '\t' << (round + 1) * churn << '\t'
+              << ns_per(hit, uint64_t{passes} * pages) << '\t'
+              << ns_per(miss, uint64_t{passes} * pages) << '\t'
+              << ptable_tombstones(table.get()) << '\n';
+  }
+
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,116 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "vtpc.h"
+}
+
+/*
+ * Writes the decimal numbers 0, 1, 2, ... one call each, then reads them
+ * back the same way, through vtpc and through plain read(2) and write(2),
+ * and reports the cost per call. Nearly every call lands on the page the
+ * previous one did, so this is the cost of a call on a resident page.
+ *
+ * Usage: bench_tiny [calls] [path]
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct io {
+  const char* name;
+  int (*open)(const char*, int, int);
+  ssize_t (*write)(int, const void*, size_t);
+  ssize_t (*read)(int, void*, size_t);
+  off_t (*lseek)(int, off_t, int);
+  int (*close)(int);
+};
+
+auto libc_open(const char* path, int mode, int access) -> int {
+  return ::open(path, mode, access);  // NOLINT
+}
+
+auto ns_per(clock_type::duration d, uint64_t n) -> double {
+  return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) /
+         static_cast<double>(n);
+}
+
+auto fail(const char* what) -> std::runtime_error {
+  return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+auto run(const io& io, const std::vector<std::string>& texts, const char* path)
+    -> void {
+  (void)std::remove(path);
+  int fd = io.open(path, O_RDWR | O_CREAT, 0644);  // NOLINT
+  if (fd < 0) {
+    throw fail("open");
+  }
+
+  auto start = clock_type::now();
+  for (const std::string& text : texts) {
+    if (io.write(fd, text.data(), text.size()) !=
+        static_cast<ssize_t>(text.size())) {
+      throw fail("write");
+    }
+  }
+  auto write = clock_type::now() - start;
+
+  if (io.lseek(fd, 0, SEEK_SET) != 0) {
+    throw fail("lseek");
+  }
+  char buf[16];
+  start = clock_type::now();
+  for (const std::string& text : texts) {
+    if (io.read(fd, buf, text.size()) != static_cast<ssize_t>(text.size())) {
+      throw fail("read");
+    }
+  }
+  auto read = clock_type::now() - start;
+
+  if (io.close(fd) != 0) {
+    throw fail("close");
+  }
+  (void)std::remove(path);
+
+  std::cout << io.name << '\t' << texts.size() << '\t'
+            << ns_per(write, texts.size()) << '\t'
+            << ns_per(read, texts.size()) << '\n';
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int try {
+  size_t calls = (argc > 1) ? std::stoul(argv[1]) : 1000000;
+  const char* path = (argc > 2) ? argv[2] : "/tmp/bench_tiny";
+
+  std::vector<std::string> texts;
+  texts.reserve(calls);
+  for (size_t i = 0; i < calls; ++i) {
+    texts.push_back(std::to_string(i % 10000));
+  }
+
+  std::cout << "io\tcalls\twrite_ns\tread_ns\n";
+  run(io{"libc", libc_open, ::write, ::read, ::lseek, ::close}, texts, path);
+  run(io{"vtpc", vtpc_open, vtpc_write, vtpc_read, vtpc_lseek, vtpc_close},
+      texts, path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
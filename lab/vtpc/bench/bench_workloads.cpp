@@ -0,0 +1,264 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "file.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+/*
+ * Runs workloads over a file much larger than the default cache through
+ * vt::file::open_libc and vt::file::open_vtpc, and reports throughput,
+ * per-operation latency and, for vtpc, the page hit rate. Each run starts
+ * with the file dropped from the cache it goes through, and its time
+ * includes a final sync, since vtpc holds on to written pages.
+ *
+ *   seq           sequential reads, wrapping at the end of the file
+ *   uniform       reads at uniformly random blocks
+ *   zipf          reads at Zipf-distributed blocks (s = 0.99), the hot
+ *                 ones scattered over the file
+ *   scan+hot      zipf reads, with every fifth read continuing a scan
+ *   rw-N          zipf accesses, N% of them writes
+ *
+ * Usage: bench_workloads [ops] [file MiB] [io bytes] [path]
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct op {
+  off_t offset;
+  bool write;
+};
+
+struct workload {
+  std::string name;
+  std::vector<op> ops;
+};
+
+struct result {
+  double ops_per_s;
+  double mb_per_s;
+  double p50_us;
+  double p99_us;
+  double hit_rate;  // negative if not known
+};
+
+// Block indices drawn with probability proportional to 1 / rank^s.
+class zipf {
+public:
+  zipf(uint64_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+      cdf_[i] = sum;
+    }
+    for (double& c : cdf_) {
+      c /= sum;
+    }
+  }
+
+  auto operator()(std::default_random_engine& random) const -> uint64_t {
+    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+    auto it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+    const auto rank = static_cast<uint64_t>(it - cdf_.begin());
+    return std::min<uint64_t>(rank, cdf_.size() - 1);
+  }
+
+private:
+  std::vector<double> cdf_;
+};
+
+auto make_workloads(size_t ops, uint64_t blocks, size_t io)
+    -> std::vector<workload> {
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<uint64_t> uniform(0, blocks - 1);
+  const zipf hot(blocks, 0.99);  // NOLINT
+
+  // Scatters the ranks, so the hot blocks are not all at the start.
+  std::vector<uint64_t> place(blocks);
+  for (uint64_t i = 0; i < blocks; ++i) {
+    place[i] = i;
+  }
+  std::shuffle(place.begin(), place.end(), random);
+
+  const auto at = [&](uint64_t block) {
+    return static_cast<off_t>(block * io);
+  };
+  const auto build = [&](const std::string& name, auto next) {
+    workload w{name, {}};
+    w.ops.reserve(ops);
+    for (size_t i = 0; i < ops; ++i) {
+      w.ops.push_back(next(i));
+    }
+    return w;
+  };
+
+  std::vector<workload> out;
+  out.push_back(build("seq", [&](size_t i) {
+    return op{at(i % blocks), false};
+  }));
+  out.push_back(build("uniform", [&](size_t) {
+    return op{at(uniform(random)), false};
+  }));
+  out.push_back(build("zipf", [&](size_t) {
+    return op{at(place[hot(random)]), false};
+  }));
+  uint64_t scan = 0;
+  out.push_back(build("scan+hot", [&](size_t i) {
+    if (i % 5 == 4) {  // NOLINT
+      return op{at(scan++ % blocks), false};
+    }
+    return op{at(place[hot(random)]), false};
+  }));
+  for (int percent : {10, 50, 90}) {  // NOLINT
+    std::bernoulli_distribution is_write(percent / 100.0);  // NOLINT
+    out.push_back(build("rw-" + std::to_string(percent), [&](size_t) {
+      return op{at(place[hot(random)]), is_write(random)};
+    }));
+  }
+  return out;
+}
+
+// Writes back and drops whatever the caches hold of the file.
+auto drop_caches(const std::string& path) -> void {
+  const int fd = ::open(path.c_str(), O_RDONLY);  // NOLINT
+  if (fd >= 0) {
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    (void)::close(fd);
+  }
+  const int vfd = vtpc_open(path.c_str(), O_RDONLY, 0);
+  if (vfd >= 0) {
+    (void)vtpc_fadvise(vfd, 0, 0, VTPC_FADV_DONTNEED);
+    (void)vtpc_close(vfd);
+  }
+}
+
+auto vtpc_counts() -> std::pair<uint64_t, uint64_t> {
+  vtpc_stats_t stats{};
+  (void)vtpc_cache_stats(nullptr, &stats);
+  return {stats.hits, stats.misses};
+}
+
+auto run(
+    const std::function<std::unique_ptr<vt::file>()>& open,
+    bool is_vtpc,
+    const workload& w,
+    size_t io
+) -> result {
+  std::string buf(io, 'w');
+  std::vector<double> lat;
+  lat.reserve(w.ops.size());
+
+  std::unique_ptr<vt::file> file = open();
+  const auto [hits0, misses0] = vtpc_counts();
+  const auto start = clock_type::now();
+  for (const op& o : w.ops) {
+    const auto t0 = clock_type::now();
+    file->seek(o.offset);
+    if (o.write) {
+      file->write(buf.data(), io);
+    } else {
+      file->read(buf.data(), io);
+    }
+    lat.push_back(
+        std::chrono::duration<double, std::micro>(clock_type::now() - t0)
+            .count()
+    );
+  }
+  file->sync();
+  const double secs =
+      std::chrono::duration<double>(clock_type::now() - start).count();
+  const auto [hits1, misses1] = vtpc_counts();
+  file.reset();
+
+  std::sort(lat.begin(), lat.end());
+  const auto pct = [&](double p) {
+    return lat[std::min(lat.size() - 1, static_cast<size_t>(p * lat.size()))];
+  };
+  const auto n = static_cast<double>(w.ops.size());
+  const auto accesses = static_cast<double>(hits1 - hits0 + misses1 - misses0);
+  return result{
+      .ops_per_s = n / secs,
+      .mb_per_s = n * static_cast<double>(io) / secs / (1 << 20),
+      .p50_us = pct(0.50),  // NOLINT
+      .p99_us = pct(0.99),  // NOLINT
+      .hit_rate = (is_vtpc && accesses > 0)
+                      ? static_cast<double>(hits1 - hits0) / accesses
+                      : -1.0,
+  };
+}
+
+auto prepare(const std::string& path, uint64_t size) -> void {
+  std::unique_ptr<vt::file> file = vt::file::open_libc(path);
+  const std::string chunk(1 << 20, 'x');
+  for (uint64_t at = 0; at < size; at += chunk.size()) {
+    file->write(chunk.data(), std::min<uint64_t>(chunk.size(), size - at));
+  }
+  file->sync();
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int try {
+  const size_t ops = (argc > 1) ? std::stoul(argv[1]) : 20000;
+  const uint64_t mib = (argc > 2) ? std::stoull(argv[2]) : 64;
+  const size_t io = (argc > 3) ? std::stoul(argv[3]) : 4096;
+  const std::string path = (argc > 4) ? argv[4] : "/tmp/bench_workloads";
+  const uint64_t size = mib << 20U;
+  if (io == 0 || size < io) {
+    std::cerr << "the file must hold at least one I/O\n";
+    return 2;
+  }
+
+  (void)std::remove(path.c_str());
+  prepare(path, size);
+  const std::vector<workload> workloads = make_workloads(ops, size / io, io);
+
+  std::cout << "workload\tio\tops_s\tmb_s\tp50_us\tp99_us\thit_rate\n";
+  std::cout << std::fixed << std::setprecision(2);
+  for (const workload& w : workloads) {
+    for (bool is_vtpc : {false, true}) {
+      drop_caches(path);
+      const result r = run(
+          [&] {
+            return is_vtpc ? vt::file::open_vtpc(path)
+                           : vt::file::open_libc(path);
+          },
+          is_vtpc, w, io
+      );
+      std::cout << w.name << '\t' << (is_vtpc ? "vtpc" : "libc") << '\t'
+                << r.ops_per_s << '\t' << r.mb_per_s << '\t' << r.p50_us
+                << '\t' << r.p99_us << '\t';
+      if (r.hit_rate < 0) {
+        std::cout << '-';
+      } else {
+        std::cout << r.hit_rate;
+      }
+      std::cout << '\n';
+    }
+  }
+  (void)std::remove(path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
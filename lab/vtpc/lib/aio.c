@@ -0,0 +1,490 @@
+#define _GNU_SOURCE
+
+#include "aio.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 64u
+
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned cq_entries;
+} ring_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_sync = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+/* Requests not handed to the worker or the ring yet. */
+static aio_req_t *g_head;
+static aio_req_t *g_tail;
+static int g_started;
+
+/* Finished ring requests whose complete() is still to run. Callbacks may
+ * block on the caller's locks, so they run on their own thread and the
+ * reaper keeps draining the CQ for threads that wait in aio_run(). */
+static aio_req_t *g_cb_head;
+static pthread_cond_t g_cb = PTHREAD_COND_INITIALIZER;
+
+/* Ring requests the kernel would not take, to be run by the fallback
+ * thread, so that no thread does blocking I/O under g_lock. */
+static aio_req_t *g_fb_head;
+static pthread_cond_t g_fb = PTHREAD_COND_INITIALIZER;
+
+__thread int aio_own_thread;
+
+static int g_uring;
+static ring_t g_ring;
+static unsigned g_ring_inflight;
+static unsigned g_ring_unsubmitted;
+
+static void queue_push(aio_req_t *r) {
+  r->next = NULL;
+  if (g_tail) {
+    g_tail->next = r;
+  } else {
+    g_head = r;
+  }
+  g_tail = r;
+}
+
+static void queue_push_front(aio_req_t *r) {
+  r->next = g_head;
+  g_head = r;
+  if (!g_tail) g_tail = r;
+}
+
+static aio_req_t *queue_pop(void) {
+  aio_req_t *r = g_head;
+  if (r) {
+    g_head = r->next;
+    if (!g_head) g_tail = NULL;
+  }
+  return r;
+}
+
+/* Drops the first n bytes of the request's iovec; returns what is left. */
+static size_t advance(aio_req_t *r, size_t n) {
+  r->offset += (off_t)n;
+  int i = 0;
+  while (i < r->iovcnt && n >= r->iov[i].iov_len) n -= r->iov[i++].iov_len;
+  if (i < r->iovcnt) {
+    r->iov[i].iov_base = (char *)r->iov[i].iov_base + n;
+    r->iov[i].iov_len -= n;
+  }
+  r->iovcnt -= i;
+  memmove(r->iov, r->iov + i, sizeof(r->iov[0]) * (size_t)r->iovcnt);
+
+  size_t left = 0;
+  for (i = 0; i < r->iovcnt; i++) left += r->iov[i].iov_len;
+  return left;
+}
+
+/* Worker backend */
+
+static ssize_t run_req(aio_req_t *r) {
+  size_t want = 0;
+  for (int i = 0; i < r->iovcnt; i++) want += r->iov[i].iov_len;
+  size_t done = 0;
+
+  while (done < want) {
+    ssize_t n = (r->op == AIO_READ)
+                    ? preadv(r->fd, r->iov, r->iovcnt, r->offset)
+                    : pwritev(r->fd, r->iov, r->iovcnt, r->offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return (done > 0) ? (ssize_t)done : -1;
+    }
+    if (n == 0) break;
+
+    done += (size_t)n;
+    if (r->op == AIO_READ) break;
+    advance(r, (size_t)n);
+  }
+  return (ssize_t)done;
+}
+
+static void run_now(aio_req_t *r) {
+  ssize_t n = run_req(r);
+  r->err = (n < 0) ? errno : 0;
+  r->result = n;
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  aio_own_thread = 1;
+  pthread_mutex_lock(&g_lock);
+  for (;;) {
+    aio_req_t *r = queue_pop();
+    if (!r) {
+      pthread_cond_wait(&g_queued, &g_lock);
+      continue;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    run_now(r);
+    r->complete(r);
+
+    pthread_mutex_lock(&g_lock);
+  }
+  return NULL;
+}
+
+static int start_thread(void *(*fn)(void *)) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t tid;
+  int rc = pthread_create(&tid, &attr, fn, NULL);
+  pthread_attr_destroy(&attr);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  return 0;
+}
+
+/* io_uring backend, driven by raw syscalls */
+
+static int ring_enter(
+    unsigned to_submit,
+    unsigned min_complete,
+    unsigned flags
+) {
+  return (int)syscall(
+      __NR_io_uring_enter, g_ring.fd, to_submit, min_complete, flags, NULL, 0
+  );
+}
+
+static void sync_complete(aio_req_t *req);
+static void ring_deliver(aio_req_t *r);
+
+/* Moves queued requests into free SQEs, never more than the CQ can hold,
+ * and submits them with a single io_uring_enter. If that fails, the SQEs
+ * the kernel did not take are withdrawn and their requests handed to the
+ * fallback thread. */
+static void ring_push_locked(void) {
+  ring_t *rg = &g_ring;
+  unsigned tail = *rg->sq_tail;
+  unsigned head = __atomic_load_n(rg->sq_head, __ATOMIC_ACQUIRE);
+
+  while (g_head && g_ring_inflight < rg->cq_entries &&
+         tail - head < rg->sq_entries) {
+    aio_req_t *r = queue_pop();
+    unsigned idx = tail & *rg->sq_mask;
+    struct io_uring_sqe *sqe = &rg->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (r->op == AIO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = r->fd;
+    sqe->off = (uint64_t)r->offset;
+    sqe->addr = (uint64_t)(uintptr_t)r->iov;
+    sqe->len = (uint32_t)r->iovcnt;
+    sqe->user_data = (uint64_t)(uintptr_t)r;
+    rg->sq_array[idx] = idx;
+    tail++;
+    g_ring_inflight++;
+    g_ring_unsubmitted++;
+  }
+  __atomic_store_n(rg->sq_tail, tail, __ATOMIC_RELEASE);
+
+  while (g_ring_unsubmitted > 0) {
+    int n = ring_enter(g_ring_unsubmitted, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    g_ring_unsubmitted -= (unsigned)n;
+  }
+  if (g_ring_unsubmitted == 0) return;
+
+  unsigned first = tail - g_ring_unsubmitted;
+  __atomic_store_n(rg->sq_tail, first, __ATOMIC_RELEASE);
+  g_ring_inflight -= g_ring_unsubmitted;
+  g_ring_unsubmitted = 0;
+  for (unsigned t = first; t != tail; t++) {
+    struct io_uring_sqe *sqe = &rg->sqes[t & *rg->sq_mask];
+    aio_req_t *r = (aio_req_t *)(uintptr_t)sqe->user_data;
+    r->next = g_fb_head;
+    g_fb_head = r;
+  }
+  pthread_cond_signal(&g_fb);
+}
+
+/* Accounts one completion; returns 0 if the request was queued again. */
+static int ring_settle(aio_req_t *r, int res) {
+  if (res == -EINTR || res == -EAGAIN) {
+    queue_push_front(r);
+    return 0;
+  }
+  if (res < 0) {
+    if (r->result == 0) r->result = -1;
+    r->err = -res;
+    return 1;
+  }
+
+  r->result += res;
+  if (r->op == AIO_WRITE && res > 0 && advance(r, (size_t)res) > 0) {
+    queue_push_front(r);
+    return 0;
+  }
+  return 1;
+}
+
+static void *dispatcher(void *arg) {
+  (void)arg;
+  aio_own_thread = 1;
+  pthread_mutex_lock(&g_lock);
+  for (;;) {
+    aio_req_t *r = g_cb_head;
+    if (!r) {
+      pthread_cond_wait(&g_cb, &g_lock);
+      continue;
+    }
+    g_cb_head = r->next;
+    pthread_mutex_unlock(&g_lock);
+
+    r->complete(r);
+
+    pthread_mutex_lock(&g_lock);
+  }
+  return NULL;
+}
+
+/* Runs a request the ring would not take as the worker backend would, on
+ * top of whatever part of it the ring did already. */
+static void *fallback(void *arg) {
+  (void)arg;
+  aio_own_thread = 1;
+  pthread_mutex_lock(&g_lock);
+  for (;;) {
+    aio_req_t *r = g_fb_head;
+    if (!r) {
+      pthread_cond_wait(&g_fb, &g_lock);
+      continue;
+    }
+    g_fb_head = r->next;
+    pthread_mutex_unlock(&g_lock);
+
+    ssize_t prior = r->result;
+    run_now(r);
+    if (r->result >= 0) {
+      r->result += prior;
+    } else if (prior > 0) {
+      r->result = prior;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    ring_deliver(r);
+  }
+  return NULL;
+}
+
+static void sync_complete(aio_req_t *req) {
+  req->done = 1;
+  pthread_cond_broadcast(&g_sync);
+}
+
+/* Hands a finished request to its waiter or to the dispatcher. */
+static void ring_deliver(aio_req_t *r) {
+  if (r->complete == sync_complete) {
+    sync_complete(r);
+  } else {
+    r->next = g_cb_head;
+    g_cb_head = r;
+    pthread_cond_signal(&g_cb);
+  }
+}
+
+static void *reaper(void *arg) {
+  (void)arg;
+  aio_own_thread = 1;
+  ring_t *rg = &g_ring;
+  for (;;) {
+    (void)ring_enter(0, 1, IORING_ENTER_GETEVENTS);
+
+    pthread_mutex_lock(&g_lock);
+    unsigned head = *rg->cq_head;
+    unsigned tail = __atomic_load_n(rg->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &rg->cqes[head & *rg->cq_mask];
+      aio_req_t *r = (aio_req_t *)(uintptr_t)cqe->user_data;
+      head++;
+      g_ring_inflight--;
+      if (ring_settle(r, cqe->res)) ring_deliver(r);
+    }
+    __atomic_store_n(rg->cq_head, head, __ATOMIC_RELEASE);
+    ring_push_locked();
+    pthread_mutex_unlock(&g_lock);
+  }
+  return NULL;
+}
+
+/* The ring is only used if the kernel has vectored reads and writes on
+ * it, which kernels without IORING_REGISTER_PROBE are not asked about. */
+static int ring_probe(int fd) {
+  unsigned nops = IORING_OP_WRITEV + 1u;
+  struct io_uring_probe *probe = (struct io_uring_probe *)calloc(
+      1, sizeof(*probe) + nops * sizeof(struct io_uring_probe_op)
+  );
+  if (!probe) return -1;
+  int ok = syscall(
+               __NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nops
+           ) == 0 &&
+           probe->ops_len > IORING_OP_WRITEV &&
+           (probe->ops[IORING_OP_READV].flags & IO_URING_OP_SUPPORTED) &&
+           (probe->ops[IORING_OP_WRITEV].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok ? 0 : -1;
+}
+
+static int ring_setup(void) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if (fd < 0) return -1;
+  if (ring_probe(fd) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && cq_len > sq_len) sq_len = cq_len;
+
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_SHARED | MAP_POPULATE;
+  char *sq = mmap(NULL, sq_len, prot, flags, fd, IORING_OFF_SQ_RING);
+  char *cq = sq;
+  if (sq != MAP_FAILED && !single) {
+    cq = mmap(NULL, cq_len, prot, flags, fd, IORING_OFF_CQ_RING);
+  }
+  void *sqes = MAP_FAILED;
+  if (sq != MAP_FAILED && cq != MAP_FAILED) {
+    sqes = mmap(
+        NULL,
+        p.sq_entries * sizeof(struct io_uring_sqe),
+        prot,
+        flags,
+        fd,
+        IORING_OFF_SQES
+    );
+  }
+  if (sqes == MAP_FAILED) {
+    if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_len);
+    if (sq != MAP_FAILED) munmap(sq, sq_len);
+    close(fd);
+    return -1;
+  }
+
+  ring_t *rg = &g_ring;
+  rg->fd = fd;
+  rg->sq_head = (unsigned *)(sq + p.sq_off.head);
+  rg->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  rg->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  rg->sq_array = (unsigned *)(sq + p.sq_off.array);
+  rg->sq_entries = p.sq_entries;
+  rg->sqes = (struct io_uring_sqe *)sqes;
+  rg->cq_head = (unsigned *)(cq + p.cq_off.head);
+  rg->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  rg->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  rg->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  rg->cq_entries = p.cq_entries;
+
+  if (start_thread(dispatcher) != 0 || start_thread(fallback) != 0 ||
+      start_thread(reaper) != 0) {
+    munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+    if (cq != sq) munmap(cq, cq_len);
+    munmap(sq, sq_len);
+    close(fd);
+    return -1;
+  }
+  return 0;
+}
+
+static void backend_init(void) {
+  const char *env = getenv("VTPC_IO_URING");
+  if (env && strcmp(env, "0") == 0) return;
+  g_uring = (ring_setup() == 0);
+}
+
+int aio_submit(aio_req_t *req) {
+  if (req->iovcnt <= 0 || req->iovcnt > AIO_MAX_VEC || !req->complete) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_once(&g_once, backend_init);
+
+  pthread_mutex_lock(&g_lock);
+  if (!g_uring && !g_started) {
+    if (start_thread(worker) != 0) {
+      pthread_mutex_unlock(&g_lock);
+      return -1;
+    }
+    g_started = 1;
+  }
+
+  req->result = 0;
+  req->err = 0;
+  queue_push(req);
+  if (g_uring) {
+    ring_push_locked();
+  } else {
+    pthread_cond_signal(&g_queued);
+  }
+  pthread_mutex_unlock(&g_lock);
+  return 0;
+}
+
+void aio_run_all(aio_req_t **reqs, int n) {
+  pthread_once(&g_once, backend_init);
+  if (!g_uring) {
+    for (int i = 0; i < n; i++) run_now(reqs[i]);
+    return;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  for (int i = 0; i < n; i++) {
+    reqs[i]->complete = sync_complete;
+    reqs[i]->result = 0;
+    reqs[i]->err = 0;
+    reqs[i]->done = 0;
+    queue_push(reqs[i]);
+  }
+  ring_push_locked();
+  for (int i = 0; i < n; i++) {
+    while (!reqs[i]->done) pthread_cond_wait(&g_sync, &g_lock);
+  }
+  pthread_mutex_unlock(&g_lock);
+}
+
+ssize_t aio_run(aio_req_t *req) {
+  aio_run_all(&req, 1);
+  if (req->result < 0) errno = req->err;
+  return req->result;
+}
+
+const char *aio_backend(void) {
+  pthread_once(&g_once, backend_init);
+  return g_uring ? "io_uring" : "thread";
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Vectored disk I/O. Requests are owned by the caller and go through
+ * io_uring when the kernel allows it and has vectored reads and writes on
+ * it (VTPC_IO_URING=0 turns it off), or else through a background worker
+ * doing preadv/pwritev. A read stops at
+ * the first short transfer, as at EOF; a short write is resumed, so iov
+ * may be modified. result is the byte count or -1 with err set.
+ */
+
+#define AIO_MAX_VEC 64
+
+typedef enum { AIO_READ = 0, AIO_WRITE = 1 } aio_op_t;
+
+typedef struct aio_req aio_req_t;
+
+struct aio_req {
+  aio_op_t op;
+  int fd;
+  off_t offset;
+  int iovcnt;
+  struct iovec iov[AIO_MAX_VEC];
+  void (*complete)(aio_req_t *req);
+
+  /* Filled in before complete() is called. */
+  ssize_t result;
+  int err;
+
+  aio_req_t *next;
+  int done;
+};
+
+/* Queues req; complete() later runs on an I/O thread that holds no locks.
+ * Returns -1 with errno set if the request cannot be queued. */
+int aio_submit(aio_req_t *req);
+
+/* Issues the n requests together and waits for all of them; complete is
+ * not used. With the worker backend they run on the calling thread. */
+void aio_run_all(aio_req_t **reqs, int n);
+
+/* aio_run_all() for one request; returns its result with errno set. */
+ssize_t aio_run(aio_req_t *req);
+
+const char *aio_backend(void);
+
+/* Set on the threads vtpc starts, these and its flusher, so the LD_PRELOAD
+ * shim sends their file calls straight to libc. */
+extern __thread int aio_own_thread;
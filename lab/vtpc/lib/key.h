@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Pages are keyed by file identity, so every handle of a file shares them
+ * and they outlive the handles. */
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t page_no;
+} page_key_t;
+
+static inline uint64_t hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static inline uint64_t key_hash(page_key_t k) {
+  uint64_t x = (k.ino * 0x9e3779b97f4a7c15ULL) ^
+               (k.dev * 0xc2b2ae3d27d4eb4fULL) ^ k.page_no;
+  return hash_u64(x);
+}
+
+static inline int key_eq(page_key_t a, page_key_t b) {
+  return (a.page_no == b.page_no) && (a.ino == b.ino) && (a.dev == b.dev);
+}
@@ -0,0 +1,128 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4u
+#define LZ_MAX_OFFSET 65535u
+
+static uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the bytes of a length past its nibble; NULL if out of room. */
+static unsigned char *put_len(unsigned char *op, const unsigned char *end, size_t len) {
+  for (; len >= 255; len -= 255) {
+    if (op == end) return NULL;
+    *op++ = 255;
+  }
+  if (op == end) return NULL;
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+/* One sequence; mlen 0 makes it the last, with literals only. */
+static unsigned char *put_seq(unsigned char *op, const unsigned char *end, const unsigned char *lit, size_t nlit, size_t off, size_t mlen) {
+  if (op == end) return NULL;
+  size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+  *op++ = (unsigned char)(((nlit < 15 ? nlit : 15) << 4) | (mcode < 15 ? mcode : 15));
+  if (nlit >= 15 && !(op = put_len(op, end, nlit - 15))) return NULL;
+  if ((size_t)(end - op) < nlit) return NULL;
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (mlen == 0) return op;
+
+  if (end - op < 2) return NULL;
+  *op++ = (unsigned char)(off & 0xff);
+  *op++ = (unsigned char)(off >> 8);
+  if (mcode >= 15 && !(op = put_len(op, end, mcode - 15))) return NULL;
+  return op;
+}
+
+size_t lz_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap) {
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *op = (unsigned char *)dst;
+  const unsigned char *end = op + cap;
+  uint32_t table[1u << LZ_HASH_BITS]; /* position + 1, 0 for none */
+  memset(table, 0, sizeof(table));
+
+  size_t ip = 0;
+  size_t anchor = 0;
+  while (n >= LZ_MIN_MATCH && ip <= n - LZ_MIN_MATCH) {
+    uint32_t v = read32(in + ip);
+    uint32_t h = hash4(v);
+    size_t cand = table[h];
+    table[h] = (uint32_t)(ip + 1);
+    if (cand == 0 || ip - (cand - 1) > LZ_MAX_OFFSET ||
+        read32(in + cand - 1) != v) {
+      ip++;
+      continue;
+    }
+
+    size_t from = cand - 1;
+    size_t len = LZ_MIN_MATCH;
+    while (ip + len < n && in[from + len] == in[ip + len]) len++;
+    op = put_seq(op, end, in + anchor, ip - anchor, ip - from, len);
+    if (!op) return 0;
+    ip += len;
+    anchor = ip;
+  }
+
+  op = put_seq(op, end, in + anchor, n - anchor, 0, 0);
+  if (!op) return 0;
+  return (size_t)(op - (unsigned char *)dst);
+}
+
+/* Reads the bytes of a length past its nibble into *len. */
+static int get_len(const unsigned char *in, size_t n, size_t *ip, size_t *len) {
+  unsigned char b;
+  do {
+    if (*ip >= n) return -1;
+    b = in[(*ip)++];
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+int lz_decompress(const void *src, size_t len, void *dst, size_t n) {
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  size_t ip = 0;
+  size_t op = 0;
+
+  /* Only a last sequence of literals ends the block. */
+  for (;;) {
+    if (ip >= len) return -1;
+    unsigned token = in[ip++];
+    size_t nlit = token >> 4;
+    if (nlit == 15 && get_len(in, len, &ip, &nlit) != 0) return -1;
+    if (nlit > len - ip || nlit > n - op) return -1;
+    memcpy(out + op, in + ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == len) break;
+
+    if (len - ip < 2) return -1;
+    size_t off = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+    ip += 2;
+    size_t mlen = token & 15u;
+    if (mlen == 15 && get_len(in, len, &ip, &mlen) != 0) return -1;
+    mlen += LZ_MIN_MATCH;
+    if (off == 0 || off > op || mlen > n - op) return -1;
+    /* Byte by byte, since a match may overlap what it copies. */
+    for (size_t i = 0; i < mlen; i++) out[op + i] = out[op - off + i];
+    op += mlen;
+  }
+  return (op == n) ? 0 : -1;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A small LZ77 codec for pages, laid out like LZ4 blocks. Each sequence is
+ * a token byte with the literal count in its high nibble and the match
+ * length less 4 in the low one, 15 in either meaning that length bytes
+ * follow, each added in until one is not 255; then the literals, then a
+ * 2-byte little-endian match offset. The last sequence has literals only.
+ * Matches are found through a hash of the next 4 bytes, one candidate per
+ * bucket, which trades ratio for speed.
+ */
+
+/* The most lz_compress() can need for n bytes. */
+size_t lz_bound(size_t n);
+
+/* Returns the compressed size, or 0 if it would not fit in cap. */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap);
+
+/* Returns 0 if src decodes to exactly n bytes, -1 if it is malformed. */
+int lz_decompress(const void *src, size_t len, void *dst, size_t n);
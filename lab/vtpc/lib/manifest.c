@@ -0,0 +1,232 @@
+#include "manifest.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  manifest_file_t file; /* npages counts pages */
+  manifest_page_t *pages;
+  int loaded; /* read from disk and not claimed yet */
+} entry_t;
+
+struct manifest {
+  pthread_mutex_t lock;
+  char *path;
+  uint32_t page_size;
+  entry_t *ents;
+  size_t nents;
+  size_t cap;
+};
+
+static entry_t *find_locked(manifest_t *m, uint64_t dev, uint64_t ino) {
+  for (size_t i = 0; i < m->nents; i++) {
+    if (m->ents[i].file.dev == dev && m->ents[i].file.ino == ino) {
+      return &m->ents[i];
+    }
+  }
+  return NULL;
+}
+
+static void remove_locked(manifest_t *m, entry_t *e) {
+  free(e->pages);
+  *e = m->ents[--m->nents];
+}
+
+static entry_t *add_locked(manifest_t *m) {
+  if (m->nents == m->cap) {
+    size_t cap = m->cap ? m->cap * 2 : 16;
+    entry_t *ents = (entry_t *)realloc(m->ents, cap * sizeof(entry_t));
+    if (!ents) return NULL;
+    m->ents = ents;
+    m->cap = cap;
+  }
+  entry_t *e = &m->ents[m->nents++];
+  memset(e, 0, sizeof(*e));
+  return e;
+}
+
+/* Reads what it can; a short or foreign file leaves the rest out. */
+static void load(manifest_t *m) {
+  FILE *in = fopen(m->path, "rb");
+  if (!in) return;
+  manifest_header_t h;
+  if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != MANIFEST_MAGIC ||
+      h.version != MANIFEST_VERSION || h.page_size != m->page_size) {
+    fclose(in);
+    return;
+  }
+  for (uint64_t i = 0; i < h.nfiles; i++) {
+    manifest_file_t f;
+    if (fread(&f, sizeof(f), 1, in) != 1 || f.npages > UINT32_MAX) break;
+    manifest_page_t *pages =
+        (manifest_page_t *)malloc((f.npages ? f.npages : 1) * sizeof(*pages));
+    if (!pages) break;
+    if (fread(pages, sizeof(*pages), f.npages, in) != f.npages) {
+      free(pages);
+      break;
+    }
+    entry_t *e = find_locked(m, f.dev, f.ino);
+    if (e) remove_locked(m, e);
+    if (!(e = add_locked(m))) {
+      free(pages);
+      break;
+    }
+    e->file = f;
+    e->pages = pages;
+    e->loaded = 1;
+  }
+  fclose(in);
+}
+
+manifest_t *manifest_open(const char *path, uint32_t page_size) {
+  manifest_t *m = (manifest_t *)calloc(1, sizeof(*m));
+  if (!m) return NULL;
+  m->path = strdup(path);
+  if (!m->path) {
+    free(m);
+    errno = ENOMEM;
+    return NULL;
+  }
+  m->page_size = page_size;
+  pthread_mutex_init(&m->lock, NULL);
+  load(m);
+  return m;
+}
+
+void manifest_close(manifest_t *m) {
+  if (!m) return;
+  for (size_t i = 0; i < m->nents; i++) free(m->ents[i].pages);
+  free(m->ents);
+  free(m->path);
+  pthread_mutex_destroy(&m->lock);
+  free(m);
+}
+
+int manifest_save(manifest_t *m) {
+  pthread_mutex_lock(&m->lock);
+  size_t len = strlen(m->path);
+  char *tmp = (char *)malloc(len + sizeof(".tmp"));
+  FILE *out = NULL;
+  if (tmp) {
+    memcpy(tmp, m->path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+    out = fopen(tmp, "wb");
+  }
+  if (!out) {
+    int saved = tmp ? errno : ENOMEM;
+    pthread_mutex_unlock(&m->lock);
+    free(tmp);
+    errno = saved;
+    return -1;
+  }
+
+  manifest_header_t h = {
+      .magic = MANIFEST_MAGIC,
+      .version = MANIFEST_VERSION,
+      .page_size = m->page_size,
+      .nfiles = m->nents,
+  };
+  int ok = fwrite(&h, sizeof(h), 1, out) == 1;
+  for (size_t i = 0; ok && i < m->nents; i++) {
+    const entry_t *e = &m->ents[i];
+    ok = fwrite(&e->file, sizeof(e->file), 1, out) == 1 &&
+         fwrite(e->pages, sizeof(*e->pages), e->file.npages, out) ==
+             e->file.npages;
+  }
+  ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+  if (fclose(out) != 0) ok = 0;
+  ok = ok && rename(tmp, m->path) == 0;
+  int saved = errno;
+  if (!ok) (void)unlink(tmp);
+  pthread_mutex_unlock(&m->lock);
+  free(tmp);
+  if (!ok) {
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+int manifest_record(manifest_t *m, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime, const manifest_page_t *pages, uint32_t n) {
+  manifest_page_t *copy = NULL;
+  if (n > 0) {
+    copy = (manifest_page_t *)malloc(n * sizeof(*copy));
+    if (!copy) {
+      errno = ENOMEM;
+      return -1;
+    }
+    memcpy(copy, pages, n * sizeof(*copy));
+  }
+
+  pthread_mutex_lock(&m->lock);
+  entry_t *e = find_locked(m, dev, ino);
+  if (e) remove_locked(m, e);
+  if (n > 0 && !(e = add_locked(m))) {
+    pthread_mutex_unlock(&m->lock);
+    free(copy);
+    errno = ENOMEM;
+    return -1;
+  }
+  if (n > 0) {
+    e->file = (manifest_file_t){
+        .dev = dev,
+        .ino = ino,
+        .size = size,
+        .mtime_sec = mtime.tv_sec,
+        .mtime_nsec = mtime.tv_nsec,
+        .npages = n,
+    };
+    e->pages = copy;
+  }
+  pthread_mutex_unlock(&m->lock);
+  return 0;
+}
+
+static int by_hotness(const void *a, const void *b) {
+  uint64_t x = ((const manifest_page_t *)a)->hotness;
+  uint64_t y = ((const manifest_page_t *)b)->hotness;
+  return (x < y) - (x > y);
+}
+
+static int by_page(const void *a, const void *b) {
+  uint64_t x = ((const manifest_page_t *)a)->page_no;
+  uint64_t y = ((const manifest_page_t *)b)->page_no;
+  return (x > y) - (x < y);
+}
+
+uint32_t manifest_claim(manifest_t *m, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime, uint32_t max, uint64_t **pages) {
+  *pages = NULL;
+  pthread_mutex_lock(&m->lock);
+  entry_t *e = find_locked(m, dev, ino);
+  if (!e || !e->loaded) {
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+  }
+  if (e->file.size != size || e->file.mtime_sec != mtime.tv_sec ||
+      e->file.mtime_nsec != mtime.tv_nsec) {
+    remove_locked(m, e);
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+  }
+  e->loaded = 0;
+
+  uint32_t n = (uint32_t)e->file.npages;
+  if (n > max) {
+    qsort(e->pages, n, sizeof(*e->pages), by_hotness);
+    n = max;
+    qsort(e->pages, n, sizeof(*e->pages), by_page);
+  }
+  uint64_t *out = (n > 0) ? (uint64_t *)malloc(n * sizeof(*out)) : NULL;
+  if (out) {
+    for (uint32_t i = 0; i < n; i++) out[i] = e->pages[i].page_no;
+  }
+  /* Only what was handed out is saved again. */
+  e->file.npages = n;
+  pthread_mutex_unlock(&m->lock);
+  *pages = out;
+  return out ? n : 0;
+}
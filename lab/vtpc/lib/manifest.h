@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * A warm-cache manifest: the pages an instance held of each file, kept in
+ * a file so a later run can read them in again ahead of use. The file is a
+ * manifest_header_t, then per file a manifest_file_t followed by npages
+ * manifest_page_t in page order. Each file carries the size and mtime it
+ * had when recorded, and its pages are only handed out while it still has
+ * them. The manifest is rewritten whole, through a temporary file renamed
+ * over it, so a reader never sees it half written.
+ */
+
+#define MANIFEST_MAGIC 0x316e616d63707476ull /* "vtpcman1" */
+#define MANIFEST_VERSION 1u
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint64_t nfiles;
+} manifest_header_t;
+
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t npages;
+} manifest_file_t;
+
+typedef struct {
+  uint64_t page_no;
+  uint64_t hotness; /* hits while resident */
+} manifest_page_t;
+
+typedef struct manifest manifest_t;
+
+/* Loads the manifest at path, if there is one of page_size pages, and
+ * saves to it later. One that cannot be read is treated as empty. */
+manifest_t *manifest_open(const char *path, uint32_t page_size);
+void manifest_close(manifest_t *m);
+int manifest_save(manifest_t *m);
+
+/* Replaces the pages recorded for the file, which must be in page order;
+ * n == 0 forgets it. Returns -1 with errno set if out of memory. */
+int manifest_record(manifest_t *m, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime, const manifest_page_t *pages, uint32_t n);
+
+/* Hands out, once, the pages loaded for the file if it still has the
+ * recorded size and mtime: up to max of the hottest, in page order, into
+ * a malloc()ed *pages. A file that changed is forgotten. */
+uint32_t manifest_claim(manifest_t *m, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime, uint32_t max, uint64_t **pages);
@@ -0,0 +1,98 @@
+#include "pageset.h"
+
+#include "key.h"
+
+#define NIL (-1)
+
+static uint64_t prio(const pset_node_t *nodes, int32_t n) {
+  return hash_u64(nodes[n].key ^ 0x9e3779b97f4a7c15ULL);
+}
+
+static int32_t merge(pset_node_t *nodes, int32_t a, int32_t b) {
+  if (a == NIL) return b;
+  if (b == NIL) return a;
+  if (prio(nodes, a) > prio(nodes, b)) {
+    nodes[a].right = merge(nodes, nodes[a].right, b);
+    return a;
+  }
+  nodes[b].left = merge(nodes, a, nodes[b].left);
+  return b;
+}
+
+/* Keys < key go to *l, the rest to *r. */
+static void split(
+    pset_node_t *nodes,
+    int32_t t,
+    uint64_t key,
+    int32_t *l,
+    int32_t *r
+) {
+  if (t == NIL) {
+    *l = NIL;
+    *r = NIL;
+    return;
+  }
+  if (nodes[t].key < key) {
+    split(nodes, nodes[t].right, key, &nodes[t].right, r);
+    *l = t;
+  } else {
+    split(nodes, nodes[t].left, key, l, &nodes[t].left);
+    *r = t;
+  }
+}
+
+void pset_init(pset_t *set) {
+  set->root = NIL;
+  set->size = 0;
+}
+
+void pset_insert(pset_t *set, pset_node_t *nodes, int32_t n, uint64_t key) {
+  nodes[n].left = NIL;
+  nodes[n].right = NIL;
+  nodes[n].key = key;
+
+  int32_t l = NIL;
+  int32_t r = NIL;
+  split(nodes, set->root, key, &l, &r);
+  set->root = merge(nodes, merge(nodes, l, n), r);
+  set->size++;
+}
+
+void pset_erase(pset_t *set, pset_node_t *nodes, int32_t n) {
+  int32_t *link = &set->root;
+  while (*link != NIL && *link != n) {
+    link = (nodes[n].key < nodes[*link].key) ? &nodes[*link].left
+                                             : &nodes[*link].right;
+  }
+  if (*link != n) return;
+
+  *link = merge(nodes, nodes[n].left, nodes[n].right);
+  nodes[n].left = NIL;
+  nodes[n].right = NIL;
+  set->size--;
+}
+
+int32_t pset_first(const pset_t *set, const pset_node_t *nodes) {
+  int32_t t = set->root;
+  if (t == NIL) return NIL;
+  while (nodes[t].left != NIL) t = nodes[t].left;
+  return t;
+}
+
+int32_t pset_lower_bound(
+    const pset_t *set,
+    const pset_node_t *nodes,
+    uint64_t key
+) {
+  int32_t best = NIL;
+  int32_t t = set->root;
+  while (t != NIL) {
+    if (nodes[t].key >= key) {
+      best = t;
+      t = nodes[t].left;
+    } else {
+      t = nodes[t].right;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Ordered set of slots keyed by page number: an intrusive treap whose nodes
+ * live in a caller-owned array indexed by slot. Priorities are derived from
+ * the key, so nodes carry no extra state. All operations are O(log n).
+ */
+
+typedef struct {
+  int32_t left;
+  int32_t right;
+  uint64_t key;
+} pset_node_t;
+
+typedef struct {
+  int32_t root;
+  uint32_t size;
+} pset_t;
+
+void pset_init(pset_t *set);
+void pset_insert(pset_t *set, pset_node_t *nodes, int32_t n, uint64_t key);
+void pset_erase(pset_t *set, pset_node_t *nodes, int32_t n);
+int32_t pset_first(const pset_t *set, const pset_node_t *nodes);
+int32_t pset_lower_bound(
+    const pset_t *set,
+    const pset_node_t *nodes,
+    uint64_t key
+);
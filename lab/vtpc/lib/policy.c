@@ -0,0 +1,710 @@
+#include "policy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define NIL (-1)
+
+/* Meaning of lists[] per policy:
+ *   LRU:   0 = resident, MRU at head
+ *   CLOCK: 0 = ring, scanned from hand towards tail
+ *   2Q:    0 = A1in (FIFO), 1 = Am (LRU), 2 = A1out (ghost FIFO)
+ *   ARC:   0 = T1, 1 = T2, 2 = B1 (ghost), 3 = B2 (ghost)
+ *   OPT:   0 = pages without a hint, MRU at head; 1 = hinted pages, kept
+ *          in a max-heap on the next access time instead of a list
+ */
+enum { L_T1 = 0, L_T2 = 1, L_B1 = 2, L_B2 = 3 };
+enum { L_A1IN = 0, L_AM = 1, L_A1OUT = 2 };
+enum { L_RECENT = 0, L_HINTED = 1 };
+
+enum {
+  PEND_GHOST = 1,   /* incoming key was found in a ghost list */
+  PEND_IN_B2 = 2,   /* ARC: ... and that list was B2 */
+  PEND_DROP_T1 = 4, /* ARC: L1 is full of residents, drop T1 LRU unghosted */
+};
+
+typedef struct {
+  int32_t head;
+  int32_t tail;
+  uint32_t size;
+} plist_t;
+
+typedef struct {
+  int32_t prev;
+  int32_t next;
+  int32_t hnext;
+  uint8_t list;   /* 0 = unlinked, otherwise list index + 1 */
+  uint8_t pinned; /* list to return to on unpin, same encoding */
+  uint8_t ref;
+  page_key_t key;
+  uint64_t when; /* OPT: hinted next access */
+} pnode_t;
+
+struct policy {
+  policy_kind_t kind;
+  uint32_t capacity;
+  uint32_t ghost_cap;
+  uint32_t nbuckets;
+  size_t nodes_off;
+  size_t buckets_off;
+  size_t dense_off;
+  size_t total_size;
+
+  plist_t lists[4];
+  int32_t ghost_free;
+  int pending;
+
+  int32_t hand;    /* CLOCK */
+  uint32_t ndense; /* RANDOM, OPT heap size */
+  uint32_t rng;    /* RANDOM */
+  uint32_t kin;    /* 2Q */
+  uint32_t kout;   /* 2Q */
+  uint32_t arc_p;  /* ARC */
+  uint64_t soonest; /* OPT: no hint in the heap is for before this */
+};
+
+static const char *const k_names[] = {
+    [POLICY_RANDOM] = "random",
+    [POLICY_LRU] = "lru",
+    [POLICY_CLOCK] = "clock",
+    [POLICY_2Q] = "2q",
+    [POLICY_ARC] = "arc",
+    [POLICY_OPT] = "opt",
+};
+
+static size_t align_up(size_t x) {
+  return (x + 15u) & ~(size_t)15u;
+}
+
+static pnode_t *nodes(policy_t *p) {
+  return (pnode_t *)((char *)p + p->nodes_off);
+}
+
+static int32_t *buckets(policy_t *p) {
+  return (int32_t *)((char *)p + p->buckets_off);
+}
+
+static int32_t *dense(policy_t *p) {
+  return (int32_t *)((char *)p + p->dense_off);
+}
+
+static uint32_t ghost_capacity(policy_kind_t kind, uint32_t capacity) {
+  switch (kind) {
+    case POLICY_2Q:
+      return (capacity / 2u > 0) ? capacity / 2u : 1u;
+    case POLICY_ARC:
+      return capacity * 2u;
+    default:
+      return 0;
+  }
+}
+
+static uint32_t bucket_count(uint32_t ghost_cap) {
+  uint32_t n = 1;
+  while (n < ghost_cap * 2u) n <<= 1u;
+  return n;
+}
+
+/* Intrusive lists */
+
+static void list_push_front(policy_t *p, int l, int32_t n) {
+  pnode_t *ns = nodes(p);
+  plist_t *lst = &p->lists[l];
+  ns[n].prev = NIL;
+  ns[n].next = lst->head;
+  ns[n].list = (uint8_t)(l + 1);
+  if (lst->head != NIL) ns[lst->head].prev = n;
+  lst->head = n;
+  if (lst->tail == NIL) lst->tail = n;
+  lst->size++;
+}
+
+static void list_push_back(policy_t *p, int l, int32_t n) {
+  pnode_t *ns = nodes(p);
+  plist_t *lst = &p->lists[l];
+  ns[n].next = NIL;
+  ns[n].prev = lst->tail;
+  ns[n].list = (uint8_t)(l + 1);
+  if (lst->tail != NIL) ns[lst->tail].next = n;
+  lst->tail = n;
+  if (lst->head == NIL) lst->head = n;
+  lst->size++;
+}
+
+static void list_insert_before(policy_t *p, int l, int32_t at, int32_t n) {
+  pnode_t *ns = nodes(p);
+  plist_t *lst = &p->lists[l];
+  if (at == NIL || at == lst->head) {
+    list_push_front(p, l, n);
+    return;
+  }
+  ns[n].next = at;
+  ns[n].prev = ns[at].prev;
+  ns[n].list = (uint8_t)(l + 1);
+  ns[ns[at].prev].next = n;
+  ns[at].prev = n;
+  lst->size++;
+}
+
+static void list_unlink(policy_t *p, int32_t n) {
+  pnode_t *ns = nodes(p);
+  if (ns[n].list == 0) return;
+  plist_t *lst = &p->lists[ns[n].list - 1];
+  if (ns[n].prev != NIL) {
+    ns[ns[n].prev].next = ns[n].next;
+  } else {
+    lst->head = ns[n].next;
+  }
+  if (ns[n].next != NIL) {
+    ns[ns[n].next].prev = ns[n].prev;
+  } else {
+    lst->tail = ns[n].prev;
+  }
+  ns[n].prev = NIL;
+  ns[n].next = NIL;
+  ns[n].list = 0;
+  lst->size--;
+}
+
+static int list_of(policy_t *p, int32_t n) {
+  return (int)nodes(p)[n].list - 1;
+}
+
+/* Ghost directory: keys of recently evicted pages, hashed for O(1) lookup */
+
+static int32_t ghost_find(policy_t *p, page_key_t key) {
+  if (p->ghost_cap == 0) return NIL;
+  pnode_t *ns = nodes(p);
+  uint32_t b = (uint32_t)(key_hash(key) & (p->nbuckets - 1u));
+  for (int32_t g = buckets(p)[b]; g != NIL; g = ns[g].hnext) {
+    if (key_eq(ns[g].key, key)) return g;
+  }
+  return NIL;
+}
+
+static void ghost_drop(policy_t *p, int32_t g) {
+  pnode_t *ns = nodes(p);
+  uint32_t b = (uint32_t)(key_hash(ns[g].key) & (p->nbuckets - 1u));
+  int32_t *link = &buckets(p)[b];
+  while (*link != NIL && *link != g) link = &ns[*link].hnext;
+  if (*link == g) *link = ns[g].hnext;
+
+  list_unlink(p, g);
+  ns[g].hnext = NIL;
+  ns[g].next = p->ghost_free;
+  p->ghost_free = g;
+}
+
+static void ghost_push(policy_t *p, int l, page_key_t key) {
+  if (p->ghost_cap == 0) return;
+  if (p->ghost_free == NIL) {
+    int32_t old = p->lists[l].tail;
+    if (old == NIL) return;
+    ghost_drop(p, old);
+  }
+
+  pnode_t *ns = nodes(p);
+  int32_t g = p->ghost_free;
+  p->ghost_free = ns[g].next;
+
+  ns[g].key = key;
+  uint32_t b = (uint32_t)(key_hash(key) & (p->nbuckets - 1u));
+  ns[g].hnext = buckets(p)[b];
+  buckets(p)[b] = g;
+  list_push_front(p, l, g);
+}
+
+/* RANDOM */
+
+static int random_victim(policy_t *p) {
+  if (p->ndense == 0) return NIL;
+  p->rng = p->rng * 1103515245u + 12345u;
+  int32_t slot = dense(p)[p->rng % p->ndense];
+  policy_remove(p, slot);
+  return slot;
+}
+
+/* CLOCK */
+
+static int clock_victim(policy_t *p) {
+  pnode_t *ns = nodes(p);
+  plist_t *ring = &p->lists[0];
+  if (ring->size == 0) return NIL;
+
+  for (;;) {
+    int32_t n = (p->hand != NIL) ? p->hand : ring->head;
+    p->hand = (ns[n].next != NIL) ? ns[n].next : ring->head;
+    if (ns[n].ref) {
+      ns[n].ref = 0;
+      continue;
+    }
+    policy_remove(p, n);
+    return n;
+  }
+}
+
+/* 2Q */
+
+static void twoq_miss(policy_t *p, page_key_t key) {
+  int32_t g = ghost_find(p, key);
+  if (g != NIL) {
+    p->pending = PEND_GHOST;
+    ghost_drop(p, g);
+  }
+}
+
+static int twoq_victim(policy_t *p) {
+  plist_t *a1in = &p->lists[L_A1IN];
+  plist_t *am = &p->lists[L_AM];
+
+  if (a1in->size > 0 && (a1in->size > p->kin || am->size == 0)) {
+    int32_t n = a1in->tail;
+    page_key_t key = nodes(p)[n].key;
+    list_unlink(p, n);
+    if (p->lists[L_A1OUT].size >= p->kout) {
+      ghost_drop(p, p->lists[L_A1OUT].tail);
+    }
+    ghost_push(p, L_A1OUT, key);
+    return n;
+  }
+  if (am->size == 0) return NIL;
+
+  int32_t n = am->tail;
+  list_unlink(p, n);
+  return n;
+}
+
+/* ARC */
+
+static void arc_miss(policy_t *p, page_key_t key) {
+  plist_t *t1 = &p->lists[L_T1];
+  plist_t *t2 = &p->lists[L_T2];
+  plist_t *b1 = &p->lists[L_B1];
+  plist_t *b2 = &p->lists[L_B2];
+  uint32_t c = p->capacity;
+
+  int32_t g = ghost_find(p, key);
+  if (g != NIL) {
+    if (list_of(p, g) == L_B1) {
+      uint32_t delta = (b2->size > b1->size) ? b2->size / b1->size : 1u;
+      p->arc_p = (p->arc_p + delta < c) ? p->arc_p + delta : c;
+      p->pending = PEND_GHOST;
+    } else {
+      uint32_t delta = (b1->size > b2->size) ? b1->size / b2->size : 1u;
+      p->arc_p = (p->arc_p > delta) ? p->arc_p - delta : 0u;
+      p->pending = PEND_GHOST | PEND_IN_B2;
+    }
+    ghost_drop(p, g);
+    return;
+  }
+
+  uint32_t l1 = t1->size + b1->size;
+  uint32_t total = l1 + t2->size + b2->size;
+  if (l1 >= c) {
+    if (t1->size < c && b1->size > 0) {
+      ghost_drop(p, b1->tail);
+    } else {
+      p->pending = PEND_DROP_T1;
+    }
+  } else if (total >= 2u * c && b2->size > 0) {
+    ghost_drop(p, b2->tail);
+  }
+}
+
+static int arc_victim(policy_t *p) {
+  plist_t *t1 = &p->lists[L_T1];
+  plist_t *t2 = &p->lists[L_T2];
+
+  if ((p->pending & PEND_DROP_T1) && t1->size > 0) {
+    int32_t n = t1->tail;
+    list_unlink(p, n);
+    return n;
+  }
+
+  int from_t1 = t1->size > 0 &&
+                (t1->size > p->arc_p ||
+                 ((p->pending & PEND_IN_B2) && t1->size == p->arc_p));
+  if (!from_t1 && t2->size == 0) from_t1 = 1;
+  if (from_t1 && t1->size == 0) return NIL;
+
+  int32_t n = from_t1 ? t1->tail : t2->tail;
+  page_key_t key = nodes(p)[n].key;
+  list_unlink(p, n);
+  ghost_push(p, from_t1 ? L_B1 : L_B2, key);
+  return n;
+}
+
+/* OPT: dense() is a max-heap of hinted slots on when, and prev holds the
+ * heap position of a slot, as it does the dense position for RANDOM. */
+
+static void heap_place(policy_t *p, uint32_t pos, int32_t n) {
+  dense(p)[pos] = n;
+  nodes(p)[n].prev = (int32_t)pos;
+}
+
+static void heap_sift_up(policy_t *p, uint32_t pos) {
+  pnode_t *ns = nodes(p);
+  int32_t n = dense(p)[pos];
+  while (pos > 0) {
+    uint32_t parent = (pos - 1u) / 2u;
+    int32_t up = dense(p)[parent];
+    if (ns[up].when >= ns[n].when) break;
+    heap_place(p, pos, up);
+    pos = parent;
+  }
+  heap_place(p, pos, n);
+}
+
+static void heap_sift_down(policy_t *p, uint32_t pos) {
+  pnode_t *ns = nodes(p);
+  int32_t n = dense(p)[pos];
+  for (;;) {
+    uint32_t child = pos * 2u + 1u;
+    if (child >= p->ndense) break;
+    if (child + 1u < p->ndense &&
+        ns[dense(p)[child + 1u]].when > ns[dense(p)[child]].when) {
+      child++;
+    }
+    int32_t down = dense(p)[child];
+    if (ns[down].when <= ns[n].when) break;
+    heap_place(p, pos, down);
+    pos = child;
+  }
+  heap_place(p, pos, n);
+}
+
+static void heap_push(policy_t *p, int32_t n) {
+  if (nodes(p)[n].when < p->soonest) p->soonest = nodes(p)[n].when;
+  nodes(p)[n].list = L_HINTED + 1;
+  heap_place(p, p->ndense++, n);
+  heap_sift_up(p, p->ndense - 1u);
+}
+
+static void heap_unlink(policy_t *p, int32_t n) {
+  pnode_t *ns = nodes(p);
+  uint32_t pos = (uint32_t)ns[n].prev;
+  int32_t last = dense(p)[--p->ndense];
+  ns[n].prev = NIL;
+  ns[n].list = 0;
+  if (last == n) return;
+  heap_place(p, pos, last);
+  heap_sift_up(p, pos);
+  heap_sift_down(p, (uint32_t)ns[last].prev);
+}
+
+/* Moves pages whose hinted access is before now, and so did not come, to
+ * the cold end of the unhinted list and rebuilds the heap from the rest.
+ * soonest bounds the hints from below, so this only scans the heap once
+ * one of them may have passed. */
+static void opt_expire(policy_t *p, uint64_t now) {
+  if (now <= p->soonest) return;
+  pnode_t *ns = nodes(p);
+  uint32_t kept = 0;
+  p->soonest = UINT64_MAX;
+  for (uint32_t i = 0; i < p->ndense; i++) {
+    int32_t n = dense(p)[i];
+    if (ns[n].when < now) {
+      list_push_back(p, L_RECENT, n);
+      continue;
+    }
+    if (ns[n].when < p->soonest) p->soonest = ns[n].when;
+    heap_place(p, kept++, n);
+  }
+  p->ndense = kept;
+  for (uint32_t i = kept / 2u; i > 0; i--) heap_sift_down(p, i - 1u);
+}
+
+/* Pages with no known next use go first, least recently used first, after
+ * those whose hint has expired; the heap only gives up its farthest page
+ * when nothing else is left. */
+static int opt_victim(policy_t *p, uint64_t now) {
+  opt_expire(p, now);
+  int32_t n = p->lists[L_RECENT].tail;
+  if (n != NIL) {
+    list_unlink(p, n);
+    return n;
+  }
+  if (p->ndense == 0) return NIL;
+  n = dense(p)[0];
+  heap_unlink(p, n);
+  return n;
+}
+
+/* Public interface */
+
+int policy_parse(const char *name, policy_kind_t *out) {
+  if (!name) return -1;
+  for (size_t i = 0; i < sizeof(k_names) / sizeof(k_names[0]); i++) {
+    if (strcasecmp(name, k_names[i]) == 0) {
+      *out = (policy_kind_t)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *policy_name(policy_kind_t kind) {
+  if ((size_t)kind >= sizeof(k_names) / sizeof(k_names[0])) return "?";
+  return k_names[kind];
+}
+
+size_t policy_size(policy_kind_t kind, uint32_t capacity) {
+  uint32_t ghost_cap = ghost_capacity(kind, capacity);
+  size_t sz = align_up(sizeof(struct policy));
+  sz += align_up((size_t)(capacity + ghost_cap) * sizeof(pnode_t));
+  sz += align_up((size_t)bucket_count(ghost_cap) * sizeof(int32_t));
+  sz += align_up((size_t)capacity * sizeof(int32_t));
+  return sz;
+}
+
+void policy_init(void *mem, policy_kind_t kind, uint32_t capacity) {
+  policy_t *p = (policy_t *)mem;
+  memset(p, 0, sizeof(*p));
+
+  p->kind = kind;
+  p->capacity = capacity;
+  p->ghost_cap = ghost_capacity(kind, capacity);
+  p->nbuckets = bucket_count(p->ghost_cap);
+  p->nodes_off = align_up(sizeof(struct policy));
+  p->buckets_off =
+      p->nodes_off +
+      align_up((size_t)(capacity + p->ghost_cap) * sizeof(pnode_t));
+  p->dense_off =
+      p->buckets_off + align_up((size_t)p->nbuckets * sizeof(int32_t));
+  p->total_size = policy_size(kind, capacity);
+
+  for (int l = 0; l < 4; l++) {
+    p->lists[l].head = NIL;
+    p->lists[l].tail = NIL;
+    p->lists[l].size = 0;
+  }
+
+  pnode_t *ns = nodes(p);
+  for (uint32_t i = 0; i < capacity + p->ghost_cap; i++) {
+    ns[i].prev = NIL;
+    ns[i].next = NIL;
+    ns[i].hnext = NIL;
+    ns[i].list = 0;
+    ns[i].pinned = 0;
+    ns[i].ref = 0;
+  }
+  p->ghost_free = NIL;
+  for (uint32_t i = capacity + p->ghost_cap; i > capacity; i--) {
+    ns[i - 1].next = p->ghost_free;
+    p->ghost_free = (int32_t)(i - 1);
+  }
+  for (uint32_t b = 0; b < p->nbuckets; b++) buckets(p)[b] = NIL;
+
+  p->hand = NIL;
+  p->soonest = UINT64_MAX;
+  p->rng = 0xC0FFEEu;
+  p->kin = (capacity / 4u > 0) ? capacity / 4u : 1u;
+  p->kout = p->ghost_cap;
+}
+
+policy_t *policy_create(policy_kind_t kind, uint32_t capacity) {
+  void *mem = malloc(policy_size(kind, capacity));
+  if (!mem) return NULL;
+  policy_init(mem, kind, capacity);
+  return (policy_t *)mem;
+}
+
+void policy_destroy(policy_t *p) {
+  free(p);
+}
+
+int policy_miss(policy_t *p, page_key_t key) {
+  p->pending = 0;
+  switch (p->kind) {
+    case POLICY_2Q:
+      twoq_miss(p, key);
+      break;
+    case POLICY_ARC:
+      arc_miss(p, key);
+      break;
+    default:
+      break;
+  }
+  return p->pending;
+}
+
+int policy_victim(policy_t *p, uint64_t now) {
+  switch (p->kind) {
+    case POLICY_RANDOM:
+      return random_victim(p);
+    case POLICY_LRU: {
+      int32_t n = p->lists[0].tail;
+      if (n != NIL) list_unlink(p, n);
+      return n;
+    }
+    case POLICY_CLOCK:
+      return clock_victim(p);
+    case POLICY_2Q:
+      return twoq_victim(p);
+    case POLICY_ARC:
+      return arc_victim(p);
+    case POLICY_OPT:
+      return opt_victim(p, now);
+  }
+  return NIL;
+}
+
+/* Links a resident slot at the most recently used end of list l. */
+static void link_resident(policy_t *p, int slot, int l) {
+  pnode_t *ns = nodes(p);
+  switch (p->kind) {
+    case POLICY_RANDOM:
+      ns[slot].prev = (int32_t)p->ndense;
+      ns[slot].list = 1;
+      dense(p)[p->ndense++] = slot;
+      break;
+    case POLICY_OPT:
+      if (l == L_HINTED) {
+        heap_push(p, slot);
+      } else {
+        list_push_front(p, L_RECENT, slot);
+      }
+      break;
+    case POLICY_CLOCK:
+      ns[slot].ref = 1;
+      if (p->hand == NIL) {
+        list_push_back(p, 0, slot);
+      } else {
+        list_insert_before(p, 0, p->hand, slot);
+      }
+      break;
+    default:
+      list_push_front(p, l, slot);
+      break;
+  }
+}
+
+void policy_insert(policy_t *p, int slot, page_key_t key, int hint) {
+  pnode_t *ns = nodes(p);
+  policy_remove(p, slot);
+  ns[slot].key = key;
+
+  int l = 0;
+  if (p->kind == POLICY_2Q) l = (hint & PEND_GHOST) ? L_AM : L_A1IN;
+  if (p->kind == POLICY_ARC) l = (hint & PEND_GHOST) ? L_T2 : L_T1;
+  if (!(hint & POLICY_INSERT_COLD)) {
+    link_resident(p, slot, l);
+    return;
+  }
+
+  switch (p->kind) {
+    case POLICY_RANDOM:
+      link_resident(p, slot, l);
+      break;
+    case POLICY_CLOCK:
+      link_resident(p, slot, l);
+      ns[slot].ref = 0;
+      p->hand = slot;
+      break;
+    default:
+      list_push_back(p, l, slot);
+      break;
+  }
+}
+
+void policy_hit(policy_t *p, int slot) {
+  pnode_t *ns = nodes(p);
+  if (ns[slot].list == 0) return;
+  switch (p->kind) {
+    case POLICY_RANDOM:
+      break;
+    case POLICY_LRU:
+      if (p->lists[0].head != slot) {
+        list_unlink(p, slot);
+        list_push_front(p, 0, slot);
+      }
+      break;
+    case POLICY_CLOCK:
+      ns[slot].ref = 1;
+      break;
+    case POLICY_2Q:
+      if (list_of(p, slot) == L_AM && p->lists[L_AM].head != slot) {
+        list_unlink(p, slot);
+        list_push_front(p, L_AM, slot);
+      }
+      break;
+    case POLICY_ARC:
+      if (list_of(p, slot) >= 0 && p->lists[L_T2].head != slot) {
+        list_unlink(p, slot);
+        list_push_front(p, L_T2, slot);
+      }
+      break;
+    case POLICY_OPT:
+      if (list_of(p, slot) == L_HINTED) {
+        heap_unlink(p, slot);
+        list_push_front(p, L_RECENT, slot);
+      } else if (p->lists[L_RECENT].head != slot) {
+        list_unlink(p, slot);
+        list_push_front(p, L_RECENT, slot);
+      }
+      break;
+  }
+}
+
+void policy_remove(policy_t *p, int slot) {
+  pnode_t *ns = nodes(p);
+  ns[slot].pinned = 0;
+  if (ns[slot].list == 0) return;
+
+  if (p->kind == POLICY_RANDOM) {
+    int32_t pos = ns[slot].prev;
+    int32_t last = dense(p)[--p->ndense];
+    dense(p)[pos] = last;
+    ns[last].prev = pos;
+    ns[slot].prev = NIL;
+    ns[slot].list = 0;
+    return;
+  }
+
+  if (p->kind == POLICY_OPT && list_of(p, slot) == L_HINTED) {
+    heap_unlink(p, slot);
+    return;
+  }
+
+  if (p->kind == POLICY_CLOCK && p->hand == slot) {
+    p->hand = ns[slot].next;
+  }
+  list_unlink(p, slot);
+  ns[slot].ref = 0;
+}
+
+void policy_pin(policy_t *p, int slot) {
+  pnode_t *ns = nodes(p);
+  if (ns[slot].list == 0) return;
+  uint8_t l = ns[slot].list;
+  policy_remove(p, slot);
+  ns[slot].pinned = l;
+}
+
+void policy_unpin(policy_t *p, int slot) {
+  pnode_t *ns = nodes(p);
+  if (ns[slot].pinned == 0) return;
+  int l = ns[slot].pinned - 1;
+  ns[slot].pinned = 0;
+  link_resident(p, slot, l);
+}
+
+void policy_advise(policy_t *p, int slot, uint64_t when) {
+  pnode_t *ns = nodes(p);
+  if (p->kind != POLICY_OPT) return;
+  ns[slot].when = when;
+
+  if (ns[slot].pinned != 0) {
+    ns[slot].pinned = (when == UINT64_MAX) ? L_RECENT + 1 : L_HINTED + 1;
+    return;
+  }
+  if (ns[slot].list == 0) return;
+
+  policy_remove(p, slot);
+  if (when == UINT64_MAX) {
+    list_push_back(p, L_RECENT, slot);
+  } else {
+    heap_push(p, slot);
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key.h"
+
+typedef enum {
+  POLICY_RANDOM = 0,
+  POLICY_LRU,
+  POLICY_CLOCK,
+  POLICY_2Q,
+  POLICY_ARC,
+  POLICY_OPT,
+} policy_kind_t;
+
+typedef struct policy policy_t;
+
+/* ORed into the policy_insert() hint: link the page at the cold end, so it
+ * is the next victim of its list unless it is hit in between. */
+#define POLICY_INSERT_COLD 0x100
+
+/*
+ * Eviction policy over slots [0, capacity). The cache calls policy_miss()
+ * once per miss before it picks a slot, policy_victim() right after it and
+ * only when there is no free slot, and policy_insert() with the hint
+ * returned by policy_miss() once the page is loaded. Pinned slots are out
+ * of the replacement lists until unpinned. Every call is O(1) (CLOCK is
+ * amortized O(1)). OPT keeps pages with a hinted next access in a heap,
+ * which makes its calls O(log n), and a victim call that finds a hint in
+ * the past scans the heap for all of them.
+ *
+ * The policy lives in a single position-independent block, so it can be
+ * placed in caller-provided memory with policy_size()/policy_init().
+ */
+
+int policy_parse(const char *name, policy_kind_t *out);
+const char *policy_name(policy_kind_t kind);
+
+size_t policy_size(policy_kind_t kind, uint32_t capacity);
+void policy_init(void *mem, policy_kind_t kind, uint32_t capacity);
+policy_t *policy_create(policy_kind_t kind, uint32_t capacity);
+void policy_destroy(policy_t *p);
+
+int policy_miss(policy_t *p, page_key_t key);
+/* now is on the clock of policy_advise(); only OPT reads it. */
+int policy_victim(policy_t *p, uint64_t now);
+void policy_insert(policy_t *p, int slot, page_key_t key, int hint);
+void policy_hit(policy_t *p, int slot);
+void policy_remove(policy_t *p, int slot);
+void policy_pin(policy_t *p, int slot);
+void policy_unpin(policy_t *p, int slot);
+
+/* OPT only: the page in slot is next needed at time when, or never for
+ * UINT64_MAX. The hint covers a single access and is dropped on a hit. */
+void policy_advise(policy_t *p, int slot, uint64_t when);
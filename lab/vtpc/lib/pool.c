@@ -0,0 +1,138 @@
+#include "pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "lz.h"
+#include "policy.h"
+#include "ptable.h"
+
+/* Room for entries down to an eighth of a page each. */
+#define POOL_RATIO 8u
+
+typedef struct {
+  page_key_t key;
+  uint64_t gen;
+  size_t len;
+  unsigned char *data;
+} pool_ent_t;
+
+struct pool {
+  pthread_mutex_t lock;
+  uint32_t page_size;
+  uint32_t max;
+  size_t capacity;
+  size_t used; /* compressed bytes held */
+  ptable_t *table;
+  policy_t *lru;
+  pool_ent_t *ents;
+  int32_t *free;
+  uint32_t nfree;
+};
+
+pool_t *pool_create(size_t capacity_bytes, uint32_t page_size) {
+  size_t pages = capacity_bytes / page_size;
+  if (pages == 0 || pages > (size_t)INT32_MAX / (2u * POOL_RATIO)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  pool_t *p = (pool_t *)calloc(1, sizeof(*p));
+  if (!p) return NULL;
+  pthread_mutex_init(&p->lock, NULL);
+  p->page_size = page_size;
+  p->max = (uint32_t)(pages * POOL_RATIO);
+  p->capacity = capacity_bytes;
+  p->table = (ptable_t *)malloc(ptable_size(p->max));
+  p->lru = policy_create(POLICY_LRU, p->max);
+  p->ents = (pool_ent_t *)calloc(p->max, sizeof(pool_ent_t));
+  p->free = (int32_t *)malloc(p->max * sizeof(int32_t));
+  if (!p->table || !p->lru || !p->ents || !p->free) {
+    pool_destroy(p);
+    errno = ENOMEM;
+    return NULL;
+  }
+  ptable_init(p->table, p->max);
+  for (uint32_t i = 0; i < p->max; i++) p->free[i] = (int32_t)(p->max - 1u - i);
+  p->nfree = p->max;
+  return p;
+}
+
+void pool_destroy(pool_t *p) {
+  if (!p) return;
+  if (p->ents) {
+    for (uint32_t i = 0; i < p->max; i++) free(p->ents[i].data);
+  }
+  if (p->lru) policy_destroy(p->lru);
+  pthread_mutex_destroy(&p->lock);
+  free(p->table);
+  free(p->ents);
+  free(p->free);
+  free(p);
+}
+
+/* Unlinks entry e and returns its data, which the caller frees. */
+static unsigned char *unlink_locked(pool_t *p, int32_t e) {
+  pool_ent_t *ent = &p->ents[e];
+  unsigned char *data = ent->data;
+  ptable_erase(p->table, ent->key);
+  policy_remove(p->lru, e);
+  p->used -= ent->len;
+  ent->data = NULL;
+  p->free[p->nfree++] = e;
+  return data;
+}
+
+size_t pool_put(pool_t *p, page_key_t key, uint64_t gen, const void *page) {
+  size_t cap = p->page_size - p->page_size / 8u;
+  unsigned char *buf = (unsigned char *)malloc(cap);
+  if (!buf) return 0;
+  size_t len = lz_compress(page, p->page_size, buf, cap);
+  if (len == 0 || len > p->capacity) {
+    free(buf);
+    return 0;
+  }
+  unsigned char *data = (unsigned char *)realloc(buf, len);
+  if (!data) data = buf;
+
+  pthread_mutex_lock(&p->lock);
+  int32_t e = ptable_find(p->table, key);
+  if (e >= 0) free(unlink_locked(p, e));
+  int hint = policy_miss(p->lru, key);
+  while (p->nfree == 0 || p->used + len > p->capacity) {
+    int victim = policy_victim(p->lru, 0);
+    free(unlink_locked(p, victim));
+  }
+  e = p->free[--p->nfree];
+  p->ents[e] = (pool_ent_t){.key = key, .gen = gen, .len = len, .data = data};
+  (void)ptable_insert(p->table, key, e);
+  policy_insert(p->lru, e, key, hint);
+  p->used += len;
+  pthread_mutex_unlock(&p->lock);
+  return len;
+}
+
+int pool_take(pool_t *p, page_key_t key, uint64_t gen, void *dst) {
+  pthread_mutex_lock(&p->lock);
+  int32_t e = ptable_find(p->table, key);
+  if (e < 0) {
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+  }
+  int match = p->ents[e].gen == gen;
+  size_t len = p->ents[e].len;
+  unsigned char *data = unlink_locked(p, e);
+  pthread_mutex_unlock(&p->lock);
+
+  int hit = match && lz_decompress(data, len, dst, p->page_size) == 0;
+  free(data);
+  return hit;
+}
+
+void pool_drop(pool_t *p, page_key_t key) {
+  pthread_mutex_lock(&p->lock);
+  int32_t e = ptable_find(p->table, key);
+  unsigned char *data = (e >= 0) ? unlink_locked(p, e) : NULL;
+  pthread_mutex_unlock(&p->lock);
+  free(data);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key.h"
+
+/*
+ * Compressed copies of clean pages evicted from an instance, kept in
+ * capacity_bytes of memory with LRU replacement. A page is taken out
+ * again on its next miss, so the pool and the slots never hold the same
+ * page. gen lets a file whose pages are stale stop matching them without
+ * a walk of the pool. One lock covers the pool and is a leaf; callers hold
+ * the page's shard lock, which keeps calls for one page in order.
+ */
+
+typedef struct pool pool_t;
+
+pool_t *pool_create(size_t capacity_bytes, uint32_t page_size);
+void pool_destroy(pool_t *p);
+
+/* Keeps the page if it compresses by at least an eighth. Returns its
+ * compressed size, or 0 if it was not kept. */
+size_t pool_put(pool_t *p, page_key_t key, uint64_t gen, const void *page);
+
+/* Moves the page into dst; returns 1 if it was there under gen. */
+int pool_take(pool_t *p, page_key_t key, uint64_t gen, void *dst);
+
+void pool_drop(pool_t *p, page_key_t key);
@@ -0,0 +1,189 @@
+#include "ptable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GROUP 16u
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+typedef struct {
+  page_key_t key;
+  int32_t value;
+} pt_entry_t;
+
+struct ptable {
+  uint32_t cap; /* slots, a power of two and a multiple of GROUP */
+  uint32_t count;
+  uint32_t tombs;
+  size_t entries_off;
+};
+
+static size_t align_up(size_t x) {
+  return (x + 63u) & ~(size_t)63u;
+}
+
+static int8_t *ctrl(const ptable_t *t) {
+  return (int8_t *)((char *)t + align_up(sizeof(struct ptable)));
+}
+
+static pt_entry_t *entries(const ptable_t *t) {
+  return (pt_entry_t *)((char *)t + t->entries_off);
+}
+
+/* Keeps the load at or below one half. */
+static uint32_t capacity_for(uint32_t max_items) {
+  uint32_t cap = GROUP;
+  while (cap < max_items * 2u) cap <<= 1u;
+  return cap;
+}
+
+static int8_t h2(uint64_t h) {
+  return (int8_t)(h & 0x7fu);
+}
+
+/* Bit i is set when control byte i of the group equals c. */
+static uint32_t group_match(const int8_t *g, int8_t c) {
+#if defined(__SSE2__)
+  __m128i bytes = _mm_load_si128((const __m128i *)g);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < GROUP; i++) {
+    if (g[i] == c) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+/* Empty and deleted bytes are the ones with the top bit set. */
+static uint32_t group_free(const int8_t *g) {
+#if defined(__SSE2__)
+  return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)g));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < GROUP; i++) {
+    if (g[i] < 0) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+/* Groups are visited in triangular order, which covers all of them. */
+static uint32_t probe_next(const ptable_t *t, uint32_t group, uint32_t step) {
+  return (group + step) & (t->cap / GROUP - 1u);
+}
+
+static uint32_t probe_start(const ptable_t *t, uint64_t h) {
+  return (uint32_t)(h >> 7) & (t->cap / GROUP - 1u);
+}
+
+static int32_t find_index(const ptable_t *t, page_key_t key, uint64_t h) {
+  const int8_t *cs = ctrl(t);
+  const pt_entry_t *es = entries(t);
+  uint32_t group = probe_start(t, h);
+
+  for (uint32_t step = 1; step <= t->cap / GROUP; step++) {
+    const int8_t *g = cs + group * GROUP;
+    for (uint32_t m = group_match(g, h2(h)); m != 0; m &= m - 1u) {
+      uint32_t i = group * GROUP + (uint32_t)__builtin_ctz(m);
+      if (key_eq(es[i].key, key)) return (int32_t)i;
+    }
+    if (group_match(g, CTRL_EMPTY) != 0) return -1;
+    group = probe_next(t, group, step);
+  }
+  return -1;
+}
+
+static int insert_hashed(ptable_t *t, page_key_t key, int32_t value) {
+  int8_t *cs = ctrl(t);
+  uint64_t h = key_hash(key);
+  uint32_t group = probe_start(t, h);
+
+  for (uint32_t step = 1; step <= t->cap / GROUP; step++) {
+    uint32_t m = group_free(cs + group * GROUP);
+    if (m != 0) {
+      uint32_t i = group * GROUP + (uint32_t)__builtin_ctz(m);
+      if (cs[i] == CTRL_DELETED) t->tombs--;
+      cs[i] = h2(h);
+      entries(t)[i].key = key;
+      entries(t)[i].value = value;
+      t->count++;
+      return 0;
+    }
+    group = probe_next(t, group, step);
+  }
+  return -1;
+}
+
+/* Reinserts every entry into a table without tombstones. Without memory
+ * for the copy the table stays as it is, which is only slower. */
+static void rehash(ptable_t *t) {
+  pt_entry_t *live = (pt_entry_t *)malloc((size_t)t->count * sizeof(*live));
+  if (!live) return;
+
+  int8_t *cs = ctrl(t);
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < t->cap; i++) {
+    if (cs[i] >= 0) live[n++] = entries(t)[i];
+  }
+
+  memset(cs, (unsigned char)CTRL_EMPTY, t->cap);
+  t->count = 0;
+  t->tombs = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    (void)insert_hashed(t, live[i].key, live[i].value);
+  }
+  free(live);
+}
+
+size_t ptable_size(uint32_t max_items) {
+  uint32_t cap = capacity_for(max_items);
+  return align_up(sizeof(struct ptable)) + align_up(cap) +
+         (size_t)cap * sizeof(pt_entry_t);
+}
+
+void ptable_init(void *mem, uint32_t max_items) {
+  ptable_t *t = (ptable_t *)mem;
+  t->cap = capacity_for(max_items);
+  t->count = 0;
+  t->tombs = 0;
+  t->entries_off = align_up(sizeof(struct ptable)) + align_up(t->cap);
+  memset(ctrl(t), (unsigned char)CTRL_EMPTY, t->cap);
+}
+
+int32_t ptable_find(const ptable_t *t, page_key_t key) {
+  int32_t i = find_index(t, key, key_hash(key));
+  return (i >= 0) ? entries(t)[i].value : -1;
+}
+
+int ptable_insert(ptable_t *t, page_key_t key, int32_t value) {
+  return insert_hashed(t, key, value);
+}
+
+void ptable_erase(ptable_t *t, page_key_t key) {
+  int32_t i = find_index(t, key, key_hash(key));
+  if (i < 0) return;
+
+  int8_t *cs = ctrl(t);
+  const int8_t *g = cs + ((uint32_t)i & ~(GROUP - 1u));
+  t->count--;
+  if (group_match(g, CTRL_EMPTY) != 0) {
+    cs[i] = CTRL_EMPTY;
+    return;
+  }
+  cs[i] = CTRL_DELETED;
+  if (++t->tombs > t->cap / 8u) rehash(t);
+}
+
+uint32_t ptable_count(const ptable_t *t) {
+  return t->count;
+}
+
+uint32_t ptable_tombstones(const ptable_t *t) {
+  return t->tombs;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key.h"
+
+/*
+ * Page table: open addressing over groups of 16 slots with one control
+ * byte each, probed a group at a time (SSE2 where available). A control
+ * byte holds 7 bits of the key hash for a used slot, so a probe compares
+ * keys only on a tag match. Erasing from a group that still has an empty
+ * slot leaves no tombstone, since no probe went past that group; the rare
+ * tombstones left otherwise are swept by a rehash once they reach 1/8 of
+ * the table.
+ *
+ * Like the policy, the table is a single position-independent block sized
+ * by ptable_size() and set up in place by ptable_init().
+ */
+
+typedef struct ptable ptable_t;
+
+size_t ptable_size(uint32_t max_items);
+void ptable_init(void *mem, uint32_t max_items);
+
+/* Returns the value stored for key, or -1. */
+int32_t ptable_find(const ptable_t *t, page_key_t key);
+
+/* key must not be present. Returns -1 if the table is full. */
+int ptable_insert(ptable_t *t, page_key_t key, int32_t value);
+
+void ptable_erase(ptable_t *t, page_key_t key);
+
+uint32_t ptable_count(const ptable_t *t);
+uint32_t ptable_tombstones(const ptable_t *t);
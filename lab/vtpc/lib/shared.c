@@ -0,0 +1,408 @@
+#define _GNU_SOURCE
+
+#include "shared.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "policy.h"
+#include "ptable.h"
+
+#define SHARED_MAGIC 0x766d68736370747full /* "vtpcshmv" */
+#define SHARED_VERSION 1u
+#define SHARED_MAX_SHARDS 16u
+#define SHARED_SHARD_MIN_PAGES 64u
+#define SHARED_FILES 4096u /* a power of two */
+#define SHARED_FILE_PROBE 16u
+#define SHARED_ALIGN 64u
+
+typedef struct {
+  pthread_mutex_t lock; /* robust, process-shared */
+  uint64_t epoch;       /* writes and drops so far */
+  uint32_t nfree;
+} sshard_t;
+
+typedef struct {
+  page_key_t key;
+  uint64_t gen;
+} sslot_t;
+
+/* gen 0 marks a free entry. */
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t gen;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+} sfile_t;
+
+/* The start of the object. Everything after it is found by offset. */
+typedef struct {
+  uint64_t magic; /* set last, once the rest is ready */
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t npages;
+  uint32_t nshards;
+  uint32_t shard_pages;
+  size_t size;
+  size_t slots_off;
+  size_t free_off;
+  size_t shards_off;
+  size_t tables_off;
+  size_t table_stride;
+  size_t policies_off;
+  size_t policy_stride;
+  size_t files_off;
+  size_t arena_off;
+
+  pthread_mutex_t files_lock; /* robust, process-shared */
+  uint64_t next_gen;
+  uint64_t recoveries; /* atomic */
+} shdr_t;
+
+struct shared {
+  shdr_t *h;
+  unsigned char *base;
+};
+
+static size_t layout_add(size_t *size, size_t bytes) {
+  size_t off = (*size + SHARED_ALIGN - 1u) & ~(size_t)(SHARED_ALIGN - 1u);
+  *size = off + bytes;
+  return off;
+}
+
+static size_t align(size_t x) {
+  return (x + SHARED_ALIGN - 1u) & ~(size_t)(SHARED_ALIGN - 1u);
+}
+
+static void layout(shdr_t *h, uint32_t npages, uint32_t page_size) {
+  uint32_t nshards = 1;
+  while (nshards * 2u <= SHARED_MAX_SHARDS &&
+         npages / (nshards * 2u) >= SHARED_SHARD_MIN_PAGES) {
+    nshards *= 2u;
+  }
+  h->page_size = page_size;
+  h->nshards = nshards;
+  h->shard_pages = npages / nshards;
+  h->npages = h->shard_pages * nshards;
+
+  size_t size = 0;
+  (void)layout_add(&size, sizeof(shdr_t));
+  h->slots_off = layout_add(&size, h->npages * sizeof(sslot_t));
+  h->free_off = layout_add(&size, h->npages * sizeof(int32_t));
+  h->shards_off = layout_add(&size, nshards * sizeof(sshard_t));
+  h->table_stride = align(ptable_size(h->shard_pages));
+  h->tables_off = layout_add(&size, nshards * h->table_stride);
+  h->policy_stride = align(policy_size(POLICY_LRU, h->shard_pages));
+  h->policies_off = layout_add(&size, nshards * h->policy_stride);
+  h->files_off = layout_add(&size, SHARED_FILES * sizeof(sfile_t));
+  h->arena_off = layout_add(&size, (size_t)h->npages * page_size);
+  h->size = size;
+}
+
+static sslot_t *slots(const shared_t *s) {
+  return (sslot_t *)(s->base + s->h->slots_off);
+}
+
+static int32_t *free_stack(const shared_t *s, uint32_t shard) {
+  return (int32_t *)(s->base + s->h->free_off) + shard * s->h->shard_pages;
+}
+
+static sshard_t *shard(const shared_t *s, uint32_t i) {
+  return (sshard_t *)(s->base + s->h->shards_off) + i;
+}
+
+static ptable_t *table(const shared_t *s, uint32_t i) {
+  return (ptable_t *)(s->base + s->h->tables_off + i * s->h->table_stride);
+}
+
+static policy_t *policy(const shared_t *s, uint32_t i) {
+  return (policy_t *)(s->base + s->h->policies_off + i * s->h->policy_stride);
+}
+
+static sfile_t *files(const shared_t *s) {
+  return (sfile_t *)(s->base + s->h->files_off);
+}
+
+static unsigned char *page(const shared_t *s, uint32_t shard_no, int32_t i) {
+  size_t slot = (size_t)shard_no * s->h->shard_pages + (size_t)i;
+  return s->base + s->h->arena_off + slot * s->h->page_size;
+}
+
+static uint32_t shard_of(const shared_t *s, page_key_t key) {
+  return (uint32_t)(key_hash(key) >> 32) & (s->h->nshards - 1u);
+}
+
+static int mutex_init(pthread_mutex_t *m) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  int rc = pthread_mutex_init(m, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return rc;
+}
+
+/* Empties a shard: its table, policy and free stack start over. */
+static void shard_reset(shared_t *s, uint32_t i) {
+  uint32_t n = s->h->shard_pages;
+  ptable_init(table(s, i), n);
+  policy_init(policy(s, i), POLICY_LRU, n);
+  int32_t *fs = free_stack(s, i);
+  for (uint32_t j = 0; j < n; j++) fs[j] = (int32_t)(n - 1u - j);
+  sshard_t *sh = shard(s, i);
+  sh->nfree = n;
+  sh->epoch++; /* fills that started before may predate a lost write */
+}
+
+static void files_reset(shared_t *s) {
+  memset(files(s), 0, SHARED_FILES * sizeof(sfile_t));
+}
+
+/* Locks a robust mutex; if its holder died, repairs what it guards. */
+static void lock_robust(shared_t *s, pthread_mutex_t *m, int shard_no) {
+  if (pthread_mutex_lock(m) != EOWNERDEAD) return;
+  if (shard_no >= 0) {
+    shard_reset(s, (uint32_t)shard_no);
+  } else {
+    files_reset(s);
+  }
+  __atomic_add_fetch(&s->h->recoveries, 1, __ATOMIC_RELAXED);
+  pthread_mutex_consistent(m);
+}
+
+static int build(shared_t *s, int fd, size_t capacity_bytes, uint32_t page_size) {
+  shdr_t probe;
+  memset(&probe, 0, sizeof(probe));
+  layout(&probe, (uint32_t)(capacity_bytes / page_size), page_size);
+  if (ftruncate(fd, (off_t)probe.size) != 0) return -1;
+
+  void *mem = mmap(NULL, probe.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) return -1;
+  s->base = (unsigned char *)mem;
+  s->h = (shdr_t *)mem;
+  memcpy(s->h, &probe, sizeof(probe));
+  s->h->magic = 0;
+  s->h->version = SHARED_VERSION;
+  s->h->next_gen = 1;
+  s->h->recoveries = 0;
+  mutex_init(&s->h->files_lock);
+  files_reset(s);
+  for (uint32_t i = 0; i < s->h->nshards; i++) {
+    mutex_init(&shard(s, i)->lock);
+    shard(s, i)->epoch = 0;
+    shard_reset(s, i);
+  }
+  __atomic_store_n(&s->h->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Maps an object that build() finished, or returns 1 if there is none. */
+static int map_ready(shared_t *s, int fd, uint32_t page_size) {
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) return -1;
+  if ((size_t)sb.st_size < sizeof(shdr_t)) return 1;
+
+  void *mem = mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) return -1;
+  shdr_t *h = (shdr_t *)mem;
+  if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC) {
+    munmap(mem, (size_t)sb.st_size);
+    return 1;
+  }
+  if (h->version != SHARED_VERSION || h->page_size != page_size ||
+      h->size != (size_t)sb.st_size) {
+    munmap(mem, (size_t)sb.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+  s->base = (unsigned char *)mem;
+  s->h = h;
+  return 0;
+}
+
+/* The object is built under an exclusive flock(), so an attacher either
+ * waits for it or, if the builder died halfway, builds it again. */
+shared_t *shared_attach(const char *name, size_t capacity_bytes, uint32_t page_size) {
+  if (page_size == 0 || (page_size & (page_size - 1u)) != 0 ||
+      capacity_bytes / page_size < 1 ||
+      capacity_bytes / page_size > (size_t)INT32_MAX / 2u) {
+    errno = EINVAL;
+    return NULL;
+  }
+  shared_t *s = (shared_t *)calloc(1, sizeof(*s));
+  if (!s) return NULL;
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    free(s);
+    return NULL;
+  }
+
+  int rc = -1;
+  if (flock(fd, LOCK_SH) == 0) {
+    rc = map_ready(s, fd, page_size);
+    if (rc == 1 && flock(fd, LOCK_EX) == 0) {
+      rc = map_ready(s, fd, page_size);
+      if (rc == 1) rc = build(s, fd, capacity_bytes, page_size);
+    }
+  }
+  int saved = errno;
+  close(fd); /* drops the flock */
+  if (rc != 0) {
+    free(s);
+    errno = saved;
+    return NULL;
+  }
+  return s;
+}
+
+void shared_detach(shared_t *s) {
+  if (!s) return;
+  munmap(s->base, s->h->size);
+  free(s);
+}
+
+int shared_unlink(const char *name) {
+  return shm_unlink(name);
+}
+
+static sfile_t *file_slot(shared_t *s, uint64_t dev, uint64_t ino) {
+  sfile_t *fs = files(s);
+  uint32_t h = (uint32_t)hash_u64(ino * 0x9e3779b97f4a7c15ull ^ dev);
+  sfile_t *empty = NULL;
+  for (uint32_t i = 0; i < SHARED_FILE_PROBE; i++) {
+    sfile_t *f = &fs[(h + i) & (SHARED_FILES - 1u)];
+    if (f->gen != 0 && f->dev == dev && f->ino == ino) return f;
+    if (f->gen == 0 && !empty) empty = f;
+  }
+  /* A full window gives up its first entry; that file starts over with a
+   * new generation next time. */
+  return empty ? empty : &fs[h & (SHARED_FILES - 1u)];
+}
+
+uint64_t shared_file(shared_t *s, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime) {
+  lock_robust(s, &s->h->files_lock, -1);
+  sfile_t *f = file_slot(s, dev, ino);
+  if (f->gen == 0 || f->dev != dev || f->ino != ino || f->size != size ||
+      f->mtime_sec != (int64_t)mtime.tv_sec ||
+      f->mtime_nsec != (int64_t)mtime.tv_nsec) {
+    f->dev = dev;
+    f->ino = ino;
+    f->gen = s->h->next_gen++;
+    f->size = size;
+    f->mtime_sec = (int64_t)mtime.tv_sec;
+    f->mtime_nsec = (int64_t)mtime.tv_nsec;
+  }
+  uint64_t gen = f->gen;
+  pthread_mutex_unlock(&s->h->files_lock);
+  return gen;
+}
+
+void shared_file_written(shared_t *s, uint64_t dev, uint64_t ino, uint64_t gen, int64_t size, struct timespec mtime) {
+  lock_robust(s, &s->h->files_lock, -1);
+  sfile_t *f = file_slot(s, dev, ino);
+  if (f->gen == gen && f->dev == dev && f->ino == ino) {
+    f->size = size;
+    f->mtime_sec = (int64_t)mtime.tv_sec;
+    f->mtime_nsec = (int64_t)mtime.tv_nsec;
+  }
+  pthread_mutex_unlock(&s->h->files_lock);
+}
+
+int shared_get(shared_t *s, page_key_t key, uint64_t gen, void *dst, uint64_t *epoch) {
+  uint32_t i = shard_of(s, key);
+  lock_robust(s, &shard(s, i)->lock, (int)i);
+  int32_t slot = ptable_find(table(s, i), key);
+  int hit = slot >= 0 &&
+            slots(s)[i * s->h->shard_pages + (uint32_t)slot].gen == gen;
+  if (hit) {
+    memcpy(dst, page(s, i, slot), s->h->page_size);
+    policy_hit(policy(s, i), slot);
+  } else {
+    *epoch = shard(s, i)->epoch;
+  }
+  pthread_mutex_unlock(&shard(s, i)->lock);
+  return hit;
+}
+
+/* Frees the page's slot, with the shard locked. */
+static void drop_locked(shared_t *s, uint32_t i, page_key_t key) {
+  int32_t slot = ptable_find(table(s, i), key);
+  if (slot < 0) return;
+  ptable_erase(table(s, i), key);
+  policy_remove(policy(s, i), slot);
+  free_stack(s, i)[shard(s, i)->nfree++] = slot;
+}
+
+/* Generations only grow, and a page under a newer one is never replaced
+ * by one under an older generation. */
+static void store(shared_t *s, page_key_t key, uint64_t gen, const void *src, int write, uint64_t epoch) {
+  uint32_t i = shard_of(s, key);
+  sshard_t *sh = shard(s, i);
+  lock_robust(s, &sh->lock, (int)i);
+  if (!write && sh->epoch != epoch) {
+    pthread_mutex_unlock(&sh->lock);
+    return;
+  }
+
+  sslot_t *ss = slots(s) + i * s->h->shard_pages;
+  int32_t slot = ptable_find(table(s, i), key);
+  if (slot >= 0) {
+    if (ss[slot].gen > gen || (!write && ss[slot].gen == gen)) {
+      if (write) {
+        drop_locked(s, i, key); /* older than what was just written */
+        sh->epoch++;
+      }
+      pthread_mutex_unlock(&sh->lock);
+      return;
+    }
+    policy_hit(policy(s, i), slot);
+  } else {
+    int hint = policy_miss(policy(s, i), key);
+    if (sh->nfree == 0) {
+      int victim = policy_victim(policy(s, i), 0);
+      if (victim < 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return;
+      }
+      drop_locked(s, i, ss[victim].key);
+    }
+    slot = free_stack(s, i)[--sh->nfree];
+    ss[slot].key = key;
+    (void)ptable_insert(table(s, i), key, slot);
+    policy_insert(policy(s, i), slot, key, hint);
+  }
+  ss[slot].gen = gen;
+  memcpy(page(s, i, slot), src, s->h->page_size);
+  if (write) sh->epoch++;
+  pthread_mutex_unlock(&sh->lock);
+}
+
+void shared_fill(shared_t *s, page_key_t key, uint64_t gen, uint64_t epoch, const void *src) {
+  store(s, key, gen, src, 0, epoch);
+}
+
+void shared_write(shared_t *s, page_key_t key, uint64_t gen, const void *src) {
+  store(s, key, gen, src, 1, 0);
+}
+
+void shared_drop(shared_t *s, page_key_t key) {
+  uint32_t i = shard_of(s, key);
+  lock_robust(s, &shard(s, i)->lock, (int)i);
+  drop_locked(s, i, key);
+  shard(s, i)->epoch++;
+  pthread_mutex_unlock(&shard(s, i)->lock);
+}
+
+uint64_t shared_recoveries(const shared_t *s) {
+  return __atomic_load_n(&s->h->recoveries, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "key.h"
+
+/*
+ * Clean pages shared between processes in a named POSIX shared memory
+ * object. The object is sharded like a cache instance, each shard with a
+ * page table, an LRU policy and a robust process-shared mutex. Pages are
+ * copied in and out under that mutex, so nothing in it points into one
+ * process. A process that dies holding a shard mutex leaves the shard to
+ * be emptied by the next one to lock it, which loses nothing, since the
+ * tier only holds copies of what is on disk.
+ *
+ * A file is tagged with a generation that changes whenever a process sees
+ * it with another size or mtime than the one last recorded, and its pages
+ * carry the generation they were stored under, so a file changed behind
+ * the tier's back, or replaced by one with the same inode, loses them.
+ */
+
+typedef struct shared shared_t;
+
+/* Maps the object name, creating it with room for capacity_bytes of
+ * page_size pages if it does not exist. An existing object keeps its size,
+ * but must have the same page size. */
+shared_t *shared_attach(const char *name, size_t capacity_bytes, uint32_t page_size);
+void shared_detach(shared_t *s);
+int shared_unlink(const char *name);
+
+/* Returns the generation of the file as of its current size and mtime. */
+uint64_t shared_file(shared_t *s, uint64_t dev, uint64_t ino, int64_t size, struct timespec mtime);
+
+/* Records the size and mtime the file has after a write by this process,
+ * when gen is still its generation, so the write does not cost the file
+ * its pages. */
+void shared_file_written(shared_t *s, uint64_t dev, uint64_t ino, uint64_t gen, int64_t size, struct timespec mtime);
+
+/* Copies the page into dst and returns 1 if it is there under gen.
+ * Otherwise sets *epoch for a shared_fill() of the page once it is read
+ * from disk, which is only stored if no write or drop of a page near it
+ * was stored since, so it never replaces newer data. */
+int shared_get(shared_t *s, page_key_t key, uint64_t gen, void *dst, uint64_t *epoch);
+void shared_fill(shared_t *s, page_key_t key, uint64_t gen, uint64_t epoch, const void *src);
+
+/* Stores the page as just written to disk. */
+void shared_write(shared_t *s, page_key_t key, uint64_t gen, const void *src);
+
+void shared_drop(shared_t *s, page_key_t key);
+
+/* Shards emptied after their holder died. */
+uint64_t shared_recoveries(const shared_t *s);
@@ -0,0 +1,37 @@
+#include "stats.h"
+
+#include <stddef.h>
+
+static void hist_sum(vtpc_hist_t *dst, const vtpc_hist_t *src) {
+  dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+  dst->total_ns += __atomic_load_n(&src->total_ns, __ATOMIC_RELAXED);
+  for (int i = 0; i < VTPC_HIST_BUCKETS; i++) {
+    dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+  }
+}
+
+void stats_time(vtpc_hist_t *h, uint64_t ns) {
+  int b = 63 - __builtin_clzll(ns | 1u);
+  if (b >= VTPC_HIST_BUCKETS) b = VTPC_HIST_BUCKETS - 1;
+  stats_add(&h->count, 1);
+  stats_add(&h->total_ns, ns);
+  stats_add(&h->buckets[b], 1);
+}
+
+void stats_sum(vtpc_stats_t *dst, const vtpc_stats_t *src) {
+  const uint64_t *from = (const uint64_t *)src;
+  uint64_t *to = (uint64_t *)dst;
+  size_t n = offsetof(vtpc_stats_t, miss_ns) / sizeof(uint64_t);
+  for (size_t i = 0; i < n; i++) {
+    to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+  }
+  hist_sum(&dst->miss_ns, &src->miss_ns);
+  hist_sum(&dst->flush_ns, &src->flush_ns);
+}
+
+void stats_clear(vtpc_stats_t *s) {
+  uint64_t *words = (uint64_t *)s;
+  for (size_t i = 0; i < sizeof(*s) / sizeof(uint64_t); i++) {
+    __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "vtpc.h"
+
+/*
+ * Counters are bumped with relaxed atomics from whichever thread does the
+ * work and summed on demand, so a snapshot is consistent per counter but
+ * not across counters. Keep one block per shard to stay off shared lines.
+ */
+
+static inline void stats_add(uint64_t *ctr, uint64_t n) {
+  __atomic_fetch_add(ctr, n, __ATOMIC_RELAXED);
+}
+
+void stats_time(vtpc_hist_t *h, uint64_t ns);
+void stats_sum(vtpc_stats_t *dst, const vtpc_stats_t *src);
+void stats_clear(vtpc_stats_t *s);
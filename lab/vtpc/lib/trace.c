@@ -0,0 +1,102 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_BUF_RECORDS 4096u
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_on; /* atomic, so an idle trace_log() takes no lock */
+static int g_fd = -1;
+static uint64_t g_t0;
+static trace_rec_t g_buf[TRACE_BUF_RECORDS];
+static uint32_t g_nbuf;
+static pthread_once_t g_exit_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/* A trace that cannot be written stops there rather than fail the I/O. */
+static void flush_locked(void) {
+  if (g_nbuf > 0 && write_all(g_fd, g_buf, g_nbuf * sizeof(trace_rec_t)) != 0) {
+    __atomic_store_n(&g_on, 0, __ATOMIC_RELAXED);
+  }
+  g_nbuf = 0;
+}
+
+static void stop_at_exit(void) {
+  (void)trace_start(NULL);
+}
+
+static void register_exit(void) {
+  (void)atexit(stop_at_exit);
+}
+
+int trace_start(const char *path) {
+  pthread_mutex_lock(&g_lock);
+  if (g_fd >= 0) {
+    flush_locked();
+    __atomic_store_n(&g_on, 0, __ATOMIC_RELAXED);
+    (void)close(g_fd);
+    g_fd = -1;
+  }
+  if (!path) {
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  trace_header_t h = {
+      .magic = TRACE_MAGIC,
+      .version = TRACE_VERSION,
+      .record_size = sizeof(trace_rec_t),
+  };
+  if (fd < 0 || write_all(fd, &h, sizeof(h)) != 0) {
+    int saved = errno;
+    if (fd >= 0) (void)close(fd);
+    pthread_mutex_unlock(&g_lock);
+    errno = saved;
+    return -1;
+  }
+  g_fd = fd;
+  g_t0 = now_ns();
+  __atomic_store_n(&g_on, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&g_lock);
+  pthread_once(&g_exit_once, register_exit);
+  return 0;
+}
+
+void trace_log(uint32_t op, int fd, int64_t offset, uint64_t length) {
+  if (!__atomic_load_n(&g_on, __ATOMIC_RELAXED)) return;
+  pthread_mutex_lock(&g_lock);
+  if (g_fd >= 0 && __atomic_load_n(&g_on, __ATOMIC_RELAXED)) {
+    g_buf[g_nbuf++] = (trace_rec_t){
+        .ns = now_ns() - g_t0,
+        .offset = offset,
+        .length = length,
+        .fd = fd,
+        .op = op,
+    };
+    if (g_nbuf == TRACE_BUF_RECORDS) flush_locked();
+  }
+  pthread_mutex_unlock(&g_lock);
+}
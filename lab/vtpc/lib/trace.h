@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * An I/O trace: a trace_header_t, then one fixed-size record per call, in
+ * the order the calls returned. Reads and writes record the bytes they
+ * moved, so a short read at the end of a file covers only what it
+ * returned, and failed calls are left out. An open records the identity of
+ * the file, which the later records of its fd refer to.
+ */
+
+#define TRACE_MAGIC 0x3163727463707476ull /* "vtpctrc1" */
+#define TRACE_VERSION 1u
+
+enum {
+  TRACE_OPEN = 1, /* offset is the inode, length the device */
+  TRACE_CLOSE,
+  TRACE_READ,
+  TRACE_WRITE,
+  TRACE_SYNC,
+  TRACE_PIN, /* the pinned page, in bytes */
+};
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+} trace_header_t;
+
+typedef struct {
+  uint64_t ns; /* since the trace started */
+  int64_t offset;
+  uint64_t length;
+  int32_t fd;
+  uint32_t op;
+} trace_rec_t;
+
+/* Starts a trace to path, ending the one in progress; NULL only ends it.
+ * Records are buffered and written out when the buffer fills, when the
+ * trace ends and at exit. */
+int trace_start(const char *path);
+
+/* Does nothing unless a trace is in progress. */
+void trace_log(uint32_t op, int fd, int64_t offset, uint64_t length);
@@ -4,13 +4,29 @@
 #include "vtpc.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "aio.h"
+#include "key.h"
+#include "manifest.h"
+#include "pageset.h"
+#include "policy.h"
+#include "pool.h"
+#include "ptable.h"
+#include "shared.h"
+#include "stats.h"
+#include "trace.h"
+
 #ifndef VTPC_PAGE_SIZE
 #define VTPC_PAGE_SIZE 4096u
 #endif
@@ -19,465 +35,2991 @@
 #define VTPC_CACHE_PAGES 256u
 #endif
 
+#ifndef VTPC_SHARDS
+#define VTPC_SHARDS 16u
+#endif
+
+#ifndef VTPC_RA_MIN_PAGES
+#define VTPC_RA_MIN_PAGES 4u
+#endif
 
-#define HT_FACTOR 4u
-#define HT_SIZE (VTPC_CACHE_PAGES * HT_FACTOR)
+#ifndef VTPC_RA_MAX_PAGES
+#define VTPC_RA_MAX_PAGES 32u
+#endif
 
+#ifndef VTPC_WB_MAX_PAGES
+#define VTPC_WB_MAX_PAGES 64u
+#endif
 
-typedef struct {
-  int fd;
-  uint64_t page_no;
-} page_key_t;
+#ifndef VTPC_BYPASS_PAGES
+#define VTPC_BYPASS_PAGES 64u
+#endif
 
+#ifndef VTPC_SHARED_PAGES
+#define VTPC_SHARED_PAGES 16384u
+#endif
 
-typedef struct {
-  int in_use;           
-  int dirty;            
-  int key_valid;        
-  page_key_t key;       
-  unsigned char *data;  
-} page_slot_t;
+#ifndef VTPC_COMPRESS_PAGES
+#define VTPC_COMPRESS_PAGES 0u
+#endif
+
+#ifndef VTPC_FLUSHER
+#define VTPC_FLUSHER 0
+#endif
+
+#ifndef VTPC_DIRTY_BACKGROUND_RATIO
+#define VTPC_DIRTY_BACKGROUND_RATIO 10u
+#endif
+
+#ifndef VTPC_DIRTY_EXPIRE_CENTISECS
+#define VTPC_DIRTY_EXPIRE_CENTISECS 3000u
+#endif
+
+#ifndef VTPC_DIRTY_WRITEBACK_CENTISECS
+#define VTPC_DIRTY_WRITEBACK_CENTISECS 500u
+#endif
+
+#ifndef VTPC_POLICY
+#define VTPC_POLICY "lru"
+#endif
+
+#define MIN_PAGE_SIZE 512u
+#define MAX_PAGE_SIZE (1u << 30)
+#define MAX_SHARDS 1024u
+#define SHARD_MIN_PAGES 4u
+#define RA_MAX_BATCHES 16
+#define FLUSH_BATCH 8
+#define FD_TABLE_MIN 64u
+#define FILES_MIN 16u
+#define LAYOUT_ALIGN 64u
 
-typedef enum { HT_EMPTY = 0, HT_USED = 1, HT_TOMB = 2 } ht_state_t;
+
+typedef struct vtpc_file file_t;
 
 typedef struct {
-  ht_state_t st;
+  int in_use;
+  int dirty;
+  int key_valid;
   page_key_t key;
-  int slot_index;
-} ht_entry_t;
+  file_t *file;
+  unsigned char *data;
+  int busy;    /* being filled from disk; not in the policy yet */
+  int wb;      /* being written back by the flusher; pinned */
+  int pins;    /* vtpc_pin() references; out of the policy while any */
+  /* Bytes [valid_lo, valid_hi) hold the page's data. A partial write to a
+   * page that is not resident does not read it in; the rest comes from
+   * disk once it is read, pinned or written back. */
+  uint32_t valid_lo;
+  uint32_t valid_hi;
+  uint32_t gen; /* bumped each time the slot takes a page */
+  uint32_t hits; /* since it took the page, for the manifest */
+  int dirty_prev;
+  int dirty_next;
+  uint64_t dirtied_ns;
+} page_slot_t;
 
+/* A shard owns a fixed range of slots together with the page table,
+ * policy, free stack and dirty list that cover them. Pages are spread over
+ * shards by key hash, and everything in a shard is guarded by its lock. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t settled;  /* a busy or wb page of this shard settled */
+  int base;
+  ptable_t *table;
+  policy_t *policy;
+  int *free;
+  int nfree;
+  int nio;  /* busy + wb pages */
+
+  /* Dirty pages not under writeback, oldest first. */
+  int dirty_head;
+  int dirty_tail;
+  uint32_t ndirty;
+
+  vtpc_stats_t stats;
+} shard_t;
+
+/* A cache instance. Everything but the page arena lives in one block that
+ * starts with this header; slot indices are local to the instance. */
+struct vtpc_cache {
+  size_t block_size;
+  uint32_t page_size;
+  uint32_t npages;
+  int flags;
+  uint32_t nshards;
+  uint32_t shard_pages;
+  uint32_t ra_max;
+  size_t bypass_min;  /* smallest aligned transfer sent around the cache */
+
+  /* Files with open fds or resident pages, hashed by identity. */
+  pthread_mutex_t files_lock;
+  file_t **files;
+  uint32_t files_cap;
+  uint32_t nfiles;
+  int nfds;  /* fds bound to the instance */
+
+  page_slot_t *pages;
+  pset_node_t *res_nodes;
+  pset_node_t *dirty_nodes;
+  shard_t *shards;
+  unsigned char *arena;
+  shared_t *shared;  /* set before any file is added, or NULL */
+  pool_t *pool;      /* likewise */
+  manifest_t *manifest; /* likewise */
+
+  int flusher;
+  int flusher_stop;
+  pthread_t flusher_tid;
+  pthread_mutex_t flush_lock;
+  pthread_cond_t flush_kick;
+};
+
+/* A file as seen by one instance, shared by all its fds there. The cache
+ * does its own I/O through io_fd, a dup of a writable fd if one was ever
+ * bound. It stays in the instance after the last close for as long as it
+ * has resident pages, and is checked against the file's size and mtime
+ * when it is opened again, open or not.
+ *
+ * meta_lock is a leaf taken under shard locks; it guards the page sets,
+ * io_pages, file_size and the stamp. nopen and io_fd are under the
+ * instance's files_lock. */
+struct vtpc_file {
+  uint64_t dev;
+  uint64_t ino;
+  file_t *next;
+  int nopen;
+  int io_fd;
+  int spare_fd;  /* a read-only io_fd replaced by a writable one */
+  off_t stamp_size; /* on disk after the last bind or write from here */
+  struct timespec stamp_mtime;
+
+  pthread_mutex_t meta_lock;
+  pthread_cond_t io_done;
+  off_t file_size;
+  pset_t resident;
+  pset_t dirty;
+  int io_pages;  /* pages being read or written back unlocked */
+  int no_direct; /* O_DIRECT refused by the file system, atomic */
+  uint64_t shared_gen; /* generation in the shared tier, atomic */
+  uint64_t pool_gen;   /* generation in the compressed tier, atomic */
+  vtpc_stats_t stats;  /* evictions and writebacks */
+};
+
+/* io_lock serializes the cursor calls on the fd and guards offset and the
+ * readahead state. Entries are allocated per fd number on first use and
+ * reused, never freed. */
 typedef struct {
   int used;
   int fd;
+  vtpc_cache_t *cache;
+  file_t *file;
+  pthread_mutex_t io_lock;
   off_t offset;
-  off_t file_size;
+  uint64_t ra_prev;    /* last page read through this fd */
+  uint64_t ra_next;    /* first page not yet submitted for readahead */
+  uint64_t ra_marker;  /* reading this page submits the next window */
+  uint32_t ra_size;    /* current window in pages, 0 = no stream */
+  int advice;          /* VTPC_FADV_* pattern, under io_lock */
+  int npins;           /* pages pinned through this fd, atomic */
+  uint64_t last;       /* slot << 32 | gen of the last page, atomic */
+  vtpc_stats_t stats;
 } fd_state_t;
 
+/* Tables only grow; a replaced one is kept, since lookups read it without
+ * a lock, so all of them together take at most twice the last one. */
+typedef struct fd_table {
+  uint32_t cap;
+  struct fd_table *prev; /* the one it replaced */
+  fd_state_t *slots[];
+} fd_table_t;
+
+typedef struct {
+  aio_req_t req;
+  vtpc_cache_t *cache;
+  file_t *file;
+  vtpc_stats_t *demand;  /* stats of the fd that asked for the pages */
+  uint64_t t0;
+  uint32_t npages;
+  int slots[AIO_MAX_VEC];
+  int hints[AIO_MAX_VEC];
+  uint64_t epochs[AIO_MAX_VEC]; /* for shared_fill() */
+} ra_batch_t;
+
+/* A position in an iovec array; off is into iov[0]. */
+typedef struct {
+  const struct iovec *iov;
+  int cnt;
+  size_t off;
+} iov_cursor_t;
+
+/* A run of contiguous dirty pages and the extra shard locks taken for it. */
+typedef struct {
+  file_t *file;
+  uint64_t first;
+  int cnt;
+  int slots[VTPC_WB_MAX_PAGES];
+  shard_t *held[VTPC_WB_MAX_PAGES];
+  int nheld;
+  int fd; /* buffered reopen for a partial page, or -1 */
+} wb_run_t;
+
+
+static fd_table_t *g_fds;
+static pthread_mutex_t g_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Lock order: fd io_lock, g_fds_lock, files_lock, one shard lock, file
+ * meta_lock. Further shard locks are only ever try-locked, so writeback
+ * runs may cross shards. */
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static int g_init_err;
+static policy_kind_t g_policy;
+static uint32_t g_want_shards;
+static uint32_t g_ra_pages;
+static uint32_t g_bypass_pages;
+
+static pthread_once_t g_default_once = PTHREAD_ONCE_INIT;
+static pthread_once_t g_remember_once = PTHREAD_ONCE_INIT;
+static vtpc_cache_t *g_default;
+static int g_default_err;
+
+static ra_batch_t g_ra[RA_MAX_BATCHES];
+static int g_ra_free[RA_MAX_BATCHES];
+static int g_ra_nfree;
+static pthread_mutex_t g_ra_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hands out the generations of files in compressed tiers. */
+static uint64_t g_pool_gen;
+
+static uint32_t g_dirty_ratio;
+static uint64_t g_dirty_expire_ns;
+static uint64_t g_writeback_interval_ns;
+
+static void tunables_init(void);
+static int tunables_ensure(void);
+static void default_init(void);
+static uint32_t env_u32(const char *name, uint32_t def);
+static uint64_t now_ns(void);
+
+static size_t layout_add(size_t *size, size_t bytes);
+static void cache_free(vtpc_cache_t *c);
+static int cache_share(vtpc_cache_t *c, const char *name, size_t capacity_bytes);
+static int cache_compress(vtpc_cache_t *c, size_t capacity_bytes);
+static int cache_manifest(vtpc_cache_t *c, const char *path);
+static void cache_remember(vtpc_cache_t *c);
+static void default_remember(void);
+static void register_remember(void);
+
+static shard_t *shard_for(vtpc_cache_t *c, page_key_t key);
+static shard_t *shard_of_slot(vtpc_cache_t *c, int slot_index);
+static void shard_wait(shard_t *sh);
+
+static page_key_t file_key(const file_t *f, uint64_t page_no);
+static off_t file_size_of(file_t *f);
+static file_t **files_bucket(vtpc_cache_t *c, uint64_t dev, uint64_t ino);
+static int files_grow(vtpc_cache_t *c);
+static file_t *file_get(vtpc_cache_t *c, int fd, const struct stat *sb);
+static int file_put(vtpc_cache_t *c, file_t *f);
+static void file_remember(vtpc_cache_t *c, file_t *f, off_t size, struct timespec mtime);
+static void file_warm(fd_state_t *st);
+static void file_invalidate(vtpc_cache_t *c, file_t *f);
+static void files_reap(vtpc_cache_t *c);
+static void file_grow(file_t *f, off_t size);
+static void file_io_add(file_t *f, int n);
+static void file_io_wait(file_t *f);
+static int file_fd(file_t *f);
+static int file_buffered_fd(file_t *f);
+static uint64_t file_shared_gen(file_t *f);
+static uint64_t file_pool_gen(file_t *f);
+static void file_pool_renew(file_t *f);
+static void file_pool_forget(vtpc_cache_t *c, file_t *f, uint64_t first, uint64_t end);
+static void file_stamp(vtpc_cache_t *c, file_t *f);
+static int file_stamped(file_t *f, const struct stat *sb);
+static void file_recheck(vtpc_cache_t *c, file_t *f, const struct stat *sb);
+static void file_cut(vtpc_cache_t *c, file_t *f, off_t size, int stale);
+static void file_truncate(vtpc_cache_t *c, file_t *f);
+static int fd_is_rdwr(int fd);
+
+static fd_state_t *fd_lookup(int fd);
+static fd_state_t *fd_entry(int fd);
+static fd_state_t *fdstate_ensure(int fd, vtpc_cache_t *c);
+static int fdstate_remove(fd_state_t *st);
+static int insert_flags(const fd_state_t *st);
+
+static void slot_claim(vtpc_cache_t *c, int slot_index, file_t *f, uint64_t page_no);
+static int slot_known(vtpc_cache_t *c, int slot_index, size_t lo, size_t hi);
+static int slot_fill(vtpc_cache_t *c, int slot_index);
+static void slot_attach(vtpc_cache_t *c, int slot_index);
+static void slot_detach(vtpc_cache_t *c, int slot_index);
+static void slot_set_dirty(vtpc_cache_t *c, int slot_index);
+static void slot_clear_dirty(vtpc_cache_t *c, int slot_index);
+static void slot_share(vtpc_cache_t *c, int slot_index);
+static void slot_compress(vtpc_cache_t *c, shard_t *sh, int slot_index);
+static void dirty_list_append(vtpc_cache_t *c, int slot_index);
+static void dirty_list_unlink(vtpc_cache_t *c, int slot_index);
+
+static int run_hold(wb_run_t *run, shard_t *own, shard_t *sh);
+static void run_release(wb_run_t *run);
+static int dirty_slot_of(vtpc_cache_t *c, shard_t *sh, page_key_t key);
+static void gather_run(vtpc_cache_t *c, shard_t *own, int slot_index, wb_run_t *run);
+static void run_prep(vtpc_cache_t *c, aio_req_t *req, const wb_run_t *run);
+static void run_account(shard_t *sh, const wb_run_t *run, uint64_t ns, int ok);
+static int run_result(vtpc_cache_t *c, const aio_req_t *req, const wb_run_t *run);
+static int trim_tail(vtpc_cache_t *c, file_t *f, uint64_t first, int cnt);
+static int flush_slot(vtpc_cache_t *c, shard_t *sh, int slot_index);
+static void evict_slot(vtpc_cache_t *c, shard_t *sh, int slot_index);
+static int take_free_slot(vtpc_cache_t *c, shard_t *sh);
+static void release_slot(vtpc_cache_t *c, int slot_index);
+
+static ra_batch_t *ra_batch_alloc(void);
+static void ra_batch_free(ra_batch_t *b);
+static void ra_complete(aio_req_t *req);
+static void ra_submit(fd_state_t *st, uint64_t first, uint32_t n, uint64_t *fetched);
+static void ra_access(fd_state_t *st, uint64_t page_no);
+
+static int flusher_start(vtpc_cache_t *c);
+static void flusher_join(vtpc_cache_t *c);
+static void flusher_shard(vtpc_cache_t *c, shard_t *sh);
+static void *flusher_main(void *arg);
+
+/* Flags of lock_page(). */
+#define PAGE_WRITE 0x1      /* waits out writeback; a miss is not read */
+#define PAGE_OVERWRITE 0x2  /* the whole page is written, so a miss is not read */
+#define PAGE_FETCHED 0x4    /* fetched and counted by this request already */
+
+#define NO_LAST_PAGE UINT64_MAX /* fd_state_t.last before any page */
+
+static int lock_page(fd_state_t *st, uint64_t page_no, int flags, shard_t **out);
+static int find_page(fd_state_t *st, uint64_t page_no, int flags, shard_t **out);
+
+
+/* Settings shared by every instance: the policy kind, the shard count to
+ * aim for, the readahead limit and the flusher thresholds. */
+static void tunables_init(void) {
+  policy_kind_t kind = POLICY_LRU;
+  if (policy_parse(VTPC_POLICY, &kind) != 0) kind = POLICY_LRU;
+
+  const char *env = getenv("VTPC_POLICY");
+  if (env && *env && policy_parse(env, &kind) != 0) {
+    g_init_err = EINVAL;
+    return;
+  }
+  g_policy = kind;
+
+  g_want_shards = env_u32("VTPC_SHARDS", VTPC_SHARDS);
+  if (g_want_shards > MAX_SHARDS) g_want_shards = MAX_SHARDS;
+  g_ra_pages = env_u32("VTPC_READAHEAD", VTPC_RA_MAX_PAGES);
+  g_bypass_pages = env_u32("VTPC_BYPASS", VTPC_BYPASS_PAGES);
 
-static page_slot_t g_pages[VTPC_CACHE_PAGES];
-static ht_entry_t g_ht[HT_SIZE];
+  const char *trace = getenv("VTPC_TRACE");
+  if (trace && *trace) (void)trace_start(trace);
 
-static fd_state_t g_fds[1024];
+  for (int i = 0; i < RA_MAX_BATCHES; i++) {
+    g_ra[i].req.complete = ra_complete;
+    g_ra_free[g_ra_nfree++] = i;
+  }
 
+  g_dirty_ratio =
+      env_u32("VTPC_DIRTY_BACKGROUND_RATIO", VTPC_DIRTY_BACKGROUND_RATIO);
+  g_dirty_expire_ns = (uint64_t)env_u32(
+                          "VTPC_DIRTY_EXPIRE_CENTISECS",
+                          VTPC_DIRTY_EXPIRE_CENTISECS
+                      ) *
+                      10000000ull;
+  g_writeback_interval_ns = (uint64_t)env_u32(
+                                "VTPC_DIRTY_WRITEBACK_CENTISECS",
+                                VTPC_DIRTY_WRITEBACK_CENTISECS
+                            ) *
+                            10000000ull;
+  if (g_writeback_interval_ns == 0) g_writeback_interval_ns = 10000000ull;
+}
 
-static unsigned int g_rng = 0xC0FFEEu;
+static int tunables_ensure(void) {
+  pthread_once(&g_once, tunables_init);
+  if (g_init_err != 0) {
+    errno = g_init_err;
+    return -1;
+  }
+  return 0;
+}
 
-static uint64_t hash_u64(uint64_t x);
-static uint64_t key_hash(page_key_t k);
-static int key_eq(page_key_t a, page_key_t b);
+/* The default instance keeps the compile-time geometry. */
+static void default_init(void) {
+  int flags = 0;
+  if (env_u32("VTPC_FLUSHER", VTPC_FLUSHER) != 0) flags |= VTPC_CACHE_FLUSHER;
+  g_default = vtpc_cache_create(
+      (size_t)VTPC_CACHE_PAGES * VTPC_PAGE_SIZE, VTPC_PAGE_SIZE, flags
+  );
+  if (!g_default) {
+    g_default_err = errno;
+    return;
+  }
 
-static int ht_find_index(page_key_t key, int *out_found);
-static int ht_lookup(page_key_t key);
-static void ht_insert(page_key_t key, int slot_index);
-static void ht_erase(page_key_t key);
+  int rc = 0;
+  const char *name = getenv("VTPC_SHARED");
+  size_t pages = env_u32("VTPC_SHARED_PAGES", VTPC_SHARED_PAGES);
+  if (name && *name) rc = cache_share(g_default, name, pages * VTPC_PAGE_SIZE);
 
-static int fdstate_ensure(int fd);
-static void fdstate_remove(int fd);
+  pages = env_u32("VTPC_COMPRESS_PAGES", VTPC_COMPRESS_PAGES);
+  if (rc == 0 && pages > 0) {
+    rc = cache_compress(g_default, pages * VTPC_PAGE_SIZE);
+  }
 
-static int alloc_page_data(unsigned char **out);
-static int alloc_aligned(void **out);
+  const char *manifest = getenv("VTPC_MANIFEST");
+  if (rc == 0 && manifest && *manifest) {
+    rc = cache_manifest(g_default, manifest);
+  }
 
-static int flush_slot(int slot_index);
-static void evict_slot(int slot_index);
-static int find_free_slot(void);
-static int random_victim(void);
+  if (rc != 0) {
+    g_default_err = errno;
+    if (g_default->flusher) flusher_join(g_default);
+    cache_free(g_default);
+    g_default = NULL;
+  }
+}
 
-static int load_page_into_slot(int slot_index, int fd, uint64_t page_no, off_t file_size);
-static int get_slot_for_page(int fd, uint64_t page_no, int for_write, int full_overwrite, off_t file_size);
+/* The default instance is never destroyed, so it saves its manifest at
+ * exit. */
+static void default_remember(void) {
+  cache_remember(g_default);
+}
 
+static void register_remember(void) {
+  (void)atexit(default_remember);
+}
 
-static uint64_t hash_u64(uint64_t x) {
-  x ^= x >> 33;
-  x *= 0xff51afd7ed558ccdULL;
-  x ^= x >> 33;
-  x *= 0xc4ceb9fe1a85ec53ULL;
-  x ^= x >> 33;
-  return x;
+static uint32_t env_u32(const char *name, uint32_t def) {
+  const char *env = getenv(name);
+  if (!env || !*env) return def;
+  return (uint32_t)strtoul(env, NULL, 10);
 }
 
-static uint64_t key_hash(page_key_t k) {
-  uint64_t x = ((uint64_t)(uint32_t)k.fd << 32) ^ k.page_no;
-  return hash_u64(x);
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-static int key_eq(page_key_t a, page_key_t b) {
-  return (a.fd == b.fd) && (a.page_no == b.page_no);
+static size_t layout_add(size_t *size, size_t bytes) {
+  size_t off = (*size + LAYOUT_ALIGN - 1u) & ~(size_t)(LAYOUT_ALIGN - 1u);
+  *size = off + bytes;
+  return off;
 }
 
-static int ht_find_index(page_key_t key, int *out_found) {
-  uint64_t h = key_hash(key);
-  uint32_t start = (uint32_t)(h % HT_SIZE);
+vtpc_cache_t *vtpc_cache_create(size_t capacity_bytes, size_t page_size, int flags) {
+  if (tunables_ensure() != 0) return NULL;
+  if (page_size < MIN_PAGE_SIZE || page_size > MAX_PAGE_SIZE ||
+      (page_size & (page_size - 1u)) != 0 || capacity_bytes < page_size ||
+      capacity_bytes / page_size > (size_t)INT32_MAX / 2u) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  uint32_t npages = (uint32_t)(capacity_bytes / page_size);
+  uint32_t nshards = 1;
+  while (nshards * 2u <= g_want_shards &&
+         npages / (nshards * 2u) >= SHARD_MIN_PAGES) {
+    nshards *= 2u;
+  }
+  uint32_t shard_pages = npages / nshards;
+  npages = shard_pages * nshards;
+
+  size_t size = 0;
+  (void)layout_add(&size, sizeof(vtpc_cache_t));
+  size_t pages_off = layout_add(&size, npages * sizeof(page_slot_t));
+  size_t table_stride = ptable_size(shard_pages);
+  table_stride = (table_stride + LAYOUT_ALIGN - 1u) &
+                 ~(size_t)(LAYOUT_ALIGN - 1u);
+  size_t table_off = layout_add(&size, nshards * table_stride);
+  size_t free_off = layout_add(&size, npages * sizeof(int));
+  size_t res_off = layout_add(&size, npages * sizeof(pset_node_t));
+  size_t dirty_off = layout_add(&size, npages * sizeof(pset_node_t));
+  size_t shards_off = layout_add(&size, nshards * sizeof(shard_t));
+  size_t policy_stride = policy_size(g_policy, shard_pages);
+  policy_stride = (policy_stride + LAYOUT_ALIGN - 1u) &
+                  ~(size_t)(LAYOUT_ALIGN - 1u);
+  size_t policy_off = layout_add(&size, nshards * policy_stride);
+
+  unsigned char *block = (unsigned char *)calloc(1, size);
+  if (!block) return NULL;
+
+  vtpc_cache_t *c = (vtpc_cache_t *)block;
+  c->block_size = size;
+  c->page_size = (uint32_t)page_size;
+  c->npages = npages;
+  c->flags = flags;
+  c->nshards = nshards;
+  c->shard_pages = shard_pages;
+  c->pages = (page_slot_t *)(block + pages_off);
+  c->res_nodes = (pset_node_t *)(block + res_off);
+  c->dirty_nodes = (pset_node_t *)(block + dirty_off);
+  c->shards = (shard_t *)(block + shards_off);
+
+  /* Slot pages are carved out of one page-aligned arena, so O_DIRECT
+   * transfers can use them as is. */
+  void *arena = NULL;
+  int rc = posix_memalign(&arena, page_size, (size_t)npages * page_size);
+  if (rc != 0) {
+    free(block);
+    errno = rc;
+    return NULL;
+  }
+  c->arena = (unsigned char *)arena;
 
-  int first_tomb = -1;
-  for (uint32_t i = 0; i < HT_SIZE; i++) {
-    uint32_t idx = (start + i) % HT_SIZE;
-    ht_entry_t *e = &g_ht[idx];
+  for (uint32_t i = 0; i < npages; i++) {
+    c->pages[i].data = c->arena + (size_t)i * page_size;
+    c->pages[i].dirty_prev = -1;
+    c->pages[i].dirty_next = -1;
+  }
 
-    if (e->st == HT_EMPTY) {
-      if (out_found) *out_found = 0;
-      return (first_tomb >= 0) ? first_tomb : (int)idx;
-    }
-    if (e->st == HT_TOMB) {
-      if (first_tomb < 0) first_tomb = (int)idx;
-      continue;
-    }
-    if (key_eq(e->key, key)) {
-      if (out_found) *out_found = 1;
-      return (int)idx;
+  for (uint32_t i = 0; i < nshards; i++) {
+    shard_t *sh = &c->shards[i];
+    pthread_mutex_init(&sh->lock, NULL);
+    pthread_cond_init(&sh->settled, NULL);
+    sh->base = (int)(i * shard_pages);
+    sh->table = (ptable_t *)(block + table_off + i * table_stride);
+    ptable_init(sh->table, shard_pages);
+    sh->free = (int *)(block + free_off) + sh->base;
+    sh->dirty_head = -1;
+    sh->dirty_tail = -1;
+    sh->policy = (policy_t *)(block + policy_off + i * policy_stride);
+    policy_init(sh->policy, g_policy, shard_pages);
+
+    sh->nfree = 0;
+    for (int j = (int)shard_pages - 1; j >= 0; j--) {
+      sh->free[sh->nfree++] = sh->base + j;
     }
   }
 
-  if (out_found) *out_found = 0;
-  return -1;
+  c->files_cap = FILES_MIN;
+  c->files = (file_t **)calloc(c->files_cap, sizeof(file_t *));
+  if (!c->files) {
+    free(arena);
+    free(block);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&c->files_lock, NULL);
+
+  c->ra_max = g_ra_pages;
+  if (c->ra_max > npages / 4u) c->ra_max = npages / 4u;
+  if (flags & VTPC_CACHE_NO_READAHEAD) c->ra_max = 0;
+  c->bypass_min = (size_t)g_bypass_pages * page_size;
+  if (flags & VTPC_CACHE_NO_BYPASS) c->bypass_min = 0;
+
+  pthread_mutex_init(&c->flush_lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&c->flush_kick, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if ((flags & VTPC_CACHE_FLUSHER) && flusher_start(c) != 0) {
+    int saved = errno;
+    cache_free(c);
+    errno = saved;
+    return NULL;
+  }
+  return c;
 }
 
-static int ht_lookup(page_key_t key) {
-  int found = 0;
-  int idx = ht_find_index(key, &found);
-  if (idx < 0 || !found) return -1;
-  return g_ht[idx].slot_index;
+static void cache_free(vtpc_cache_t *c) {
+  for (uint32_t b = 0; b < c->files_cap; b++) {
+    while (c->files[b]) {
+      file_t *f = c->files[b];
+      c->files[b] = f->next;
+      pthread_mutex_destroy(&f->meta_lock);
+      pthread_cond_destroy(&f->io_done);
+      free(f);
+    }
+  }
+  free(c->files);
+  pthread_mutex_destroy(&c->files_lock);
+  for (uint32_t i = 0; i < c->nshards; i++) {
+    pthread_mutex_destroy(&c->shards[i].lock);
+    pthread_cond_destroy(&c->shards[i].settled);
+  }
+  pthread_mutex_destroy(&c->flush_lock);
+  pthread_cond_destroy(&c->flush_kick);
+  shared_detach(c->shared);
+  pool_destroy(c->pool);
+  manifest_close(c->manifest);
+  free(c->arena);
+  free(c);
 }
 
-static void ht_insert(page_key_t key, int slot_index) {
-  int found = 0;
-  int idx = ht_find_index(key, &found);
-  if (idx < 0) return;
-  g_ht[idx].st = HT_USED;
-  g_ht[idx].key = key;
-  g_ht[idx].slot_index = slot_index;
+static int cache_share(vtpc_cache_t *c, const char *name, size_t capacity_bytes) {
+  pthread_mutex_lock(&c->files_lock);
+  if (c->shared || c->nfiles > 0) {
+    pthread_mutex_unlock(&c->files_lock);
+    errno = EBUSY;
+    return -1;
+  }
+  c->shared = shared_attach(name, capacity_bytes, c->page_size);
+  pthread_mutex_unlock(&c->files_lock);
+  return c->shared ? 0 : -1;
 }
 
-static void ht_erase(page_key_t key) {
-  int found = 0;
-  int idx = ht_find_index(key, &found);
-  if (idx < 0 || !found) return;
-  g_ht[idx].st = HT_TOMB;
+int vtpc_cache_share(vtpc_cache_t *c, const char *name, size_t capacity_bytes) {
+  if (!c && !(c = vtpc_cache_default())) return -1;
+  if (!name) {
+    errno = EINVAL;
+    return -1;
+  }
+  return cache_share(c, name, capacity_bytes);
 }
 
-static int fdstate_ensure(int fd) {
-  if (fd < 0 || fd >= (int)(sizeof(g_fds) / sizeof(g_fds[0]))) {
-    errno = EBADF;
+static int cache_compress(vtpc_cache_t *c, size_t capacity_bytes) {
+  pthread_mutex_lock(&c->files_lock);
+  if (c->pool || c->nfiles > 0) {
+    pthread_mutex_unlock(&c->files_lock);
+    errno = EBUSY;
     return -1;
   }
-  if (g_fds[fd].used) return 0;
-
-  struct stat st;
-  if (fstat(fd, &st) != 0) return -1;
-
-  g_fds[fd].used = 1;
-  g_fds[fd].fd = fd;
-  g_fds[fd].offset = 0;
-  g_fds[fd].file_size = (off_t)st.st_size;
-  return 0;
+  c->pool = pool_create(capacity_bytes, c->page_size);
+  pthread_mutex_unlock(&c->files_lock);
+  return c->pool ? 0 : -1;
 }
 
-static void fdstate_remove(int fd) {
-  if (fd < 0 || fd >= (int)(sizeof(g_fds) / sizeof(g_fds[0]))) return;
-  g_fds[fd].used = 0;
-  g_fds[fd].fd = -1;
-  g_fds[fd].offset = 0;
-  g_fds[fd].file_size = 0;
+int vtpc_cache_compress(vtpc_cache_t *c, size_t capacity_bytes) {
+  if (!c && !(c = vtpc_cache_default())) return -1;
+  return cache_compress(c, capacity_bytes);
 }
 
-
-static int alloc_page_data(unsigned char **out) {
-  unsigned char *p = (unsigned char *)malloc(VTPC_PAGE_SIZE);
-  if (!p) {
-    errno = ENOMEM;
+static int cache_manifest(vtpc_cache_t *c, const char *path) {
+  pthread_mutex_lock(&c->files_lock);
+  if (c->manifest || c->nfiles > 0) {
+    pthread_mutex_unlock(&c->files_lock);
+    errno = EBUSY;
     return -1;
   }
-  *out = p;
+  c->manifest = manifest_open(path, c->page_size);
+  pthread_mutex_unlock(&c->files_lock);
+  if (!c->manifest) return -1;
+  if (c == g_default) pthread_once(&g_remember_once, register_remember);
   return 0;
 }
-static int alloc_aligned(void **out) {
-  void *p = NULL;
-  int rc = posix_memalign(&p, VTPC_PAGE_SIZE, VTPC_PAGE_SIZE);
-  if (rc != 0) {
-    errno = rc;
+
+int vtpc_cache_manifest(vtpc_cache_t *c, const char *path) {
+  if (!c && !(c = vtpc_cache_default())) return -1;
+  if (!path) {
+    errno = EINVAL;
     return -1;
   }
-  *out = p;
-  return 0;
+  return cache_manifest(c, path);
 }
 
-static int flush_slot(int slot_index) {
-  page_slot_t *s = &g_pages[slot_index];
-  if (!s->in_use || !s->dirty) return 0;
-
-  void *tmp = NULL;
-  if (alloc_aligned(&tmp) != 0) return -1;
-
-  memcpy(tmp, s->data, VTPC_PAGE_SIZE);
-
-  off_t off = (off_t)(s->key.page_no * (uint64_t)VTPC_PAGE_SIZE);
-  ssize_t wr = pwrite(s->key.fd, tmp, VTPC_PAGE_SIZE, off);
+/* Records the pages of every file, open or not, and saves the manifest. */
+static void cache_remember(vtpc_cache_t *c) {
+  if (!c->manifest) return;
+  pthread_mutex_lock(&c->files_lock);
+  for (uint32_t b = 0; b < c->files_cap; b++) {
+    for (file_t *f = c->files[b]; f; f = f->next) {
+      struct stat sb;
+      if (f->nopen > 0 && fstat(f->io_fd, &sb) == 0) {
+        file_remember(c, f, (off_t)sb.st_size, sb.st_mtim);
+      } else if (f->nopen == 0 && f->stamp_size >= 0) {
+        file_remember(c, f, f->stamp_size, f->stamp_mtime);
+      }
+    }
+  }
+  pthread_mutex_unlock(&c->files_lock);
+  (void)manifest_save(c->manifest);
+}
 
-  int saved = errno;
-  free(tmp);
+int vtpc_shared_unlink(const char *name) {
+  if (!name) {
+    errno = EINVAL;
+    return -1;
+  }
+  return shared_unlink(name);
+}
 
-  if (wr < 0) {
-    errno = saved;
+int vtpc_cache_destroy(vtpc_cache_t *c) {
+  if (!c || c == g_default) {
+    errno = EINVAL;
     return -1;
   }
-  if ((size_t)wr != VTPC_PAGE_SIZE) {
-    errno = EIO;
+
+  pthread_mutex_lock(&c->files_lock);
+  int busy = c->nfds > 0;
+  pthread_mutex_unlock(&c->files_lock);
+  if (busy) {
+    errno = EBUSY;
     return -1;
   }
 
-  s->dirty = 0;
+  if (c->flusher) flusher_join(c);
+  cache_remember(c);
+  cache_free(c);
   return 0;
 }
 
-static void evict_slot(int slot_index) {
-  page_slot_t *s = &g_pages[slot_index];
-  if (!s->in_use) return;
+vtpc_cache_t *vtpc_cache_default(void) {
+  if (tunables_ensure() != 0) return NULL;
+  pthread_once(&g_default_once, default_init);
+  if (!g_default) {
+    errno = g_default_err;
+    return NULL;
+  }
+  return g_default;
+}
 
-  (void)flush_slot(slot_index);
+size_t vtpc_cache_page_size(vtpc_cache_t *cache) {
+  if (!cache && !(cache = vtpc_cache_default())) return 0;
+  return cache->page_size;
+}
 
-  if (s->key_valid) ht_erase(s->key);
+/* The table index uses the low hash bits, so shards take the high ones. */
+static shard_t *shard_for(vtpc_cache_t *c, page_key_t key) {
+  uint32_t h = (uint32_t)(key_hash(key) >> 32);
+  return &c->shards[h & (c->nshards - 1u)];
+}
 
-  s->in_use = 0;
-  s->dirty = 0;
-  s->key_valid = 0;
+static shard_t *shard_of_slot(vtpc_cache_t *c, int slot_index) {
+  return &c->shards[(uint32_t)slot_index / c->shard_pages];
 }
 
-static int find_free_slot(void) {
-  for (int i = 0; i < (int)VTPC_CACHE_PAGES; i++) {
-    if (!g_pages[i].in_use) return i;
-  }
-  return -1;
+static void shard_wait(shard_t *sh) {
+  pthread_cond_wait(&sh->settled, &sh->lock);
 }
 
-static int random_victim(void) {
-  g_rng = g_rng * 1103515245u + 12345u;
-  return (int)(g_rng % VTPC_CACHE_PAGES);
+static page_key_t file_key(const file_t *f, uint64_t page_no) {
+  page_key_t key = {.dev = f->dev, .ino = f->ino, .page_no = page_no};
+  return key;
 }
 
-static int load_page_into_slot(int slot_index, int fd, uint64_t page_no, off_t file_size) {
-  page_slot_t *s = &g_pages[slot_index];
+/* file_size changes under meta_lock but is read without it. */
+static off_t file_size_of(file_t *f) {
+  return __atomic_load_n(&f->file_size, __ATOMIC_RELAXED);
+}
 
-  s->key.fd = fd;
-  s->key.page_no = page_no;
-  s->key_valid = 1;
-  s->in_use = 1;
-  s->dirty = 0;
+static int file_fd(file_t *f) {
+  return __atomic_load_n(&f->io_fd, __ATOMIC_RELAXED);
+}
 
-  if (!s->data) {
-    if (alloc_page_data(&s->data) != 0) return -1;
-  }
+/* A write-only reopen of the io_fd without O_DIRECT, for a write that is
+ * not page aligned; -1 if the io_fd is not O_DIRECT or cannot be
+ * reopened. */
+static int file_buffered_fd(file_t *f) {
+  int fd = file_fd(f);
+  int mode = fcntl(fd, F_GETFL);
+  if (mode < 0 || !(mode & O_DIRECT)) return -1;
+  char path[32];
+  (void)snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, O_WRONLY | O_CLOEXEC);
+}
 
-  off_t off = (off_t)(page_no * (uint64_t)VTPC_PAGE_SIZE);
+static uint64_t file_shared_gen(file_t *f) {
+  return __atomic_load_n(&f->shared_gen, __ATOMIC_RELAXED);
+}
 
-  if (off >= file_size) {
-    memset(s->data, 0, VTPC_PAGE_SIZE);
-    ht_insert(s->key, slot_index);
-    return 0;
+/* Stamps the file with the size and mtime a write from here left it
+ * with, so that the next open does not take the change for someone
+ * else's, and records them in the shared tier for the same reason. */
+static void file_stamp(vtpc_cache_t *c, file_t *f) {
+  struct stat sb;
+  if (fstat(file_fd(f), &sb) != 0) return;
+  pthread_mutex_lock(&f->meta_lock);
+  f->stamp_size = (off_t)sb.st_size;
+  f->stamp_mtime = sb.st_mtim;
+  pthread_mutex_unlock(&f->meta_lock);
+  if (c->shared) {
+    shared_file_written(
+        c->shared, f->dev, f->ino, file_shared_gen(f), sb.st_size, sb.st_mtim
+    );
   }
+}
 
-  void *tmp = NULL;
-  if (alloc_aligned(&tmp) != 0) return -1;
+static int file_stamped(file_t *f, const struct stat *sb) {
+  pthread_mutex_lock(&f->meta_lock);
+  int same = f->stamp_size == sb->st_size &&
+             f->stamp_mtime.tv_sec == sb->st_mtim.tv_sec &&
+             f->stamp_mtime.tv_nsec == sb->st_mtim.tv_nsec;
+  pthread_mutex_unlock(&f->meta_lock);
+  return same;
+}
 
-  ssize_t rd = pread(fd, tmp, VTPC_PAGE_SIZE, off);
-  int saved = errno;
+static uint64_t file_pool_gen(file_t *f) {
+  return __atomic_load_n(&f->pool_gen, __ATOMIC_RELAXED);
+}
 
-  if (rd < 0) {
-    free(tmp);
-    errno = saved;
+/* Moves the file to a generation of its own, which no page in a
+ * compressed tier has yet. */
+static void file_pool_renew(file_t *f) {
+  uint64_t gen = __atomic_add_fetch(&g_pool_gen, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&f->pool_gen, gen, __ATOMIC_RELAXED);
+}
+
+/* Drops the compressed copies of [first, end); all of them at once by a
+ * new generation if that covers the file. */
+static void file_pool_forget(vtpc_cache_t *c, file_t *f, uint64_t first, uint64_t end) {
+  uint64_t pages =
+      ((uint64_t)file_size_of(f) + c->page_size - 1) / c->page_size;
+  if (first == 0 && end >= pages) {
+    file_pool_renew(f);
+    return;
+  }
+  for (uint64_t p = first; p < end && p < pages; p++) {
+    pool_drop(c->pool, file_key(f, p));
+  }
+}
+
+static file_t **files_bucket(vtpc_cache_t *c, uint64_t dev, uint64_t ino) {
+  page_key_t key = {.dev = dev, .ino = ino, .page_no = 0};
+  return &c->files[key_hash(key) & (c->files_cap - 1u)];
+}
+
+static int files_grow(vtpc_cache_t *c) {
+  uint32_t old_cap = c->files_cap;
+  file_t **old = c->files;
+  file_t **files = (file_t **)calloc(old_cap * 2u, sizeof(file_t *));
+  if (!files) {
+    errno = ENOMEM;
     return -1;
   }
 
-  if (rd == 0) {
-    memset(s->data, 0, VTPC_PAGE_SIZE);
-  } else {
-    memcpy(s->data, tmp, (size_t)rd);
-    if ((size_t)rd < VTPC_PAGE_SIZE) {
-      memset(s->data + rd, 0, VTPC_PAGE_SIZE - (size_t)rd);
+  c->files = files;
+  c->files_cap = old_cap * 2u;
+  for (uint32_t b = 0; b < old_cap; b++) {
+    while (old[b]) {
+      file_t *f = old[b];
+      old[b] = f->next;
+      file_t **to = files_bucket(c, f->dev, f->ino);
+      f->next = *to;
+      *to = f;
     }
   }
-
-  free(tmp);
-
-  ht_insert(s->key, slot_index);
+  free(old);
   return 0;
 }
 
-static int get_slot_for_page(int fd, uint64_t page_no, int for_write, int full_overwrite, off_t file_size) {
-  page_key_t key = {.fd = fd, .page_no = page_no};
-
-  int slot = ht_lookup(key);
-  if (slot >= 0) {
-    return slot;
+/* Frees closed files whose pages are all gone. */
+static void files_reap(vtpc_cache_t *c) {
+  for (uint32_t b = 0; b < c->files_cap; b++) {
+    file_t **link = &c->files[b];
+    while (*link) {
+      file_t *f = *link;
+      pthread_mutex_lock(&f->meta_lock);
+      int idle = f->nopen == 0 && f->resident.size == 0 && f->io_pages == 0;
+      pthread_mutex_unlock(&f->meta_lock);
+      if (!idle) {
+        link = &f->next;
+        continue;
+      }
+      *link = f->next;
+      pthread_mutex_destroy(&f->meta_lock);
+      pthread_cond_destroy(&f->io_done);
+      free(f);
+      c->nfiles--;
+    }
   }
+}
+
+static int fd_is_rdwr(int fd) {
+  int mode = fcntl(fd, F_GETFL);
+  return mode >= 0 && (mode & O_ACCMODE) == O_RDWR;
+}
 
-  slot = find_free_slot();
-  if (slot < 0) {
-    slot = random_victim();
-    evict_slot(slot);
+/* Binds fd to the entry of its file, with files_lock held. A file keeps
+ * its pages only if its size and mtime are still those of its stamp; the
+ * cache does not see writes made behind its back until then. */
+static file_t *file_get(vtpc_cache_t *c, int fd, const struct stat *sb) {
+  uint64_t dev = (uint64_t)sb->st_dev;
+  uint64_t ino = (uint64_t)sb->st_ino;
+  file_t *f = *files_bucket(c, dev, ino);
+  while (f && !(f->dev == dev && f->ino == ino)) f = f->next;
+
+  if (f && f->nopen > 0) {
+    if (!fd_is_rdwr(file_fd(f)) && fd_is_rdwr(fd)) {
+      int io_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+      if (io_fd < 0) return NULL;
+      f->spare_fd = f->io_fd;
+      __atomic_store_n(&f->io_fd, io_fd, __ATOMIC_RELAXED);
+    }
+    if (!file_stamped(f, sb)) file_recheck(c, f, sb);
+    f->nopen++;
+    c->nfds++;
+    return f;
   }
 
-  if (for_write && full_overwrite) {
-    page_slot_t *s = &g_pages[slot];
-    if (!s->data) {
-      if (alloc_page_data(&s->data) != 0) return -1;
+  int io_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (io_fd < 0) return NULL;
+
+  if (f) {
+    if (!file_stamped(f, sb)) {
+      file_invalidate(c, f);
+      file_pool_renew(f);
     }
-    s->key = key;
-    s->key_valid = 1;
-    s->in_use = 1;
-    s->dirty = 0;
-    memset(s->data, 0, VTPC_PAGE_SIZE);
-    ht_insert(key, slot);
-    return slot;
+  } else {
+    if (c->nfiles >= c->files_cap) files_reap(c);
+    if (c->nfiles >= c->files_cap && files_grow(c) != 0) {
+      close(io_fd);
+      return NULL;
+    }
+    f = (file_t *)calloc(1, sizeof(*f));
+    if (!f) {
+      close(io_fd);
+      errno = ENOMEM;
+      return NULL;
+    }
+    f->dev = dev;
+    f->ino = ino;
+    pthread_mutex_init(&f->meta_lock, NULL);
+    pthread_cond_init(&f->io_done, NULL);
+    pset_init(&f->resident);
+    pset_init(&f->dirty);
+    file_pool_renew(f);
+
+    file_t **b = files_bucket(c, dev, ino);
+    f->next = *b;
+    *b = f;
+    c->nfiles++;
   }
 
-  if (load_page_into_slot(slot, fd, page_no, file_size) != 0) return -1;
-  return slot;
+  pthread_mutex_lock(&f->meta_lock);
+  __atomic_store_n(&f->file_size, (off_t)sb->st_size, __ATOMIC_RELAXED);
+  f->stamp_size = (off_t)sb->st_size;
+  f->stamp_mtime = sb->st_mtim;
+  pthread_mutex_unlock(&f->meta_lock);
+  if (c->shared) {
+    uint64_t gen = shared_file(c->shared, dev, ino, sb->st_size, sb->st_mtim);
+    __atomic_store_n(&f->shared_gen, gen, __ATOMIC_RELAXED);
+  }
+  f->io_fd = io_fd;
+  f->spare_fd = -1;
+  f->nopen = 1;
+  c->nfds++;
+  return f;
 }
 
+/* Drops an fd's hold on its file. The last one waits for the I/O still
+ * in flight, stamps the file, records it in the manifest and closes the
+ * cache's own fds; the pages stay for the next open. Takes files_lock and
+ * returns 1 for the last one. */
+static int file_put(vtpc_cache_t *c, file_t *f) {
+  pthread_mutex_lock(&c->files_lock);
+  c->nfds--;
+  int last = --f->nopen == 0;
+  if (last) {
+    file_io_wait(f);
+
+    struct stat sb;
+    pthread_mutex_lock(&f->meta_lock);
+    if (fstat(f->io_fd, &sb) == 0) {
+      f->stamp_size = (off_t)sb.st_size;
+      f->stamp_mtime = sb.st_mtim;
+    } else {
+      f->stamp_size = -1;
+    }
+    pthread_mutex_unlock(&f->meta_lock);
+    if (c->manifest && f->stamp_size >= 0) {
+      file_remember(c, f, f->stamp_size, f->stamp_mtime);
+    }
+    close(f->io_fd);
+    if (f->spare_fd >= 0) close(f->spare_fd);
+    f->io_fd = -1;
+    f->spare_fd = -1;
+  }
+  pthread_mutex_unlock(&c->files_lock);
+  return last;
+}
 
-int vtpc_open(const char *path, int mode, int access) {
-#ifdef O_DIRECT
-  mode |= O_DIRECT;
-#endif
+/* Records the resident pages of the file in the manifest under the size
+ * and mtime it has on disk. Takes shard locks, so files_lock may be held
+ * but no shard lock. */
+static void file_remember(vtpc_cache_t *c, file_t *f, off_t size, struct timespec mtime) {
+  manifest_page_t *pages =
+      (manifest_page_t *)malloc(c->npages * sizeof(manifest_page_t));
+  if (!pages) return;
+
+  uint32_t n = 0;
+  uint64_t from = 0;
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->resident, c->res_nodes, from);
+       i >= 0 && n < c->npages;
+       i = pset_lower_bound(&f->resident, c->res_nodes, from)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    from = key.page_no + 1;
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && !c->pages[slot].busy) {
+      pages[n++] = (manifest_page_t){
+          .page_no = key.page_no,
+          .hotness = c->pages[slot].hits,
+      };
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
 
-  int fd = open(path, mode, access);
-  if (fd < 0) return -1;
+  (void)manifest_record(c->manifest, f->dev, f->ino, size, mtime, pages, n);
+  free(pages);
+}
 
-  if (fdstate_ensure(fd) != 0) {
-    int saved = errno;
-    close(fd);
-    errno = saved;
-    return -1;
+/* Reads in the pages the manifest lists for a file just opened, if it
+ * has not changed since. Runs of them go out as readahead in offset
+ * order and are not waited for. */
+static void file_warm(fd_state_t *st) {
+  vtpc_cache_t *c = st->cache;
+  struct stat sb;
+  if (fstat(st->fd, &sb) != 0) return;
+
+  uint64_t *pages = NULL;
+  uint32_t n = manifest_claim(
+      c->manifest, st->file->dev, st->file->ino, sb.st_size, sb.st_mtim,
+      c->npages, &pages
+  );
+  pthread_mutex_lock(&st->io_lock);
+  for (uint32_t i = 0; i < n;) {
+    uint32_t run = 1;
+    while (i + run < n && run < AIO_MAX_VEC &&
+           pages[i + run] == pages[i] + run) {
+      run++;
+    }
+    ra_submit(st, pages[i], run, NULL);
+    i += run;
   }
-
-  return fd;
+  pthread_mutex_unlock(&st->io_lock);
+  free(pages);
 }
 
-int vtpc_close(int fd) {
-  if (fdstate_ensure(fd) != 0) return -1;
-
-  for (int i = 0; i < (int)VTPC_CACHE_PAGES; i++) {
-    if (g_pages[i].in_use && g_pages[i].key_valid && g_pages[i].key.fd == fd) {
-      if (flush_slot(i) != 0) {
-        int saved = errno;
-        evict_slot(i);
-        (void)close(fd);
-        fdstate_remove(fd);
-        errno = saved;
-        return -1;
+/* Evicts every page of a closed file, which are all clean. */
+static void file_invalidate(vtpc_cache_t *c, file_t *f) {
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_first(&f->resident, c->res_nodes); i >= 0;
+       i = pset_first(&f->resident, c->res_nodes)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0) {
+      if (c->pages[slot].busy || c->pages[slot].wb) {
+        shard_wait(sh);
+      } else {
+        evict_slot(c, sh, slot);
       }
-      evict_slot(i);
     }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
   }
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-  fdstate_remove(fd);
-  return close(fd);
+/* An open file was changed from outside since its stamp: its clean pages
+ * go, and if it shrank, so does everything past its new end, dirty or not.
+ * Dirty pages within it stay, as writes from here made after the change. */
+static void file_recheck(vtpc_cache_t *c, file_t *f, const struct stat *sb) {
+  off_t size = (off_t)sb->st_size;
+  pthread_mutex_lock(&f->meta_lock);
+  int shrank = size < f->stamp_size;
+  pthread_mutex_unlock(&f->meta_lock);
+
+  file_cut(c, f, shrank ? size : (off_t)INT64_MAX, 1);
+  file_pool_renew(f);
+
+  pthread_mutex_lock(&f->meta_lock);
+  if (shrank || size > f->file_size) {
+    __atomic_store_n(&f->file_size, size, __ATOMIC_RELAXED);
+  }
+  f->stamp_size = size;
+  f->stamp_mtime = sb->st_mtim;
+  pthread_mutex_unlock(&f->meta_lock);
+  if (c->shared) {
+    uint64_t gen =
+        shared_file(c->shared, f->dev, f->ino, sb->st_size, sb->st_mtim);
+    __atomic_store_n(&f->shared_gen, gen, __ATOMIC_RELAXED);
+  }
 }
 
-ssize_t vtpc_read(int fd, void *buf, size_t count) {
-  if (count == 0) return 0;
-  if (!buf) {
-    errno = EINVAL;
-    return -1;
+/* Drops what the cache holds of the file past size: pages past it go,
+ * dirty or not, and a dirty page it ends in loses the bytes past it. With
+ * stale set, every clean page goes as well. Pinned pages stay, zeroed past
+ * size and no longer dirty there. */
+static void file_cut(vtpc_cache_t *c, file_t *f, off_t size, int stale) {
+  uint64_t from = 0;
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->resident, c->res_nodes, from); i >= 0;
+       i = pset_lower_bound(&f->resident, c->res_nodes, from)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && (c->pages[slot].busy || c->pages[slot].wb)) {
+      shard_wait(sh);
+    } else {
+      from = key.page_no + 1;
+      if (slot >= 0) {
+        page_slot_t *s = &c->pages[slot];
+        off_t at = (off_t)(key.page_no * (uint64_t)c->page_size);
+        size_t keep = 0;
+        if (at < size) {
+          keep = (size - at < (off_t)c->page_size) ? (size_t)(size - at)
+                                                   : c->page_size;
+        }
+        if (s->dirty && keep < c->page_size) {
+          if (keep <= s->valid_lo) {
+            slot_clear_dirty(c, slot);
+          } else if (s->valid_hi > keep) {
+            s->valid_hi = (uint32_t)keep;
+          }
+        }
+        if (keep < c->page_size) {
+          memset(s->data + keep, 0, c->page_size - keep);
+        }
+        if (!s->dirty && s->pins == 0 && (keep < c->page_size || stale)) {
+          evict_slot(c, sh, slot);
+        }
+      }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
   }
-  if (fdstate_ensure(fd) != 0) return -1;
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-  fd_state_t *st = &g_fds[fd];
+/* The file was opened with O_TRUNC, which emptied it under any fds open
+ * on it already. A writeback that was in flight then may have grown it
+ * again past anything written since. */
+static void file_truncate(vtpc_cache_t *c, file_t *f) {
+  file_cut(c, f, 0, 1);
+  file_pool_renew(f);
+  pthread_mutex_lock(&f->meta_lock);
+  __atomic_store_n(&f->file_size, 0, __ATOMIC_RELAXED);
+  struct stat sb;
+  if (fstat(file_fd(f), &sb) == 0 && sb.st_size > 0) {
+    (void)ftruncate(file_fd(f), 0);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+  file_stamp(c, f);
+}
 
-  if (st->offset >= st->file_size) return 0;
+static void file_grow(file_t *f, off_t size) {
+  pthread_mutex_lock(&f->meta_lock);
+  if (size > f->file_size) {
+    __atomic_store_n(&f->file_size, size, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-  unsigned char *out = (unsigned char *)buf;
-  size_t done = 0;
+static void file_io_add(file_t *f, int n) {
+  pthread_mutex_lock(&f->meta_lock);
+  f->io_pages += n;
+  if (f->io_pages == 0) pthread_cond_broadcast(&f->io_done);
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-  while (count > 0) {
-    if (st->offset >= st->file_size) break;
+static void file_io_wait(file_t *f) {
+  pthread_mutex_lock(&f->meta_lock);
+  while (f->io_pages > 0) pthread_cond_wait(&f->io_done, &f->meta_lock);
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-    uint64_t page_no = (uint64_t)(st->offset / (off_t)VTPC_PAGE_SIZE);
-    size_t in_page = (size_t)(st->offset % (off_t)VTPC_PAGE_SIZE);
+static fd_state_t *fd_lookup(int fd) {
+  fd_table_t *t = __atomic_load_n(&g_fds, __ATOMIC_ACQUIRE);
+  if (!t || (uint32_t)fd >= t->cap) return NULL;
+  return __atomic_load_n(&t->slots[fd], __ATOMIC_ACQUIRE);
+}
 
-    size_t can_take = VTPC_PAGE_SIZE - in_page;
-    size_t need = (count < can_take) ? count : can_take;
+/* Returns the entry of fd, with g_fds_lock held, growing the table to
+ * the next power of two that covers it. */
+static fd_state_t *fd_entry(int fd) {
+  fd_table_t *t = g_fds;
+  if (!t || (uint32_t)fd >= t->cap) {
+    uint32_t cap = t ? t->cap : FD_TABLE_MIN;
+    while (cap <= (uint32_t)fd) cap *= 2u;
+    fd_table_t *grown = (fd_table_t *)calloc(
+        1, sizeof(fd_table_t) + (size_t)cap * sizeof(fd_state_t *)
+    );
+    if (!grown) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    grown->cap = cap;
+    grown->prev = t;
+    if (t) memcpy(grown->slots, t->slots, t->cap * sizeof(fd_state_t *));
+    __atomic_store_n(&g_fds, grown, __ATOMIC_RELEASE);
+    t = grown;
+  }
 
-    off_t remain = st->file_size - st->offset;
-    if ((off_t)need > remain) need = (size_t)remain;
+  if (!t->slots[fd]) {
+    fd_state_t *st = (fd_state_t *)calloc(1, sizeof(*st));
+    if (!st) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    st->fd = -1;
+    pthread_mutex_init(&st->io_lock, NULL);
+    __atomic_store_n(&t->slots[fd], st, __ATOMIC_RELEASE);
+  }
+  return t->slots[fd];
+}
 
-    int slot = get_slot_for_page(fd, page_no, 0, 0, st->file_size);
-    if (slot < 0) return (done > 0) ? (ssize_t)done : -1;
+/* An fd that was not opened through vtpc is bound to the default instance
+ * on first use. */
+static fd_state_t *fdstate_ensure(int fd, vtpc_cache_t *c) {
+  if (tunables_ensure() != 0) return NULL;
+  if (fd < 0) {
+    errno = EBADF;
+    return NULL;
+  }
 
-    memcpy(out, g_pages[slot].data + in_page, need);
+  fd_state_t *st = fd_lookup(fd);
+  if (st && __atomic_load_n(&st->used, __ATOMIC_ACQUIRE)) return st;
+  if (!c && !(c = vtpc_cache_default())) return NULL;
+
+  pthread_mutex_lock(&g_fds_lock);
+  st = fd_entry(fd);
+  if (st && !st->used) {
+    struct stat sb;
+    file_t *f = NULL;
+    if (fstat(fd, &sb) == 0) {
+      pthread_mutex_lock(&c->files_lock);
+      f = file_get(c, fd, &sb);
+      pthread_mutex_unlock(&c->files_lock);
+    }
 
-    out += need;
-    st->offset += (off_t)need;
-    done += need;
-    count -= need;
+    if (f) {
+      st->fd = fd;
+      st->cache = c;
+      st->file = f;
+      st->offset = 0;
+      st->ra_prev = UINT64_MAX;
+      st->ra_size = 0;
+      st->advice = VTPC_FADV_NORMAL;
+      st->npins = 0;
+      st->last = NO_LAST_PAGE;
+      stats_clear(&st->stats);
+      __atomic_store_n(&st->used, 1, __ATOMIC_RELEASE);
+      trace_log(TRACE_OPEN, fd, (int64_t)f->ino, f->dev);
+    } else {
+      st = NULL;
+    }
   }
+  pthread_mutex_unlock(&g_fds_lock);
+  return st;
+}
 
-  return (ssize_t)done;
+static int fdstate_remove(fd_state_t *st) {
+  pthread_mutex_lock(&g_fds_lock);
+  __atomic_store_n(&st->used, 0, __ATOMIC_RELEASE);
+  int last = file_put(st->cache, st->file);
+  st->cache = NULL;
+  st->file = NULL;
+  st->fd = -1;
+  st->offset = 0;
+  pthread_mutex_unlock(&g_fds_lock);
+  return last;
 }
 
-ssize_t vtpc_write(int fd, const void *buf, size_t count) {
-  if (count == 0) return 0;
-  if (!buf) {
-    errno = EINVAL;
-    return -1;
+/* Pages of a scan go in cold and are not promoted by hits. Positional
+ * calls get here without io_lock, hence the atomic load. */
+static int insert_flags(const fd_state_t *st) {
+  int advice = __atomic_load_n(&st->advice, __ATOMIC_RELAXED);
+  if (advice == VTPC_FADV_SEQUENTIAL || advice == VTPC_FADV_NOREUSE) {
+    return POLICY_INSERT_COLD;
   }
-  if (fdstate_ensure(fd) != 0) return -1;
-
-  fd_state_t *st = &g_fds[fd];
+  return 0;
+}
 
-  const unsigned char *in = (const unsigned char *)buf;
-  size_t done = 0;
+static void slot_claim(vtpc_cache_t *c, int slot_index, file_t *f, uint64_t page_no) {
+  page_slot_t *s = &c->pages[slot_index];
+  s->key = file_key(f, page_no);
+  s->file = f;
+  s->key_valid = 1;
+  s->in_use = 1;
+  s->dirty = 0;
+  s->gen++;
+  s->hits = 0;
+  s->valid_lo = 0;
+  s->valid_hi = c->page_size;
+}
 
-  while (count > 0) {
-    uint64_t page_no = (uint64_t)(st->offset / (off_t)VTPC_PAGE_SIZE);
-    size_t in_page = (size_t)(st->offset % (off_t)VTPC_PAGE_SIZE);
+static int slot_known(vtpc_cache_t *c, int slot_index, size_t lo, size_t hi) {
+  const page_slot_t *s = &c->pages[slot_index];
+  return lo >= s->valid_lo && hi <= s->valid_hi;
+}
 
-    size_t can_put = VTPC_PAGE_SIZE - in_page;
-    size_t need = (count < can_put) ? count : can_put;
+/* Reads in the bytes of a partly written page that writes did not cover.
+ * Runs with the page's shard locked throughout, like flush_slot(). */
+static int slot_fill(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (slot_known(c, slot_index, 0, c->page_size)) return 0;
 
-    int full_overwrite = (in_page == 0 && need == VTPC_PAGE_SIZE) ? 1 : 0;
+  void *buf = NULL;
+  int rc = posix_memalign(&buf, c->page_size, c->page_size);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  uint64_t gen = file_shared_gen(s->file);
+  uint64_t epoch = 0;
+  ssize_t rd = c->page_size;
+  int read = !c->shared || !shared_get(c->shared, s->key, gen, buf, &epoch);
+  if (read) {
+    aio_req_t req = {
+        .op = AIO_READ,
+        .fd = file_fd(s->file),
+        .offset = (off_t)(s->key.page_no * (uint64_t)c->page_size),
+        .iovcnt = 1,
+        .iov = {{.iov_base = buf, .iov_len = c->page_size}},
+    };
+    uint64_t t0 = now_ns();
+    rd = aio_run(&req);
+    if (rd < 0) {
+      int saved = errno;
+      free(buf);
+      errno = saved;
+      return -1;
+    }
+    stats_time(&shard_of_slot(c, slot_index)->stats.miss_ns, now_ns() - t0);
+  }
 
-    int slot = get_slot_for_page(fd, page_no, 1, full_overwrite, st->file_size);
-    if (slot < 0) return (done > 0) ? (ssize_t)done : -1;
+  unsigned char *disk = (unsigned char *)buf;
+  if ((size_t)rd < c->page_size) {
+    memset(disk + rd, 0, c->page_size - (size_t)rd);
+  }
+  if (read && c->shared) shared_fill(c->shared, s->key, gen, epoch, disk);
+  memcpy(s->data, disk, s->valid_lo);
+  memcpy(s->data + s->valid_hi, disk + s->valid_hi, c->page_size - s->valid_hi);
+  s->valid_lo = 0;
+  s->valid_hi = c->page_size;
+  free(buf);
+  return 0;
+}
 
-    memcpy(g_pages[slot].data + in_page, in, need);
-    g_pages[slot].dirty = 1;
+static void slot_attach(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  file_t *f = s->file;
+  shard_t *sh = shard_of_slot(c, slot_index);
+  (void)ptable_insert(sh->table, s->key, slot_index);
+  pthread_mutex_lock(&f->meta_lock);
+  pset_insert(&f->resident, c->res_nodes, slot_index, s->key.page_no);
+  pthread_mutex_unlock(&f->meta_lock);
+}
 
-    in += need;
-    st->offset += (off_t)need;
-    done += need;
-    count -= need;
+static void slot_detach(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  file_t *f = s->file;
+  ptable_erase(shard_of_slot(c, slot_index)->table, s->key);
+  pthread_mutex_lock(&f->meta_lock);
+  pset_erase(&f->resident, c->res_nodes, slot_index);
+  if (s->dirty) pset_erase(&f->dirty, c->dirty_nodes, slot_index);
+  pthread_mutex_unlock(&f->meta_lock);
+  if (s->dirty) dirty_list_unlink(c, slot_index);
+}
 
-    if (st->offset > st->file_size) st->file_size = st->offset;
+static void slot_set_dirty(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (s->dirty) return;
+  s->dirty = 1;
+  file_t *f = s->file;
+  pthread_mutex_lock(&f->meta_lock);
+  pset_insert(&f->dirty, c->dirty_nodes, slot_index, s->key.page_no);
+  pthread_mutex_unlock(&f->meta_lock);
+
+  shard_t *sh = shard_of_slot(c, slot_index);
+  s->dirtied_ns = c->flusher ? now_ns() : 0;
+  dirty_list_append(c, slot_index);
+  if (c->flusher && sh->ndirty * 100u >= g_dirty_ratio * c->shard_pages) {
+    pthread_cond_signal(&c->flush_kick);
   }
+}
 
-  return (ssize_t)done;
+static void slot_clear_dirty(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (!s->dirty) return;
+  s->dirty = 0;
+  file_t *f = s->file;
+  pthread_mutex_lock(&f->meta_lock);
+  pset_erase(&f->dirty, c->dirty_nodes, slot_index);
+  pthread_mutex_unlock(&f->meta_lock);
+  dirty_list_unlink(c, slot_index);
 }
 
-off_t vtpc_lseek(int fd, off_t offset, int whence) {
-  if (fdstate_ensure(fd) != 0) return (off_t)-1;
+/* Hands a page just written back to the shared tier, with its shard
+ * locked. A partial page, or one a pin may change, is dropped there. */
+static void slot_share(vtpc_cache_t *c, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (s->pins == 0 && slot_known(c, slot_index, 0, c->page_size)) {
+    shared_write(c->shared, s->key, file_shared_gen(s->file), s->data);
+  } else {
+    shared_drop(c->shared, s->key);
+  }
+}
 
-  if (whence != SEEK_SET) {
-    errno = EINVAL;
-    return (off_t)-1;
+/* Keeps a compressed copy of a victim in the instance's tier, written back
+ * first; one that stays dirty or is partial is let go. */
+static void slot_compress(vtpc_cache_t *c, shard_t *sh, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (flush_slot(c, sh, slot_index) != 0 || s->dirty ||
+      !slot_known(c, slot_index, 0, c->page_size)) {
+    return;
   }
-  if (offset < 0) {
-    errno = EINVAL;
-    return (off_t)-1;
+  size_t len = pool_put(c->pool, s->key, file_pool_gen(s->file), s->data);
+  if (len > 0) {
+    stats_add(&sh->stats.compressed, 1);
+    stats_add(&sh->stats.compressed_bytes, len);
+  } else {
+    stats_add(&sh->stats.incompressible, 1);
   }
-
-  g_fds[fd].offset = offset;
-  return offset;
 }
 
-int vtpc_fsync(int fd) {
-  if (fdstate_ensure(fd) != 0) return -1;
+static void dirty_list_append(vtpc_cache_t *c, int slot_index) {
+  shard_t *sh = shard_of_slot(c, slot_index);
+  page_slot_t *s = &c->pages[slot_index];
+  s->dirty_next = -1;
+  s->dirty_prev = sh->dirty_tail;
+  if (sh->dirty_tail >= 0) {
+    c->pages[sh->dirty_tail].dirty_next = slot_index;
+  } else {
+    sh->dirty_head = slot_index;
+  }
+  sh->dirty_tail = slot_index;
+  sh->ndirty++;
+}
+
+static void dirty_list_unlink(vtpc_cache_t *c, int slot_index) {
+  shard_t *sh = shard_of_slot(c, slot_index);
+  page_slot_t *s = &c->pages[slot_index];
+  if (s->dirty_prev < 0 && sh->dirty_head != slot_index) return;
+
+  if (s->dirty_prev >= 0) {
+    c->pages[s->dirty_prev].dirty_next = s->dirty_next;
+  } else {
+    sh->dirty_head = s->dirty_next;
+  }
+  if (s->dirty_next >= 0) {
+    c->pages[s->dirty_next].dirty_prev = s->dirty_prev;
+  } else {
+    sh->dirty_tail = s->dirty_prev;
+  }
+  s->dirty_prev = -1;
+  s->dirty_next = -1;
+  sh->ndirty--;
+}
+
+/* own is locked by the caller; other shards are only try-locked, so a run
+ * never waits for a lock while holding one. */
+static int run_hold(wb_run_t *run, shard_t *own, shard_t *sh) {
+  if (sh == own) return 1;
+  for (int i = 0; i < run->nheld; i++) {
+    if (run->held[i] == sh) return 1;
+  }
+  if (pthread_mutex_trylock(&sh->lock) != 0) return 0;
+  run->held[run->nheld++] = sh;
+  return 1;
+}
+
+static void run_release(wb_run_t *run) {
+  for (int i = 0; i < run->nheld; i++) {
+    pthread_mutex_unlock(&run->held[i]->lock);
+  }
+  run->nheld = 0;
+}
+
+/* A partly written page only goes out on its own, read in first. */
+static int dirty_slot_of(vtpc_cache_t *c, shard_t *sh, page_key_t key) {
+  int slot = ptable_find(sh->table, key);
+  if (slot < 0 || !c->pages[slot].dirty || c->pages[slot].wb ||
+      !slot_known(c, slot, 0, c->page_size)) {
+    return -1;
+  }
+  return slot;
+}
+
+/* Collects the dirty pages around slot_index that are contiguous in the
+ * file, so they leave in file order as one vectored write of at most
+ * VTPC_WB_MAX_PAGES pages. The run ends early at a page whose shard is
+ * locked by someone else. A partly written page that cannot be read in,
+ * as through a write-only fd, makes a run of its own that writes only its
+ * known bytes, through a buffered fd since they are not aligned. */
+static void gather_run(vtpc_cache_t *c, shard_t *own, int slot_index, wb_run_t *run) {
+  page_key_t key = c->pages[slot_index].key;
+  run->file = c->pages[slot_index].file;
+  uint64_t start = key.page_no;
+  uint32_t before = 0;
+  run->nheld = 0;
+  run->fd = -1;
+
+  if (slot_fill(c, slot_index) != 0) {
+    run->first = start;
+    run->cnt = 1;
+    run->slots[0] = slot_index;
+    run->fd = file_buffered_fd(run->file);
+    return;
+  }
+
+  while (start > 0 && before < VTPC_WB_MAX_PAGES / 2u) {
+    key.page_no = start - 1;
+    shard_t *sh = shard_for(c, key);
+    if (!run_hold(run, own, sh) || dirty_slot_of(c, sh, key) < 0) break;
+    start--;
+    before++;
+  }
+
+  int cnt = 0;
+  while (cnt < (int)VTPC_WB_MAX_PAGES) {
+    key.page_no = start + (uint64_t)cnt;
+    shard_t *sh = shard_for(c, key);
+    if (!run_hold(run, own, sh)) break;
+    int slot = dirty_slot_of(c, sh, key);
+    if (slot < 0) break;
+    run->slots[cnt++] = slot;
+  }
+
+  run->first = start;
+  run->cnt = cnt;
+}
+
+/* A run leaves as one vectored write, in file order. */
+static void run_prep(vtpc_cache_t *c, aio_req_t *req, const wb_run_t *run) {
+  req->op = AIO_WRITE;
+  req->fd = file_fd(run->file);
+  req->offset = (off_t)(run->first * (uint64_t)c->page_size);
+  req->iovcnt = run->cnt;
+  for (int i = 0; i < run->cnt; i++) {
+    req->iov[i].iov_base = c->pages[run->slots[i]].data;
+    req->iov[i].iov_len = c->page_size;
+  }
+
+  const page_slot_t *s = &c->pages[run->slots[0]];
+  if (run->cnt == 1 && s->valid_hi - s->valid_lo < c->page_size) {
+    if (run->fd >= 0) req->fd = run->fd;
+    req->offset += (off_t)s->valid_lo;
+    req->iov[0].iov_base = s->data + s->valid_lo;
+    req->iov[0].iov_len = s->valid_hi - s->valid_lo;
+  }
+}
+
+/* Failed runs still count towards the flush time histogram. */
+static void run_account(shard_t *sh, const wb_run_t *run, uint64_t ns, int ok) {
+  file_t *f = run->file;
+  if (ok) {
+    stats_add(&sh->stats.writebacks, (uint64_t)run->cnt);
+    stats_add(&f->stats.writebacks, (uint64_t)run->cnt);
+  }
+  stats_time(&sh->stats.flush_ns, ns);
+  stats_time(&f->stats.flush_ns, ns);
+}
+
+/* Also closes the run's own fd, if it has one. */
+static int run_result(vtpc_cache_t *c, const aio_req_t *req, const wb_run_t *run) {
+  if (run->fd >= 0) (void)close(run->fd);
+  const page_slot_t *s = &c->pages[run->slots[0]];
+  ssize_t want = (ssize_t)run->cnt * (ssize_t)c->page_size;
+  if (run->cnt == 1) want = (ssize_t)(s->valid_hi - s->valid_lo);
+  if (req->result == want) return 0;
+  errno = (req->result < 0) ? req->err : EIO;
+  return -1;
+}
 
-  for (int i = 0; i < (int)VTPC_CACHE_PAGES; i++) {
-    if (g_pages[i].in_use && g_pages[i].key_valid && g_pages[i].key.fd == fd) {
-      if (flush_slot(i) != 0) return -1;
+/* Pages always go out whole, so the file is trimmed back to its logical
+ * size when a run covers its tail. The size only grows and is read at trim
+ * time, so a late trim never cuts off data written since. */
+static int trim_tail(vtpc_cache_t *c, file_t *f, uint64_t first, int cnt) {
+  off_t end = (off_t)((first + (uint64_t)cnt) * (uint64_t)c->page_size);
+  int rc = 0;
+  pthread_mutex_lock(&f->meta_lock);
+  if (end > f->file_size && ftruncate(file_fd(f), f->file_size) != 0) rc = -1;
+  pthread_mutex_unlock(&f->meta_lock);
+  return rc;
+}
+
+/* Writes back the run around a dirty page that is not under writeback,
+ * with sh locked throughout. */
+static int flush_slot(vtpc_cache_t *c, shard_t *sh, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (!s->in_use || !s->dirty) return 0;
+
+  wb_run_t run;
+  aio_req_t req;
+  gather_run(c, sh, slot_index, &run);
+  run_prep(c, &req, &run);
+  uint64_t t0 = now_ns();
+  (void)aio_run(&req);
+  int rc = run_result(c, &req, &run);
+  run_account(sh, &run, now_ns() - t0, rc == 0);
+  if (rc == 0) rc = trim_tail(c, run.file, run.first, run.cnt);
+  if (rc == 0) {
+    for (int i = 0; i < run.cnt; i++) {
+      slot_clear_dirty(c, run.slots[i]);
+      if (c->shared) slot_share(c, run.slots[i]);
     }
+    file_stamp(c, run.file);
   }
+  run_release(&run);
+  return rc;
+}
+
+static void evict_slot(vtpc_cache_t *c, shard_t *sh, int slot_index) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (!s->in_use) return;
+
+  (void)flush_slot(c, sh, slot_index);
+
+  if (s->key_valid) slot_detach(c, slot_index);
+  policy_remove(sh->policy, slot_index - sh->base);
+  release_slot(c, slot_index);
+}
+
+/* Busy and wb pages are outside the policy, so a victim can always be
+ * evicted right away; -1 means every slot of the shard is in flight. */
+static int take_free_slot(vtpc_cache_t *c, shard_t *sh) {
+  if (sh->nfree == 0) {
+    int victim = policy_victim(sh->policy, now_ns());
+    if (victim < 0) return -1;
+    page_slot_t *s = &c->pages[sh->base + victim];
+    stats_add(&sh->stats.evictions, 1);
+    stats_add(&s->file->stats.evictions, 1);
+    if (c->pool) slot_compress(c, sh, sh->base + victim);
+    evict_slot(c, sh, sh->base + victim);
+  }
+  return sh->free[--sh->nfree];
+}
 
+static void release_slot(vtpc_cache_t *c, int slot_index) {
+  shard_t *sh = shard_of_slot(c, slot_index);
+  page_slot_t *s = &c->pages[slot_index];
+  s->in_use = 0;
+  s->dirty = 0;
+  s->key_valid = 0;
+  s->file = NULL;
+  sh->free[sh->nfree++] = slot_index;
+}
+
+static ra_batch_t *ra_batch_alloc(void) {
+  ra_batch_t *b = NULL;
+  pthread_mutex_lock(&g_ra_lock);
+  if (g_ra_nfree > 0) b = &g_ra[g_ra_free[--g_ra_nfree]];
+  pthread_mutex_unlock(&g_ra_lock);
+  return b;
+}
+
+static void ra_batch_free(ra_batch_t *b) {
+  pthread_mutex_lock(&g_ra_lock);
+  g_ra_free[g_ra_nfree++] = (int)(b - g_ra);
+  pthread_mutex_unlock(&g_ra_lock);
+}
+
+/* Runs on the I/O worker: installs each page of the batch under its own
+ * shard lock and wakes whoever waits for it. */
+static void ra_complete(aio_req_t *req) {
+  ra_batch_t *b = (ra_batch_t *)req;
+  file_t *f = b->file;
+  vtpc_cache_t *c = b->cache;
+  size_t got = (req->result > 0) ? (size_t)req->result : 0;
+  uint64_t gen = file_shared_gen(f);
+
+  if (b->demand) {
+    uint64_t elapsed = now_ns() - b->t0;
+    stats_time(&shard_of_slot(c, b->slots[0])->stats.miss_ns, elapsed);
+    stats_time(&b->demand->miss_ns, elapsed);
+  }
+
+  for (uint32_t i = 0; i < b->npages; i++) {
+    int slot = b->slots[i];
+    shard_t *sh = shard_of_slot(c, slot);
+    page_slot_t *s = &c->pages[slot];
+
+    pthread_mutex_lock(&sh->lock);
+    s->busy = 0;
+    sh->nio--;
+    if (req->result < 0) {
+      slot_detach(c, slot);
+      release_slot(c, slot);
+    } else {
+      size_t start = (size_t)i * c->page_size;
+      size_t have = (got > start) ? got - start : 0;
+      if (have < c->page_size) {
+        memset(s->data + have, 0, c->page_size - have);
+      }
+      if (c->shared) shared_fill(c->shared, s->key, gen, b->epochs[i], s->data);
+      policy_insert(sh->policy, slot - sh->base, s->key, b->hints[i]);
+    }
+    pthread_cond_broadcast(&sh->settled);
+    pthread_mutex_unlock(&sh->lock);
+  }
+
+  int n = (int)b->npages;
+  ra_batch_free(b);
+  file_io_add(f, -n);
+}
+
+/* Reserves slots for the non-resident pages of [first, first + n) and
+ * hands each contiguous run to the I/O worker as one preadv. Pages stay
+ * busy, and out of the policy, until the read completes.
+ *
+ * With fetched set the pages are wanted by a read now rather than ahead:
+ * n is at most 64, they count as misses, and bit i of *fetched tells that
+ * page first + i was submitted. */
+static void ra_submit(fd_state_t *st, uint64_t first, uint32_t n, uint64_t *fetched) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  uint64_t end = ((uint64_t)file_size_of(f) + c->page_size - 1) / c->page_size;
+  if (first >= end) return;
+  if ((uint64_t)n < end - first) end = first + n;
+
+  uint64_t p = first;
+  while (p < end) {
+    ra_batch_t *b = ra_batch_alloc();
+    if (!b) return;
+
+    int cnt = 0;
+    int full = 0;
+    uint64_t run = p;
+    while (p < end && cnt < AIO_MAX_VEC) {
+      page_key_t key = file_key(f, p);
+      shard_t *sh = shard_for(c, key);
+      pthread_mutex_lock(&sh->lock);
+      if (ptable_find(sh->table, key) >= 0) {
+        pthread_mutex_unlock(&sh->lock);
+        if (cnt > 0) break;
+        run = ++p;
+        continue;
+      }
+
+      int hint = policy_miss(sh->policy, key);
+      int slot = take_free_slot(c, sh);
+      if (slot < 0) {
+        pthread_mutex_unlock(&sh->lock);
+        full = 1;
+        break;
+      }
+      slot_claim(c, slot, f, p);
+      slot_attach(c, slot);
+      if (fetched) {
+        *fetched |= UINT64_C(1) << (p - first);
+        stats_add(&sh->stats.misses, 1);
+        stats_add(&st->stats.misses, 1);
+      } else {
+        stats_add(&sh->stats.readahead, 1);
+        stats_add(&st->stats.readahead, 1);
+      }
+
+      /* A page from either tier is ready now and splits the run. */
+      uint64_t epoch = 0;
+      int ready = 0;
+      if (c->pool &&
+          pool_take(c->pool, key, file_pool_gen(f), c->pages[slot].data)) {
+        stats_add(&sh->stats.decompressed, 1);
+        stats_add(&st->stats.decompressed, 1);
+        ready = 1;
+      } else if (c->shared && shared_get(
+                                  c->shared, key, file_shared_gen(f),
+                                  c->pages[slot].data, &epoch
+                              )) {
+        stats_add(&sh->stats.shared, 1);
+        stats_add(&st->stats.shared, 1);
+        ready = 1;
+      }
+      if (ready) {
+        policy_insert(sh->policy, slot - sh->base, key, hint | insert_flags(st));
+        pthread_mutex_unlock(&sh->lock);
+        p++;
+        if (cnt > 0) break;
+        run = p;
+        continue;
+      }
+      c->pages[slot].busy = 1;
+      sh->nio++;
+      pthread_mutex_unlock(&sh->lock);
+
+      b->slots[cnt] = slot;
+      b->hints[cnt] = hint | insert_flags(st);
+      b->epochs[cnt] = epoch;
+      b->req.iov[cnt].iov_base = c->pages[slot].data;
+      b->req.iov[cnt].iov_len = c->page_size;
+      cnt++;
+      p++;
+    }
+    if (cnt == 0) {
+      ra_batch_free(b);
+      return;
+    }
+
+    b->cache = c;
+    b->file = f;
+    b->demand = fetched ? &st->stats : NULL;
+    b->t0 = now_ns();
+    b->npages = (uint32_t)cnt;
+    b->req.op = AIO_READ;
+    b->req.fd = file_fd(f);
+    b->req.offset = (off_t)(run * (uint64_t)c->page_size);
+    b->req.iovcnt = cnt;
+    file_io_add(f, cnt);
+    if (aio_submit(&b->req) != 0) {
+      b->req.result = -1;
+      ra_complete(&b->req);
+      return;
+    }
+    if (full) return;
+  }
+}
+
+/* On-demand readahead in the spirit of the kernel's: a read of the page
+ * right after the previous one starts a stream, and reaching the first page
+ * of the window in flight submits the next one, twice as large. */
+static void ra_access(fd_state_t *st, uint64_t page_no) {
+  uint32_t ra_max = st->cache->ra_max;
+  if (st->advice == VTPC_FADV_RANDOM) ra_max = 0;
+  uint64_t prev = st->ra_prev;
+  if (page_no == prev) return;
+  st->ra_prev = page_no;
+  if (ra_max == 0) return;
+
+  if (page_no != prev + 1) {
+    st->ra_size = 0;
+    return;
+  }
+
+  if (st->ra_size == 0) {
+    st->ra_size = (VTPC_RA_MIN_PAGES < ra_max) ? VTPC_RA_MIN_PAGES : ra_max;
+    if (st->advice == VTPC_FADV_SEQUENTIAL) st->ra_size = ra_max;
+    st->ra_next = page_no + 1;
+    st->ra_marker = page_no + 1;
+  } else if (page_no < st->ra_marker) {
+    return;
+  } else {
+    st->ra_marker = st->ra_next;
+    st->ra_size = (st->ra_size * 2u < ra_max) ? st->ra_size * 2u : ra_max;
+  }
+
+  if (st->ra_next < page_no + 1) st->ra_next = page_no + 1;
+  ra_submit(st, st->ra_next, st->ra_size, NULL);
+  st->ra_next += st->ra_size;
+}
+
+static int flusher_start(vtpc_cache_t *c) {
+  int rc = pthread_create(&c->flusher_tid, NULL, flusher_main, c);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+
+  c->flusher = 1;
+  return 0;
+}
+
+static void flusher_join(vtpc_cache_t *c) {
+  pthread_mutex_lock(&c->flush_lock);
+  c->flusher_stop = 1;
+  pthread_cond_signal(&c->flush_kick);
+  pthread_mutex_unlock(&c->flush_lock);
+  pthread_join(c->flusher_tid, NULL);
+  c->flusher = 0;
+}
+
+/* Writes back runs starting from the shard's oldest dirty page while its
+ * dirty share is above VTPC_DIRTY_BACKGROUND_RATIO percent or the oldest
+ * page is older than VTPC_DIRTY_EXPIRE_CENTISECS. Up to FLUSH_BATCH runs
+ * are pinned, marked wb and then written together without locks; anyone
+ * who wants to modify or write back those pages waits on their shard. */
+static void flusher_shard(vtpc_cache_t *c, shard_t *sh) {
+  wb_run_t runs[FLUSH_BATCH];
+  aio_req_t reqs[FLUSH_BATCH];
+  aio_req_t *batch[FLUSH_BATCH];
+  uint32_t budget = c->shard_pages;
+
+  pthread_mutex_lock(&sh->lock);
+  for (;;) {
+    int nruns = 0;
+    while (nruns < FLUSH_BATCH && budget > 0 && sh->dirty_head >= 0) {
+      int oldest = sh->dirty_head;
+      int over = sh->ndirty * 100u > g_dirty_ratio * c->shard_pages;
+      int expired =
+          now_ns() - c->pages[oldest].dirtied_ns >= g_dirty_expire_ns;
+      if (!over && !expired) break;
+
+      wb_run_t *run = &runs[nruns];
+      gather_run(c, sh, oldest, run);
+      for (int i = 0; i < run->cnt; i++) {
+        shard_t *ps = shard_of_slot(c, run->slots[i]);
+        c->pages[run->slots[i]].wb = 1;
+        ps->nio++;
+        dirty_list_unlink(c, run->slots[i]);
+        policy_pin(ps->policy, run->slots[i] - ps->base);
+      }
+      file_io_add(run->file, run->cnt);
+      run_release(run);
+
+      run_prep(c, &reqs[nruns], run);
+      batch[nruns] = &reqs[nruns];
+      budget -= (uint32_t)run->cnt;
+      nruns++;
+    }
+    if (nruns == 0) break;
+    pthread_mutex_unlock(&sh->lock);
+
+    uint64_t t0 = now_ns();
+    aio_run_all(batch, nruns);
+    uint64_t elapsed = now_ns() - t0;
+
+    int failed = 0;
+    for (int r = 0; r < nruns; r++) {
+      wb_run_t *run = &runs[r];
+      int rc = run_result(c, &reqs[r], run);
+      run_account(sh, run, elapsed, rc == 0);
+      if (rc == 0) rc = trim_tail(c, run->file, run->first, run->cnt);
+      if (rc != 0) failed = 1;
+
+      for (int i = 0; i < run->cnt; i++) {
+        shard_t *ps = shard_of_slot(c, run->slots[i]);
+        page_slot_t *s = &c->pages[run->slots[i]];
+        pthread_mutex_lock(&ps->lock);
+        s->wb = 0;
+        ps->nio--;
+        if (s->pins == 0) policy_unpin(ps->policy, run->slots[i] - ps->base);
+        if (rc == 0) {
+          slot_clear_dirty(c, run->slots[i]);
+          if (c->shared) slot_share(c, run->slots[i]);
+        } else {
+          s->dirtied_ns = now_ns();
+          dirty_list_append(c, run->slots[i]);
+        }
+        pthread_cond_broadcast(&ps->settled);
+        pthread_mutex_unlock(&ps->lock);
+      }
+      if (rc == 0) file_stamp(c, run->file);
+      file_io_add(run->file, -run->cnt);
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    if (failed) break;
+  }
+  pthread_mutex_unlock(&sh->lock);
+}
+
+static void *flusher_main(void *arg) {
+  vtpc_cache_t *c = (vtpc_cache_t *)arg;
+  aio_own_thread = 1;
+  pthread_mutex_lock(&c->flush_lock);
+  while (!c->flusher_stop) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t deadline =
+        (uint64_t)ts.tv_nsec + g_writeback_interval_ns % 1000000000ull;
+    ts.tv_sec += (time_t)(g_writeback_interval_ns / 1000000000ull +
+                          deadline / 1000000000ull);
+    ts.tv_nsec = (long)(deadline % 1000000000ull);
+    pthread_cond_timedwait(&c->flush_kick, &c->flush_lock, &ts);
+    if (c->flusher_stop) break;
+
+    pthread_mutex_unlock(&c->flush_lock);
+    for (uint32_t i = 0; i < c->nshards; i++) {
+      flusher_shard(c, &c->shards[i]);
+    }
+    pthread_mutex_lock(&c->flush_lock);
+  }
+  pthread_mutex_unlock(&c->flush_lock);
+  return NULL;
+}
+
+/* Locks the shard of the page last returned for st and gives its slot if
+ * that still holds page_no, without hashing or probing the page table. */
+static int last_page(fd_state_t *st, uint64_t page_no, int flags, shard_t **out) {
+  vtpc_cache_t *c = st->cache;
+  uint64_t last = __atomic_load_n(&st->last, __ATOMIC_RELAXED);
+  if (last == NO_LAST_PAGE) return -1;
+
+  int slot = (int)(last >> 32);
+  page_slot_t *s = &c->pages[slot];
+  shard_t *sh = shard_of_slot(c, slot);
+  pthread_mutex_lock(&sh->lock);
+  if (!s->key_valid || s->gen != (uint32_t)last ||
+      s->key.page_no != page_no || s->key.ino != st->file->ino ||
+      s->key.dev != st->file->dev || s->busy ||
+      ((flags & PAGE_WRITE) && s->wb)) {
+    pthread_mutex_unlock(&sh->lock);
+    return -1;
+  }
+  if (!(flags & PAGE_FETCHED)) {
+    if (!insert_flags(st)) policy_hit(sh->policy, slot - sh->base);
+    stats_add(&sh->stats.hits, 1);
+    stats_add(&st->stats.hits, 1);
+    s->hits++;
+  }
+  *out = sh;
+  return slot;
+}
+
+static int lock_page(fd_state_t *st, uint64_t page_no, int flags, shard_t **out) {
+  int slot = last_page(st, page_no, flags, out);
+  if (slot >= 0) return slot;
+
+  slot = find_page(st, page_no, flags, out);
+  if (slot >= 0) {
+    uint64_t last = (uint64_t)slot << 32 | st->cache->pages[slot].gen;
+    __atomic_store_n(&st->last, last, __ATOMIC_RELAXED);
+  }
+  return slot;
+}
+
+/* Returns the slot holding page_no with its shard locked in *out. A miss
+ * reserves a busy slot and reads the page with the shard unlocked, so the
+ * rest of the shard stays usable meanwhile. */
+static int find_page(fd_state_t *st, uint64_t page_no, int flags, shard_t **out) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  page_key_t key = file_key(f, page_no);
+  shard_t *sh = shard_for(c, key);
+  int hint = 0;
+  int slot;
+
+  pthread_mutex_lock(&sh->lock);
+  for (;;) {
+    slot = ptable_find(sh->table, key);
+    if (slot >= 0) {
+      page_slot_t *s = &c->pages[slot];
+      if (s->busy || ((flags & PAGE_WRITE) && s->wb)) {
+        shard_wait(sh);
+        continue;
+      }
+      if (!(flags & PAGE_FETCHED)) {
+        if (!insert_flags(st)) policy_hit(sh->policy, slot - sh->base);
+        stats_add(&sh->stats.hits, 1);
+        stats_add(&st->stats.hits, 1);
+        s->hits++;
+      }
+      *out = sh;
+      return slot;
+    }
+
+    hint |= policy_miss(sh->policy, key) | insert_flags(st);
+    slot = take_free_slot(c, sh);
+    if (slot >= 0) break;
+    if (sh->nio == 0) {
+      pthread_mutex_unlock(&sh->lock);
+      errno = ENOMEM;
+      return -1;
+    }
+    shard_wait(sh);
+  }
+
+  page_slot_t *s = &c->pages[slot];
+  slot_claim(c, slot, f, page_no);
+  stats_add(&sh->stats.misses, 1);
+  stats_add(&st->stats.misses, 1);
+
+  off_t off = (off_t)(page_no * (uint64_t)c->page_size);
+  if ((flags & PAGE_OVERWRITE) || off >= file_size_of(f)) {
+    if (c->pool) pool_drop(c->pool, key);
+    memset(s->data, 0, c->page_size);
+    slot_attach(c, slot);
+    policy_insert(sh->policy, slot - sh->base, key, hint);
+    *out = sh;
+    return slot;
+  }
+  int unpacked = c->pool && pool_take(c->pool, key, file_pool_gen(f), s->data);
+  if (unpacked) {
+    stats_add(&sh->stats.decompressed, 1);
+    stats_add(&st->stats.decompressed, 1);
+  }
+  if (flags & PAGE_WRITE) {
+    if (!unpacked) {
+      s->valid_lo = 0;
+      s->valid_hi = 0;
+    }
+    slot_attach(c, slot);
+    policy_insert(sh->policy, slot - sh->base, key, hint);
+    *out = sh;
+    return slot;
+  }
+
+  uint64_t gen = file_shared_gen(f);
+  uint64_t epoch = 0;
+  int shared = !unpacked && c->shared &&
+               shared_get(c->shared, key, gen, s->data, &epoch);
+  if (shared) {
+    stats_add(&sh->stats.shared, 1);
+    stats_add(&st->stats.shared, 1);
+  }
+  if (unpacked || shared) {
+    slot_attach(c, slot);
+    policy_insert(sh->policy, slot - sh->base, key, hint);
+    *out = sh;
+    return slot;
+  }
+
+  s->busy = 1;
+  sh->nio++;
+  slot_attach(c, slot);
+  file_io_add(f, 1);
+  pthread_mutex_unlock(&sh->lock);
+
+  aio_req_t req = {
+      .op = AIO_READ,
+      .fd = file_fd(f),
+      .offset = off,
+      .iovcnt = 1,
+      .iov = {{.iov_base = s->data, .iov_len = c->page_size}},
+  };
+  uint64_t t0 = now_ns();
+  ssize_t rd = aio_run(&req);
+  int saved = errno;
+  uint64_t elapsed = now_ns() - t0;
+
+  pthread_mutex_lock(&sh->lock);
+  stats_time(&sh->stats.miss_ns, elapsed);
+  stats_time(&st->stats.miss_ns, elapsed);
+  s->busy = 0;
+  sh->nio--;
+  pthread_cond_broadcast(&sh->settled);
+  if (rd < 0) {
+    slot_detach(c, slot);
+    release_slot(c, slot);
+    pthread_mutex_unlock(&sh->lock);
+    file_io_add(f, -1);
+    errno = saved;
+    return -1;
+  }
+
+  if ((size_t)rd < c->page_size) {
+    memset(s->data + rd, 0, c->page_size - (size_t)rd);
+  }
+  if (c->shared) shared_fill(c->shared, key, gen, epoch, s->data);
+  policy_insert(sh->policy, slot - sh->base, key, hint);
+  file_io_add(f, -1);
+  *out = sh;
+  return slot;
+}
+
+
+static int open_locked(vtpc_cache_t *c, const char *path, int mode, int access) {
+#ifdef O_DIRECT
+  mode |= O_DIRECT;
+#endif
+
+  int fd = open(path, mode, access);
+  if (fd < 0) return -1;
+
+  fd_state_t *st = fdstate_ensure(fd, c);
+  if (!st) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  if (mode & O_TRUNC) file_truncate(c, st->file);
+  if (c->manifest) file_warm(st);
+  return fd;
+}
+
+/* Writes back every dirty page of the file. With drop_failed set, a page
+ * that cannot be written is evicted and the first error is reported at
+ * the end; otherwise the first error stops the walk. */
+static int flush_file(vtpc_cache_t *c, file_t *f, int drop_failed) {
+  int failed = 0;
+  int saved = 0;
+
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_first(&f->dirty, c->dirty_nodes); i >= 0;
+       i = pset_first(&f->dirty, c->dirty_nodes)) {
+    page_key_t key = file_key(f, c->dirty_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && c->pages[slot].dirty) {
+      if (c->pages[slot].wb) {
+        shard_wait(sh);
+      } else if (flush_slot(c, sh, slot) != 0) {
+        if (!drop_failed) {
+          pthread_mutex_unlock(&sh->lock);
+          return -1;
+        }
+        if (!failed) saved = errno;
+        failed = 1;
+        slot_clear_dirty(c, slot);
+        if (c->pages[slot].pins == 0) evict_slot(c, sh, slot);
+      }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+
+  if (failed) {
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+/* Clean pages stay cached for other fds and later opens of the file. */
+static int close_locked(fd_state_t *st) {
+  if (__atomic_load_n(&st->npins, __ATOMIC_ACQUIRE) > 0) {
+    errno = EBUSY;
+    return -1;
+  }
+  int fd = st->fd;
+  vtpc_cache_t *c = st->cache;
+  int rc = flush_file(c, st->file, 1);
+  int saved = errno;
+  trace_log(TRACE_CLOSE, fd, 0, 0);
+
+  if (fdstate_remove(st) && c->manifest) (void)manifest_save(c->manifest);
+  if (rc != 0) {
+    (void)close(fd);
+    errno = saved;
+    return -1;
+  }
+  return close(fd);
+}
+
+/* Total length of the iovecs, or -1 with errno set. */
+static ssize_t iov_total(const struct iovec *iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX || (iovcnt > 0 && !iov)) {
+    errno = EINVAL;
+    return -1;
+  }
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > (size_t)SSIZE_MAX - total ||
+        (!iov[i].iov_base && iov[i].iov_len > 0)) {
+      errno = EINVAL;
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  return (ssize_t)total;
+}
+
+/* Copies n bytes between the cursor and page, in the given direction. */
+static void iov_copy(iov_cursor_t *cur, unsigned char *page, size_t n, int to_page) {
+  while (n > 0) {
+    size_t left = cur->iov->iov_len - cur->off;
+    if (left == 0) {
+      cur->iov++;
+      cur->cnt--;
+      cur->off = 0;
+      continue;
+    }
+    size_t take = (n < left) ? n : left;
+    unsigned char *user = (unsigned char *)cur->iov->iov_base + cur->off;
+    if (to_page) {
+      memcpy(page, user, take);
+    } else {
+      memcpy(user, page, take);
+    }
+    page += take;
+    cur->off += take;
+    n -= take;
+  }
+}
+
+/* Large transfers with a page-aligned buffer, offset and length go around
+ * the cache, so a bulk copy neither evicts the working set nor copies
+ * every byte twice. */
+static int bypass_ok(vtpc_cache_t *c, const iov_cursor_t *cur, size_t count, off_t offset) {
+  size_t mask = c->page_size - 1u;
+  return c->bypass_min > 0 && count >= c->bypass_min && cur->cnt > 0 &&
+         cur->iov->iov_len >= count &&
+         ((uintptr_t)cur->iov->iov_base & mask) == 0 &&
+         ((size_t)offset & mask) == 0 && (count & mask) == 0;
+}
+
+/* Writes back the dirty pages of [first, end), so the file has what the
+ * cache has. */
+static int flush_range(vtpc_cache_t *c, file_t *f, uint64_t first, uint64_t end) {
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->dirty, c->dirty_nodes, first);
+       i >= 0 && c->dirty_nodes[i].key < end;
+       i = pset_lower_bound(&f->dirty, c->dirty_nodes, first)) {
+    page_key_t key = file_key(f, c->dirty_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && c->pages[slot].wb) {
+      shard_wait(sh);
+    } else {
+      first = key.page_no + 1;
+      if (slot >= 0 && flush_slot(c, sh, slot) != 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+      }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+  return 0;
+}
+
+/* Drops the cached pages of [first, end) that a write of data around the
+ * cache makes stale, dirty or not, or with keep_dirty only the clean ones.
+ * Pinned pages stay and take the new data instead. */
+static void purge_range(vtpc_cache_t *c, file_t *f, uint64_t first, uint64_t end, const unsigned char *data, int keep_dirty) {
+  uint64_t from = first;
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->resident, c->res_nodes, from);
+       i >= 0 && c->res_nodes[i].key < end;
+       i = pset_lower_bound(&f->resident, c->res_nodes, from)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && (c->pages[slot].busy || c->pages[slot].wb)) {
+      shard_wait(sh);
+    } else {
+      from = key.page_no + 1;
+      if (slot >= 0 && !(keep_dirty && c->pages[slot].dirty)) {
+        page_slot_t *s = &c->pages[slot];
+        slot_clear_dirty(c, slot);
+        if (s->pins > 0) {
+          size_t at = (size_t)(key.page_no - first) * c->page_size;
+          memcpy(s->data, data + at, c->page_size);
+        } else {
+          evict_slot(c, sh, slot);
+        }
+      }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+}
+
+/* Moves count bytes between buf and the file at offset with pread or
+ * pwrite on the fd itself when it is O_DIRECT, as vtpc_open() makes it,
+ * else on an O_DIRECT reopen of it, or on the fd as is where the file
+ * system refuses O_DIRECT. Short only at the end of the file or after an
+ * error. */
+static ssize_t direct_io(fd_state_t *st, unsigned char *buf, size_t count, off_t offset, int write) {
+  file_t *f = st->file;
+  int mode = fcntl(st->fd, F_GETFL);
+  int fd = -1;
+  if (mode >= 0 && !(mode & O_DIRECT) &&
+      !__atomic_load_n(&f->no_direct, __ATOMIC_RELAXED)) {
+    char path[32];
+    (void)snprintf(path, sizeof(path), "/proc/self/fd/%d", st->fd);
+    fd = open(path, (mode & O_ACCMODE) | O_DIRECT | O_CLOEXEC);
+    if (fd < 0 && errno == EINVAL) {
+      __atomic_store_n(&f->no_direct, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  int io = (fd >= 0) ? fd : st->fd;
+  size_t done = 0;
+  int saved = 0;
+  while (done < count) {
+    ssize_t n = write ? pwrite(io, buf + done, count - done, offset + (off_t)done)
+                      : pread(io, buf + done, count - done, offset + (off_t)done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) saved = errno;
+    if (n <= 0) break;
+    done += (size_t)n;
+  }
+  if (fd >= 0) close(fd);
+  if (done == 0 && saved != 0) {
+    errno = saved;
+    return -1;
+  }
+  return (ssize_t)done;
+}
+
+static ssize_t bypass_read(fd_state_t *st, unsigned char *buf, size_t count, off_t offset) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  uint64_t first = (uint64_t)offset / c->page_size;
+  uint64_t end = first + count / c->page_size;
+  if (flush_range(c, f, first, end) != 0) return -1;
+
+  off_t size = file_size_of(f);
+  size_t want = count;
+  if ((off_t)want > size - offset) want = (size_t)(size - offset);
+  ssize_t n = direct_io(st, buf, count, offset, 0);
+  if (n < 0) return -1;
+
+  /* A hole left by cached writes past the old end reads as zeros. */
+  if ((size_t)n < want) memset(buf + n, 0, want - (size_t)n);
+
+  shard_t *sh = shard_for(c, file_key(f, first));
+  stats_add(&sh->stats.bytes_read, want);
+  stats_add(&sh->stats.bypassed, want);
+  stats_add(&st->stats.bytes_read, want);
+  stats_add(&st->stats.bypassed, want);
+  return (ssize_t)want;
+}
+
+static ssize_t bypass_write(fd_state_t *st, const unsigned char *buf, size_t count, off_t offset) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  uint64_t first = (uint64_t)offset / c->page_size;
+  uint64_t end = first + count / c->page_size;
+
+  /* Once before, so writeback cannot overwrite the new data with the old,
+   * and once after for pages read back in the meantime. Pages dirtied
+   * since the first pass hold a later write and are kept. */
+  if (c->pool) file_pool_forget(c, f, first, end);
+  purge_range(c, f, first, end, buf, 0);
+  ssize_t n = direct_io(st, (unsigned char *)buf, count, offset, 1);
+  if (c->pool) file_pool_forget(c, f, first, end);
+  purge_range(c, f, first, end, buf, 1);
+  if (c->shared) {
+    for (uint64_t p = first; p < end; p++) {
+      shared_drop(c->shared, file_key(f, p));
+    }
+  }
+  if (n > 0) file_stamp(c, f);
+  if (n <= 0) return n;
+
+  if (offset + n > file_size_of(f)) file_grow(f, offset + n);
+  shard_t *sh = shard_for(c, file_key(f, first));
+  stats_add(&sh->stats.bytes_written, (uint64_t)n);
+  stats_add(&sh->stats.bypassed, (uint64_t)n);
+  stats_add(&st->stats.bytes_written, (uint64_t)n);
+  stats_add(&st->stats.bypassed, (uint64_t)n);
+  return n;
+}
+
+/* Reads count bytes at offset into the cursor, taking each page once
+ * however the iovecs split it. A read over several pages first submits its
+ * misses, up to 64 pages at a time, as vectored reads. Only cursor calls
+ * (stream) feed the fd's readahead, since they run under io_lock. */
+static ssize_t read_at(fd_state_t *st, iov_cursor_t *cur, size_t count, off_t offset, int stream) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  off_t file_size = file_size_of(f);
+  if (count == 0 || offset >= file_size) return 0;
+  if (bypass_ok(c, cur, count, offset)) {
+    return bypass_read(st, (unsigned char *)cur->iov->iov_base, count, offset);
+  }
+
+  off_t page_size = (off_t)c->page_size;
+  size_t want = count;
+  if ((off_t)want > file_size - offset) want = (size_t)(file_size - offset);
+  uint64_t end = (uint64_t)(offset + (off_t)want + page_size - 1) / page_size;
+  uint64_t span = c->npages / 4u;  /* a window must not evict itself */
+  if (span > AIO_MAX_VEC) span = AIO_MAX_VEC;
+  uint64_t window = 0;  /* first page of the fetch window */
+  uint64_t window_end = 0;
+  uint64_t fetched = 0;
+  size_t done = 0;
+
+  while (count > 0) {
+    file_size = file_size_of(f);
+    if (offset >= file_size) break;
+
+    uint64_t page_no = (uint64_t)(offset / page_size);
+    size_t in_page = (size_t)(offset % page_size);
+
+    size_t can_take = c->page_size - in_page;
+    size_t need = (count < can_take) ? count : can_take;
+
+    off_t remain = file_size - offset;
+    if ((off_t)need > remain) need = (size_t)remain;
+
+    if (page_no >= window_end && end - page_no > 1 && span > 1) {
+      window = page_no;
+      window_end = (end - page_no < span) ? end : page_no + span;
+      fetched = 0;
+      ra_submit(st, window, (uint32_t)(window_end - window), &fetched);
+    }
+    int flags = 0;
+    if (page_no < window_end && (fetched >> (page_no - window) & 1u)) {
+      flags = PAGE_FETCHED;
+    }
+
+    if (stream) ra_access(st, page_no);
+    shard_t *sh = NULL;
+    int slot = lock_page(st, page_no, flags, &sh);
+    if (slot < 0) return (done > 0) ? (ssize_t)done : -1;
+    if (!slot_known(c, slot, in_page, in_page + need) &&
+        slot_fill(c, slot) != 0) {
+      pthread_mutex_unlock(&sh->lock);
+      return (done > 0) ? (ssize_t)done : -1;
+    }
+
+    iov_copy(cur, c->pages[slot].data + in_page, need, 0);
+    stats_add(&sh->stats.bytes_read, need);
+    stats_add(&st->stats.bytes_read, need);
+    pthread_mutex_unlock(&sh->lock);
+
+    offset += (off_t)need;
+    done += need;
+    count -= need;
+  }
+
+  return (ssize_t)done;
+}
+
+/* Makes [lo, hi) of a page about to be written part of its known bytes.
+ * That needs no read while the bytes stay one range. */
+static int extend_known(vtpc_cache_t *c, int slot_index, size_t lo, size_t hi) {
+  page_slot_t *s = &c->pages[slot_index];
+  if (slot_known(c, slot_index, lo, hi)) return 0;
+  if (s->valid_lo == s->valid_hi) {
+    s->valid_lo = (uint32_t)lo;
+    s->valid_hi = (uint32_t)hi;
+    return 0;
+  }
+  if (lo <= s->valid_hi && hi >= s->valid_lo) {
+    if (lo < s->valid_lo) s->valid_lo = (uint32_t)lo;
+    if (hi > s->valid_hi) s->valid_hi = (uint32_t)hi;
+    return 0;
+  }
+  return slot_fill(c, slot_index);
+}
+
+/* Writes count bytes from the cursor at offset, taking each page once. */
+static ssize_t write_at(fd_state_t *st, iov_cursor_t *cur, size_t count, off_t offset) {
+  if (count == 0) return 0;
+  if ((uint64_t)count > (uint64_t)INT64_MAX - (uint64_t)offset) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  vtpc_cache_t *c = st->cache;
+  if (bypass_ok(c, cur, count, offset)) {
+    return bypass_write(st, (const unsigned char *)cur->iov->iov_base, count, offset);
+  }
+
+  off_t page_size = (off_t)c->page_size;
+  size_t done = 0;
+
+  while (count > 0) {
+    uint64_t page_no = (uint64_t)(offset / page_size);
+    size_t in_page = (size_t)(offset % page_size);
+
+    size_t can_put = c->page_size - in_page;
+    size_t need = (count < can_put) ? count : can_put;
+
+    int flags = PAGE_WRITE;
+    if (in_page == 0 && need == c->page_size) flags |= PAGE_OVERWRITE;
+
+    shard_t *sh = NULL;
+    int slot = lock_page(st, page_no, flags, &sh);
+    if (slot < 0) return (done > 0) ? (ssize_t)done : -1;
+    if (extend_known(c, slot, in_page, in_page + need) != 0) {
+      pthread_mutex_unlock(&sh->lock);
+      return (done > 0) ? (ssize_t)done : -1;
+    }
+
+    iov_copy(cur, c->pages[slot].data + in_page, need, 1);
+    slot_set_dirty(c, slot);
+    stats_add(&sh->stats.bytes_written, need);
+    stats_add(&st->stats.bytes_written, need);
+
+    offset += (off_t)need;
+    done += need;
+    count -= need;
+
+    if (offset > file_size_of(st->file)) file_grow(st->file, offset);
+    pthread_mutex_unlock(&sh->lock);
+  }
+
+  return (ssize_t)done;
+}
+
+static ssize_t readv_locked(fd_state_t *st, const struct iovec *iov, int iovcnt) {
+  ssize_t total = iov_total(iov, iovcnt);
+  if (total < 0) return -1;
+  iov_cursor_t cur = {.iov = iov, .cnt = iovcnt, .off = 0};
+  ssize_t n = read_at(st, &cur, (size_t)total, st->offset, 1);
+  if (n > 0) trace_log(TRACE_READ, st->fd, st->offset, (uint64_t)n);
+  if (n > 0) st->offset += (off_t)n;
+  return n;
+}
+
+static ssize_t writev_locked(fd_state_t *st, const struct iovec *iov, int iovcnt) {
+  ssize_t total = iov_total(iov, iovcnt);
+  if (total < 0) return -1;
+  iov_cursor_t cur = {.iov = iov, .cnt = iovcnt, .off = 0};
+  ssize_t n = write_at(st, &cur, (size_t)total, st->offset);
+  if (n > 0) trace_log(TRACE_WRITE, st->fd, st->offset, (uint64_t)n);
+  if (n > 0) st->offset += (off_t)n;
+  return n;
+}
+
+static off_t lseek_locked(fd_state_t *st, off_t offset, int whence) {
+  off_t base = 0;
+  if (whence == SEEK_CUR) {
+    base = st->offset;
+  } else if (whence == SEEK_END) {
+    base = file_size_of(st->file);
+  } else if (whence != SEEK_SET) {
+    errno = EINVAL;
+    return (off_t)-1;
+  }
+  if (offset > 0 && base > (off_t)INT64_MAX - offset) {
+    errno = EOVERFLOW;
+    return (off_t)-1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return (off_t)-1;
+  }
+
+  st->offset = base + offset;
+  return st->offset;
+}
+
+/* Pages [*first, *end) cover the byte range; len 0 runs to the end. */
+static void page_range(vtpc_cache_t *c, off_t offset, off_t len, uint64_t *first, uint64_t *end) {
+  uint64_t page_size = c->page_size;
+  *first = (uint64_t)offset / page_size;
+  *end = UINT64_MAX;
+  if (len > 0 && (uint64_t)len <= UINT64_MAX - (uint64_t)offset - page_size) {
+    *end = ((uint64_t)offset + (uint64_t)len + page_size - 1u) / page_size;
+  }
+}
+
+/* Walks only the resident pages of the range, through the file's page set;
+ * pages still being read are skipped. */
+static void advise_range(fd_state_t *st, uint64_t first, uint64_t end, uint64_t when) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->resident, c->res_nodes, first);
+       i >= 0 && c->res_nodes[i].key < end;
+       i = pset_lower_bound(&f->resident, c->res_nodes, first)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    first = key.page_no + 1;
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && !c->pages[slot].busy) {
+      policy_advise(sh->policy, slot - sh->base, when);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+}
+
+/* Writes back and evicts the resident pages of the range. A page that
+ * fails to write back stays cached and dirty; the first error is
+ * reported once the rest of the range is done. */
+static int drop_range(fd_state_t *st, uint64_t first, uint64_t end) {
+  vtpc_cache_t *c = st->cache;
+  file_t *f = st->file;
+  int failed = 0;
+  int saved = 0;
+
+  pthread_mutex_lock(&f->meta_lock);
+  for (int i = pset_lower_bound(&f->resident, c->res_nodes, first);
+       i >= 0 && c->res_nodes[i].key < end;
+       i = pset_lower_bound(&f->resident, c->res_nodes, first)) {
+    page_key_t key = file_key(f, c->res_nodes[i].key);
+    pthread_mutex_unlock(&f->meta_lock);
+
+    shard_t *sh = shard_for(c, key);
+    pthread_mutex_lock(&sh->lock);
+    int slot = ptable_find(sh->table, key);
+    if (slot >= 0 && (c->pages[slot].busy || c->pages[slot].wb)) {
+      shard_wait(sh);
+    } else {
+      first = key.page_no + 1;
+      if (slot >= 0 && flush_slot(c, sh, slot) != 0) {
+        if (!failed) saved = errno;
+        failed = 1;
+      } else if (slot >= 0 && c->pages[slot].pins == 0) {
+        evict_slot(c, sh, slot);
+      }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    pthread_mutex_lock(&f->meta_lock);
+  }
+  pthread_mutex_unlock(&f->meta_lock);
+
+  if (failed) {
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+static int fadvise_locked(fd_state_t *st, off_t offset, off_t len, int advice) {
+  vtpc_cache_t *c = st->cache;
+  uint64_t first = 0;
+  uint64_t end = 0;
+  page_range(c, offset, len, &first, &end);
+
+  switch (advice) {
+    case VTPC_FADV_NORMAL:
+    case VTPC_FADV_RANDOM:
+    case VTPC_FADV_SEQUENTIAL:
+    case VTPC_FADV_NOREUSE:
+      __atomic_store_n(&st->advice, advice, __ATOMIC_RELAXED);
+      st->ra_size = 0;
+      return 0;
+    case VTPC_FADV_WILLNEED: {
+      uint64_t n = end - first;
+      if (n > c->npages) n = c->npages;
+      ra_submit(st, first, (uint32_t)n, NULL);
+      return 0;
+    }
+    case VTPC_FADV_DONTNEED:
+      if (c->pool) file_pool_forget(c, st->file, first, end);
+      return drop_range(st, first, end);
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+static int fsync_locked(fd_state_t *st) {
+  if (flush_file(st->cache, st->file, 0) != 0) return -1;
+  file_io_wait(st->file);
+  return fsync(st->fd);
+}
+
+int vtpc_cache_stats(vtpc_cache_t *cache, vtpc_stats_t *out) {
+  if (!out) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!cache && !(cache = vtpc_cache_default())) return -1;
+  memset(out, 0, sizeof(*out));
+  for (uint32_t i = 0; i < cache->nshards; i++) {
+    stats_sum(out, &cache->shards[i].stats);
+  }
+  return 0;
+}
+
+int vtpc_cache_stats_reset(vtpc_cache_t *cache) {
+  if (!cache && !(cache = vtpc_cache_default())) return -1;
+  for (uint32_t i = 0; i < cache->nshards; i++) {
+    stats_clear(&cache->shards[i].stats);
+  }
+  return 0;
+}
+
+int vtpc_stats(int fd, vtpc_stats_t *out) {
+  if (!out) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  memset(out, 0, sizeof(*out));
+  stats_sum(out, &st->stats);
+  stats_sum(out, &st->file->stats);
+  return 0;
+}
+
+int vtpc_stats_reset(int fd) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  stats_clear(&st->stats);
+  stats_clear(&st->file->stats);
+  return 0;
+}
+
+int vtpc_cache_open(vtpc_cache_t *cache, const char *path, int mode, int access) {
+  if (!cache) {
+    errno = EINVAL;
+    return -1;
+  }
+  return open_locked(cache, path, mode, access);
+}
+
+int vtpc_open(const char *path, int mode, int access) {
+  vtpc_cache_t *c = vtpc_cache_default();
+  if (!c) return -1;
+  return open_locked(c, path, mode, access);
+}
+
+int vtpc_close(int fd) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  pthread_mutex_lock(&st->io_lock);
+  int rc = close_locked(st);
+  pthread_mutex_unlock(&st->io_lock);
+  return rc;
+}
+
+ssize_t vtpc_read(int fd, void *buf, size_t count) {
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return vtpc_readv(fd, &iov, 1);
+}
+
+ssize_t vtpc_write(int fd, const void *buf, size_t count) {
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+  return vtpc_writev(fd, &iov, 1);
+}
+
+ssize_t vtpc_readv(int fd, const struct iovec *iov, int iovcnt) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  pthread_mutex_lock(&st->io_lock);
+  ssize_t n = readv_locked(st, iov, iovcnt);
+  pthread_mutex_unlock(&st->io_lock);
+  return n;
+}
+
+ssize_t vtpc_writev(int fd, const struct iovec *iov, int iovcnt) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  pthread_mutex_lock(&st->io_lock);
+  ssize_t n = writev_locked(st, iov, iovcnt);
+  pthread_mutex_unlock(&st->io_lock);
+  return n;
+}
+
+/* Positional calls leave io_lock alone: they neither use the offset nor
+ * feed readahead, so threads sharing an fd do not serialize on it. */
+ssize_t vtpc_pread(int fd, void *buf, size_t count, off_t offset) {
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  if (offset < 0 || iov_total(&iov, 1) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  iov_cursor_t cur = {.iov = &iov, .cnt = 1, .off = 0};
+  ssize_t n = read_at(st, &cur, count, offset, 0);
+  if (n > 0) trace_log(TRACE_READ, fd, offset, (uint64_t)n);
+  return n;
+}
+
+ssize_t vtpc_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+  if (offset < 0 || iov_total(&iov, 1) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  iov_cursor_t cur = {.iov = &iov, .cnt = 1, .off = 0};
+  ssize_t n = write_at(st, &cur, count, offset);
+  if (n > 0) trace_log(TRACE_WRITE, fd, offset, (uint64_t)n);
+  return n;
+}
+
+vtpc_pin_t vtpc_pin(int fd, uint64_t page_no, int flags, void **ptr) {
+  if (!ptr || (flags & ~VTPC_PIN_WRITE) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  vtpc_cache_t *c = st->cache;
+  if (page_no > (uint64_t)INT64_MAX / c->page_size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  shard_t *sh = NULL;
+  int page_flags = (flags & VTPC_PIN_WRITE) ? PAGE_WRITE : 0;
+  int slot = lock_page(st, page_no, page_flags, &sh);
+  if (slot < 0) return -1;
+  if (slot_fill(c, slot) != 0) {
+    pthread_mutex_unlock(&sh->lock);
+    return -1;
+  }
+
+  page_slot_t *s = &c->pages[slot];
+  if (s->pins++ == 0) policy_pin(sh->policy, slot - sh->base);
+  __atomic_fetch_add(&st->npins, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&sh->lock);
+  trace_log(TRACE_PIN, fd, (int64_t)(page_no * c->page_size), c->page_size);
+
+  *ptr = s->data;
+  return ((vtpc_pin_t)fd << 32) | (vtpc_pin_t)slot;
+}
+
+int vtpc_unpin(vtpc_pin_t pin, int dirty) {
+  int fd = (int)(pin >> 32);
+  fd_state_t *st = (pin >= 0) ? fd_lookup(fd) : NULL;
+  if (!st || !__atomic_load_n(&st->used, __ATOMIC_ACQUIRE) ||
+      __atomic_load_n(&st->npins, __ATOMIC_RELAXED) == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  vtpc_cache_t *c = st->cache;
+  uint32_t slot = (uint32_t)(pin & 0xffffffff);
+  if (slot >= c->npages) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  shard_t *sh = shard_of_slot(c, (int)slot);
+  page_slot_t *s = &c->pages[slot];
+  pthread_mutex_lock(&sh->lock);
+  if (s->pins == 0 || s->file != st->file) {
+    pthread_mutex_unlock(&sh->lock);
+    errno = EINVAL;
+    return -1;
+  }
+  if (dirty) slot_set_dirty(c, (int)slot);
+  if (--s->pins == 0 && !s->wb) policy_unpin(sh->policy, (int)slot - sh->base);
+  __atomic_fetch_sub(&st->npins, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&sh->lock);
+  return 0;
+}
+
+off_t vtpc_lseek(int fd, off_t offset, int whence) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return (off_t)-1;
+  pthread_mutex_lock(&st->io_lock);
+  off_t off = lseek_locked(st, offset, whence);
+  pthread_mutex_unlock(&st->io_lock);
+  return off;
+}
+
+int vtpc_advice(int fd, off_t offset, off_t len, access_hint_t next_access) {
+  if (offset < 0 || len < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+
+  uint64_t first = 0;
+  uint64_t end = 0;
+  page_range(st->cache, offset, len, &first, &end);
+
+  uint64_t when = UINT64_MAX;
+  if (next_access != VTPC_ACCESS_NEVER) {
+    uint64_t now = now_ns();
+    when = (next_access < UINT64_MAX - 1u - now) ? now + next_access
+                                                 : UINT64_MAX - 1u;
+  }
+  advise_range(st, first, end, when);
+  return 0;
+}
+
+int vtpc_fadvise(int fd, off_t offset, off_t len, int advice) {
+  if (offset < 0 || len < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  pthread_mutex_lock(&st->io_lock);
+  int rc = fadvise_locked(st, offset, len, advice);
+  pthread_mutex_unlock(&st->io_lock);
+  return rc;
+}
+
+int vtpc_fsync(int fd) {
+  fd_state_t *st = fdstate_ensure(fd, NULL);
+  if (!st) return -1;
+  pthread_mutex_lock(&st->io_lock);
+  int rc = fsync_locked(st);
+  pthread_mutex_unlock(&st->io_lock);
+  if (rc == 0) trace_log(TRACE_SYNC, fd, 0, 0);
+  return rc;
+}
 
-  return fsync(fd);
+int vtpc_trace(const char *path) {
+  return trace_start(path);
 }
@@ -1,10 +1,167 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+/* A cache instance with its own page table and slots. Files opened with
+ * vtpc_open() use the default instance; the other calls work on any fd,
+ * whichever instance it was opened in. */
+typedef struct vtpc_cache vtpc_cache_t;
+
+#define VTPC_CACHE_FLUSHER 0x1      /* background dirty-page flusher */
+#define VTPC_CACHE_NO_READAHEAD 0x2 /* no sequential readahead */
+#define VTPC_CACHE_NO_BYPASS 0x4    /* no direct I/O for large transfers */
+
+vtpc_cache_t* vtpc_cache_create(
+    size_t capacity_bytes,
+    size_t page_size,
+    int flags
+);
+int vtpc_cache_destroy(vtpc_cache_t* cache);
+vtpc_cache_t* vtpc_cache_default(void);
+/* 0 if the default instance cannot be created. */
+size_t vtpc_cache_page_size(vtpc_cache_t* cache);
+int vtpc_cache_open(
+    vtpc_cache_t* cache,
+    const char* path,
+    int mode,
+    int access
+);
+
+/* Backs the instance with a tier of clean pages in the POSIX shared memory
+ * object name, shared by every process attached to it: a miss looks there
+ * before going to disk, and pages read or written back are copied in. The
+ * object is created with room for capacity_bytes if it does not exist; a
+ * process that dies while using it costs the others some of its pages, and
+ * nothing else. Fails with EBUSY if the instance has a tier already or
+ * has files in it. The default instance attaches to $VTPC_SHARED, of
+ * $VTPC_SHARED_PAGES pages, if it is set. */
+int vtpc_cache_share(
+    vtpc_cache_t* cache,
+    const char* name,
+    size_t capacity_bytes
+);
+int vtpc_shared_unlink(const char* name);
+
+/* Backs the instance with capacity_bytes of memory holding compressed
+ * copies of clean pages it evicts, least recently evicted dropped first.
+ * A miss takes its page back from there before going to a shared tier or
+ * disk. Pages that do not compress by an eighth are not kept. Fails with
+ * EBUSY like vtpc_cache_share(). The default instance gets
+ * $VTPC_COMPRESS_PAGES pages' worth, none by default. */
+int vtpc_cache_compress(vtpc_cache_t* cache, size_t capacity_bytes);
+
+/* Keeps a warm-cache manifest for the instance at path: the pages it
+ * holds of a file, with their hit counts, are recorded when the file's
+ * last fd closes and when the instance is destroyed or, for the default
+ * one, at exit. Opening a file reads in, without waiting, the pages the
+ * manifest had for it when loaded here, hottest first if they do not all
+ * fit, as long as the file still has the size and mtime recorded with
+ * them. Fails with EBUSY like vtpc_cache_share(). The default instance
+ * keeps $VTPC_MANIFEST if it is set. */
+int vtpc_cache_manifest(vtpc_cache_t* cache, const char* path);
+
+/* Bucket i of a histogram counts samples of [2^i, 2^(i+1)) ns; the last
+ * bucket also takes everything slower. */
+#define VTPC_HIST_BUCKETS 32
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t buckets[VTPC_HIST_BUCKETS];
+} vtpc_hist_t;
+
+typedef struct {
+  uint64_t hits;       /* pages found resident, readahead included */
+  uint64_t misses;     /* pages not resident when asked for */
+  uint64_t readahead;  /* pages submitted for readahead */
+  uint64_t evictions;  /* pages evicted to make room */
+  uint64_t writebacks; /* dirty pages written back */
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t bypassed;         /* bytes moved around the cache, in both counts */
+  uint64_t shared;           /* misses served from the shared tier, not disk */
+  uint64_t compressed;       /* evictions kept in the compressed tier */
+  uint64_t compressed_bytes; /* their size there */
+  uint64_t incompressible;   /* evictions it did not keep */
+  uint64_t decompressed;     /* misses served from it */
+  vtpc_hist_t miss_ns;       /* disk reads that serviced a miss */
+  vtpc_hist_t flush_ns;      /* vectored writebacks, one sample per run */
+} vtpc_stats_t;
+
+/* Counters since creation or the last reset, for the whole instance or
+ * for one fd since it was opened. Evictions and writebacks belong to the
+ * file and are shared by its fds. A NULL cache means the default one. */
+int vtpc_cache_stats(vtpc_cache_t* cache, vtpc_stats_t* out);
+int vtpc_cache_stats_reset(vtpc_cache_t* cache);
+int vtpc_stats(int fd, vtpc_stats_t* out);
+int vtpc_stats_reset(int fd);
+
+/* Nanoseconds from now until the next access, for the opt policy. */
+typedef uint64_t access_hint_t;
+
+#define VTPC_ACCESS_NEVER UINT64_MAX
+
+/* Tells the cache when the resident pages of [offset, offset + len) are
+ * next accessed; len 0 means up to the end of the file. Under opt the page
+ * needed farthest in the future is evicted first, after pages with no
+ * hint. A hint covers one access, and one whose time passes without it
+ * makes the page the first to go. Other policies ignore it. */
+int vtpc_advice(int fd, off_t offset, off_t len, access_hint_t next_access);
+
+/* Access pattern advice, numbered as POSIX_FADV_* on Linux. NORMAL,
+ * RANDOM, SEQUENTIAL and NOREUSE set the pattern of the whole fd: RANDOM
+ * turns readahead off, SEQUENTIAL starts it at its largest window, and
+ * both SEQUENTIAL and NOREUSE load pages at the cold end of the policy so
+ * a scan does not push out the working set. WILLNEED starts reading the
+ * range in the background and DONTNEED writes it back and drops it. */
+#define VTPC_FADV_NORMAL 0
+#define VTPC_FADV_RANDOM 1
+#define VTPC_FADV_SEQUENTIAL 2
+#define VTPC_FADV_WILLNEED 3
+#define VTPC_FADV_DONTNEED 4
+#define VTPC_FADV_NOREUSE 5
+
+/* len 0 means up to the end of the file. */
+int vtpc_fadvise(int fd, off_t offset, off_t len, int advice);
 
 int vtpc_open(const char* path, int mode, int access);
 int vtpc_close(int fd);
 ssize_t vtpc_read(int fd, void* buf, size_t count);
 ssize_t vtpc_write(int fd, const void* buf, size_t count);
 off_t vtpc_lseek(int fd, off_t offset, int whence);
+
+/* As pread(2) and pwrite(2): the fd offset is neither used nor moved, and
+ * calls on one fd may run concurrently. */
+ssize_t vtpc_pread(int fd, void* buf, size_t count, off_t offset);
+ssize_t vtpc_pwrite(int fd, const void* buf, size_t count, off_t offset);
+
+/* As readv(2) and writev(2), at and moving the fd offset. Each page is
+ * looked up once per call, however the buffers split it. */
+ssize_t vtpc_readv(int fd, const struct iovec* iov, int iovcnt);
+ssize_t vtpc_writev(int fd, const struct iovec* iov, int iovcnt);
+
+/* A page held in memory by vtpc_pin(), or -1. */
+typedef int64_t vtpc_pin_t;
+
+#define VTPC_PIN_WRITE 0x1 /* the page will be changed in place */
+
+/* Loads page page_no of the file, of the cache's page size, and sets *ptr
+ * to its memory, which stays valid and is not evicted until the pin is
+ * released with vtpc_unpin(). Pins nest. Unpinning with dirty set marks the
+ * page modified; the page may be written back while pinned, and only
+ * unpinning dirty makes sure the last changes reach the file. Changes past
+ * the end of the file are not kept. vtpc_close() fails with EBUSY while
+ * the fd has pages pinned. */
+vtpc_pin_t vtpc_pin(int fd, uint64_t page_no, int flags, void** ptr);
+int vtpc_unpin(vtpc_pin_t pin, int dirty);
+
 int vtpc_fsync(int fd);
+
+/* Records every call that moves data, and every open, close, pin and fsync,
+ * to path in the binary format of trace.h, for replay by vtpc_sim. A new
+ * trace ends the one in progress and NULL only ends it. $VTPC_TRACE starts
+ * one on first use. */
+int vtpc_trace(const char* path);
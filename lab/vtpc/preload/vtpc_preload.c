@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "aio.h"
+#include "vtpc.h"
+
+/*
+ * LD_PRELOAD shim that sends the file I/O of an unmodified program through
+ * vtpc. VTPC_PRELOAD holds fnmatch(3) patterns separated by ':', matched
+ * against the absolute path, with '*' also matching '/'. An open(),
+ * openat() or fopen() of a matching regular file goes to vtpc_open(), and
+ * read, write, pread, pwrite, lseek, fsync, fdatasync and close on the fd
+ * go to vtpc. Streams are fopencookie(3) streams, so fileno() on them is -1.
+ *
+ * Anything else about the fd stays with the kernel: a dup of it, mmap(),
+ * readv() and fstat() all bypass the cache. Opens in append mode, of
+ * directories and with O_PATH are not routed, nor is anything the file
+ * system refuses O_DIRECT for. vtpc does not survive fork(), so a child
+ * that does I/O on routed files must exec first.
+ *
+ * Calls made from inside vtpc, such as the open() in vtpc_open() or those
+ * of its flusher and I/O threads, go straight to libc.
+ *
+ * Usage: LD_PRELOAD=build/preload/libvtpc_preload.so \
+ *        VTPC_PRELOAD='/data/t*:*.db' program ...
+ */
+
+#ifndef VTPC_PRELOAD_MAX_FDS
+#define VTPC_PRELOAD_MAX_FDS 65536
+#endif
+
+#define MAX_PATTERNS 32
+
+/* g_routed[fd] bits; both clear for fds vtpc does not own. */
+#define ROUTE_READ 0x1
+#define ROUTE_WRITE 0x2
+
+static struct {
+  int (*openat)(int, const char *, int, ...);
+  ssize_t (*read)(int, void *, size_t);
+  ssize_t (*write)(int, const void *, size_t);
+  ssize_t (*pread)(int, void *, size_t, off_t);
+  ssize_t (*pwrite)(int, const void *, size_t, off_t);
+  off_t (*lseek)(int, off_t, int);
+  int (*fsync)(int);
+  int (*fdatasync)(int);
+  int (*close)(int);
+  FILE *(*fopen)(const char *, const char *);
+} real;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static char *g_patterns[MAX_PATTERNS];
+static int g_npatterns;
+static unsigned char g_routed[VTPC_PRELOAD_MAX_FDS];
+static __thread int t_inside; /* in vtpc on this thread */
+
+static void init(void) {
+  real.openat = dlsym(RTLD_NEXT, "openat");
+  real.read = dlsym(RTLD_NEXT, "read");
+  real.write = dlsym(RTLD_NEXT, "write");
+  real.pread = dlsym(RTLD_NEXT, "pread");
+  real.pwrite = dlsym(RTLD_NEXT, "pwrite");
+  real.lseek = dlsym(RTLD_NEXT, "lseek");
+  real.fsync = dlsym(RTLD_NEXT, "fsync");
+  real.fdatasync = dlsym(RTLD_NEXT, "fdatasync");
+  real.close = dlsym(RTLD_NEXT, "close");
+  real.fopen = dlsym(RTLD_NEXT, "fopen");
+
+  const char *env = getenv("VTPC_PRELOAD");
+  char *list = (env && *env) ? strdup(env) : NULL;
+  char *save = NULL;
+  for (char *p = list ? strtok_r(list, ":", &save) : NULL;
+       p && g_npatterns < MAX_PATTERNS; p = strtok_r(NULL, ":", &save)) {
+    g_patterns[g_npatterns++] = p;
+  }
+}
+
+static void ensure(void) {
+  pthread_once(&g_once, init);
+}
+
+static int inside(void) {
+  return t_inside || aio_own_thread;
+}
+
+static int routed(int fd) {
+  if (fd < 0 || fd >= VTPC_PRELOAD_MAX_FDS || inside()) return 0;
+  return __atomic_load_n(&g_routed[fd], __ATOMIC_ACQUIRE);
+}
+
+/* Routed calls have a checked mode, so a read of a write-only fd still
+ * fails although vtpc holds it open read-write. */
+static int allowed(int fd, int need) {
+  if (routed(fd) & need) return 1;
+  errno = EBADF;
+  return 0;
+}
+
+/* Writes the absolute form of path, relative to dirfd, to out. */
+static int absolute(int dirfd, const char *path, char *out, size_t size) {
+  if (path[0] == '/') {
+    if (strlen(path) >= size) return -1;
+    strcpy(out, path);
+    return 0;
+  }
+
+  size_t len;
+  if (dirfd == AT_FDCWD) {
+    if (!getcwd(out, size)) return -1;
+    len = strlen(out);
+  } else {
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+    ssize_t n = readlink(link, out, size - 1);
+    if (n < 0) return -1;
+    len = (size_t)n;
+  }
+  if (len + 1 + strlen(path) >= size) return -1;
+  out[len] = '/';
+  strcpy(out + len + 1, path);
+  return 0;
+}
+
+static int wanted(int dirfd, const char *path, int flags, char *abs, size_t size) {
+  if (g_npatterns == 0 || inside()) return 0;
+  if (flags & (O_APPEND | O_DIRECTORY | O_PATH)) return 0;
+  if (absolute(dirfd, path, abs, size) != 0) return 0;
+  struct stat sb;
+  if (stat(abs, &sb) == 0 && !S_ISREG(sb.st_mode)) return 0;
+  for (int i = 0; i < g_npatterns; i++) {
+    if (fnmatch(g_patterns[i], abs, 0) == 0) return 1;
+  }
+  return 0;
+}
+
+/* Opens a matching path through vtpc, or returns -1 with errno 0 when the
+ * caller should open it as usual. vtpc reads in pages that writes only
+ * partly cover, so a write-only open is made read-write where permitted. */
+static int route_open(int dirfd, const char *path, int flags, mode_t mode) {
+  char abs[PATH_MAX];
+  if (!wanted(dirfd, path, flags, abs, sizeof(abs))) {
+    errno = 0;
+    return -1;
+  }
+
+  int route = 0;
+  if ((flags & O_ACCMODE) != O_WRONLY) route |= ROUTE_READ;
+  if ((flags & O_ACCMODE) != O_RDONLY) route |= ROUTE_WRITE;
+
+  t_inside = 1;
+  int fd = -1;
+  if ((flags & O_ACCMODE) == O_WRONLY) {
+    fd = vtpc_open(abs, (flags & ~O_ACCMODE) | O_RDWR, (int)mode);
+  }
+  if (fd < 0) fd = vtpc_open(abs, flags, (int)mode);
+  if (fd >= VTPC_PRELOAD_MAX_FDS) {
+    (void)vtpc_close(fd);
+    fd = -1;
+    errno = 0;
+  }
+  t_inside = 0;
+
+  if (fd < 0) {
+    if (errno == EINVAL) errno = 0; /* no O_DIRECT here */
+    return -1;
+  }
+  __atomic_store_n(&g_routed[fd], (unsigned char)route, __ATOMIC_RELEASE);
+  return fd;
+}
+
+static int open_any(int dirfd, const char *path, int flags, mode_t mode) {
+  ensure();
+  int fd = route_open(dirfd, path, flags, mode);
+  if (fd >= 0 || errno != 0) return fd;
+  return real.openat(dirfd, path, flags, mode);
+}
+
+static mode_t mode_arg(int flags, va_list ap) {
+  return (flags & (O_CREAT | O_TMPFILE)) ? (mode_t)va_arg(ap, int) : 0;
+}
+
+int open(const char *path, int flags, ...) {
+  va_list ap;
+  va_start(ap, flags);
+  mode_t mode = mode_arg(flags, ap);
+  va_end(ap);
+  return open_any(AT_FDCWD, path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+  va_list ap;
+  va_start(ap, flags);
+  mode_t mode = mode_arg(flags, ap);
+  va_end(ap);
+  return open_any(dirfd, path, flags, mode);
+}
+
+int creat(const char *path, mode_t mode) {
+  return open_any(AT_FDCWD, path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  ensure();
+  if (!routed(fd)) return real.read(fd, buf, count);
+  if (!allowed(fd, ROUTE_READ)) return -1;
+  t_inside = 1;
+  ssize_t n = vtpc_read(fd, buf, count);
+  t_inside = 0;
+  return n;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  ensure();
+  if (!routed(fd)) return real.write(fd, buf, count);
+  if (!allowed(fd, ROUTE_WRITE)) return -1;
+  t_inside = 1;
+  ssize_t n = vtpc_write(fd, buf, count);
+  t_inside = 0;
+  return n;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  ensure();
+  if (!routed(fd)) return real.pread(fd, buf, count, offset);
+  if (!allowed(fd, ROUTE_READ)) return -1;
+  t_inside = 1;
+  ssize_t n = vtpc_pread(fd, buf, count, offset);
+  t_inside = 0;
+  return n;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  ensure();
+  if (!routed(fd)) return real.pwrite(fd, buf, count, offset);
+  if (!allowed(fd, ROUTE_WRITE)) return -1;
+  t_inside = 1;
+  ssize_t n = vtpc_pwrite(fd, buf, count, offset);
+  t_inside = 0;
+  return n;
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  ensure();
+  if (!routed(fd)) return real.lseek(fd, offset, whence);
+  t_inside = 1;
+  off_t off = vtpc_lseek(fd, offset, whence);
+  t_inside = 0;
+  return off;
+}
+
+int fsync(int fd) {
+  ensure();
+  if (!routed(fd)) return real.fsync(fd);
+  t_inside = 1;
+  int rc = vtpc_fsync(fd);
+  t_inside = 0;
+  return rc;
+}
+
+int fdatasync(int fd) {
+  ensure();
+  if (!routed(fd)) return real.fdatasync(fd);
+  t_inside = 1;
+  int rc = vtpc_fsync(fd);
+  t_inside = 0;
+  return rc;
+}
+
+int close(int fd) {
+  ensure();
+  if (!routed(fd)) return real.close(fd);
+  __atomic_store_n(&g_routed[fd], 0, __ATOMIC_RELEASE);
+  t_inside = 1;
+  int rc = vtpc_close(fd);
+  t_inside = 0;
+  return rc;
+}
+
+/* With _FILE_OFFSET_BITS=64 programs call the 64-bit names; off_t is
+ * already 64 bits wide on the targets vtpc runs on. */
+_Static_assert(sizeof(off_t) == 8, "off_t must be 64 bits");
+
+int open64(const char *path, int flags, ...)
+    __attribute__((alias("open")));
+int openat64(int dirfd, const char *path, int flags, ...)
+    __attribute__((alias("openat")));
+int creat64(const char *path, mode_t mode) __attribute__((alias("creat")));
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset)
+    __attribute__((alias("pread")));
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset)
+    __attribute__((alias("pwrite")));
+off_t lseek64(int fd, off_t offset, int whence) __attribute__((alias("lseek")));
+
+/* Streams. glibc's stdio reaches the kernel without going through the
+ * functions above, so a matching fopen() gets a stream over vtpc. */
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size) {
+  t_inside = 1;
+  ssize_t n = vtpc_read((int)(intptr_t)cookie, buf, size);
+  t_inside = 0;
+  return n;
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+  t_inside = 1;
+  ssize_t n = vtpc_write((int)(intptr_t)cookie, buf, size);
+  t_inside = 0;
+  return (n < 0) ? 0 : n;
+}
+
+static int cookie_seek(void *cookie, off64_t *offset, int whence) {
+  t_inside = 1;
+  off_t off = vtpc_lseek((int)(intptr_t)cookie, *offset, whence);
+  t_inside = 0;
+  if (off < 0) return -1;
+  *offset = off;
+  return 0;
+}
+
+static int cookie_close(void *cookie) {
+  t_inside = 1;
+  int rc = vtpc_close((int)(intptr_t)cookie);
+  t_inside = 0;
+  return rc;
+}
+
+/* open(2) flags for an fopen() mode, or -1 for modes not routed. */
+static int mode_flags(const char *mode) {
+  int flags;
+  switch (mode[0]) {
+    case 'r':
+      flags = O_RDONLY;
+      break;
+    case 'w':
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+      break;
+    default:
+      return -1; /* append */
+  }
+  for (const char *p = mode + 1; *p && *p != ','; p++) {
+    if (*p == '+') flags = (flags & ~O_ACCMODE) | O_RDWR;
+    if (*p == 'x') flags |= O_EXCL;
+    if (*p == 'e') flags |= O_CLOEXEC;
+  }
+  return flags;
+}
+
+FILE *fopen(const char *path, const char *mode) {
+  ensure();
+  int flags = mode_flags(mode);
+  if (flags < 0) return real.fopen(path, mode);
+
+  int fd = route_open(AT_FDCWD, path, flags, 0666);
+  if (fd < 0) return (errno != 0) ? NULL : real.fopen(path, mode);
+  __atomic_store_n(&g_routed[fd], 0, __ATOMIC_RELEASE);
+
+  cookie_io_functions_t io = {
+      .read = cookie_read,
+      .write = cookie_write,
+      .seek = cookie_seek,
+      .close = cookie_close,
+  };
+  FILE *f = fopencookie((void *)(intptr_t)fd, mode, io);
+  if (!f) {
+    int saved = errno;
+    (void)cookie_close((void *)(intptr_t)fd);
+    errno = saved;
+  }
+  return f;
+}
+
+FILE *fopen64(const char *path, const char *mode)
+    __attribute__((alias("fopen")));
@@ -0,0 +1,283 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "policy.h"
+#include "trace.h"
+}
+
+/*
+ * Replays a trace recorded with vtpc_trace() or $VTPC_TRACE against caches
+ * of each capacity, page size and policy, with the policies of the library
+ * itself, and prints the hit rate of each next to that of Belady's optimal
+ * policy, which evicts the page needed again farthest in the future. Every
+ * page a read, write or pin touches counts as one access.
+ *
+ * Usage: vtpc_sim trace [policies] [page sizes] [capacities in pages]
+ *
+ * The lists are comma-separated. Capacities default to the powers of two
+ * from 16 pages up to the first that holds every page of the trace.
+ */
+
+namespace {
+
+constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+struct access_list {
+  std::vector<page_key_t> keys;  // one per distinct page, by id
+  std::vector<uint32_t> ids;     // the page of each access
+  std::vector<uint64_t> next;    // index of the next access to the page
+};
+
+auto split(const std::string& list) -> std::vector<std::string> {
+  std::vector<std::string> out;
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    if (!item.empty()) {
+      out.push_back(item);
+    }
+  }
+  return out;
+}
+
+auto load(const char* path) -> std::vector<trace_rec_t> {
+  std::ifstream in(path, std::ios::binary);
+  trace_header_t h{};
+  if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) {  // NOLINT
+    throw std::runtime_error(std::string(path) + ": no trace header");
+  }
+  if (h.magic != TRACE_MAGIC || h.version != TRACE_VERSION ||
+      h.record_size != sizeof(trace_rec_t)) {
+    throw std::runtime_error(std::string(path) + ": not a vtpc trace");
+  }
+  std::vector<trace_rec_t> recs;
+  trace_rec_t rec{};
+  while (in.read(reinterpret_cast<char*>(&rec), sizeof(rec))) {  // NOLINT
+    recs.push_back(rec);
+  }
+  return recs;
+}
+
+struct key_hasher {
+  auto operator()(const page_key_t& k) const -> size_t {
+    return key_hash(k);
+  }
+};
+
+struct key_equal {
+  auto operator()(const page_key_t& a, const page_key_t& b) const -> bool {
+    return key_eq(a, b) != 0;
+  }
+};
+
+// Turns the records into page accesses. An fd the trace never saw opened
+// stands for a file of its own.
+auto accesses(const std::vector<trace_rec_t>& recs, uint64_t page_size)
+    -> access_list {
+  access_list out;
+  std::unordered_map<int32_t, std::pair<uint64_t, uint64_t>> files;
+  std::unordered_map<page_key_t, uint32_t, key_hasher, key_equal> id_of;
+
+  for (const trace_rec_t& rec : recs) {
+    if (rec.op == TRACE_OPEN) {
+      files[rec.fd] = {rec.length, static_cast<uint64_t>(rec.offset)};
+      continue;
+    }
+    if (rec.op == TRACE_CLOSE) {
+      files.erase(rec.fd);
+      continue;
+    }
+    if ((rec.op != TRACE_READ && rec.op != TRACE_WRITE &&
+         rec.op != TRACE_PIN) ||
+        rec.length == 0 || rec.offset < 0) {
+      continue;
+    }
+
+    auto file = files.find(rec.fd);
+    const uint64_t dev = (file != files.end()) ? file->second.first : never;
+    const uint64_t ino = (file != files.end())
+                             ? file->second.second
+                             : static_cast<uint64_t>(rec.fd);
+    const auto offset = static_cast<uint64_t>(rec.offset);
+    const uint64_t last = (offset + rec.length - 1) / page_size;
+    for (uint64_t p = offset / page_size; p <= last; ++p) {
+      const page_key_t key{dev, ino, p};
+      auto [it, fresh] =
+          id_of.try_emplace(key, static_cast<uint32_t>(out.keys.size()));
+      if (fresh) {
+        out.keys.push_back(key);
+      }
+      out.ids.push_back(it->second);
+    }
+  }
+
+  out.next.assign(out.ids.size(), never);
+  std::vector<uint64_t> seen(out.keys.size(), never);
+  for (size_t i = out.ids.size(); i-- > 0;) {
+    out.next[i] = seen[out.ids[i]];
+    seen[out.ids[i]] = i;
+  }
+  return out;
+}
+
+// Hits of the optimal policy: on a miss with the cache full, the resident
+// page whose next access is farthest away goes. Heap entries go stale when
+// their page is accessed again and are skipped.
+auto belady(const access_list& a, uint32_t capacity) -> uint64_t {
+  std::vector<uint64_t> next_of(a.keys.size(), never);
+  std::vector<char> resident(a.keys.size(), 0);
+  std::priority_queue<std::pair<uint64_t, uint32_t>> heap;
+  uint32_t used = 0;
+  uint64_t hits = 0;
+
+  for (size_t i = 0; i < a.ids.size(); ++i) {
+    const uint32_t id = a.ids[i];
+    if (resident[id] != 0) {
+      ++hits;
+    } else {
+      if (used == capacity) {
+        for (;;) {
+          auto [when, victim] = heap.top();
+          heap.pop();
+          if (resident[victim] != 0 && next_of[victim] == when) {
+            resident[victim] = 0;
+            break;
+          }
+        }
+      } else {
+        ++used;
+      }
+      resident[id] = 1;
+    }
+    next_of[id] = a.next[i];
+    heap.emplace(a.next[i], id);
+  }
+  return hits;
+}
+
+// Hits of a library policy, driven as the cache drives it. OPT is told the
+// true next access of every page, so it should match Belady.
+auto simulate(const access_list& a, policy_kind_t kind, uint32_t capacity)
+    -> uint64_t {
+  policy_t* p = policy_create(kind, capacity);
+  if (p == nullptr) {
+    throw std::runtime_error("policy_create: " + std::string(strerror(errno)));
+  }
+  std::vector<int32_t> slot_of(a.keys.size(), -1);
+  std::vector<uint32_t> id_in(capacity, 0);
+  uint32_t used = 0;
+  uint64_t hits = 0;
+
+  for (size_t i = 0; i < a.ids.size(); ++i) {
+    const uint32_t id = a.ids[i];
+    int slot = slot_of[id];
+    if (slot >= 0) {
+      ++hits;
+      policy_hit(p, slot);
+    } else {
+      const int hint = policy_miss(p, a.keys[id]);
+      if (used < capacity) {
+        slot = static_cast<int>(used++);
+      } else {
+        slot = policy_victim(p, i);
+        policy_remove(p, slot);
+        slot_of[id_in[slot]] = -1;
+      }
+      policy_insert(p, slot, a.keys[id], hint);
+      slot_of[id] = slot;
+      id_in[slot] = id;
+    }
+    if (kind == POLICY_OPT) {
+      policy_advise(p, slot, a.next[i]);
+    }
+  }
+  policy_destroy(p);
+  return hits;
+}
+
+auto rate(uint64_t hits, size_t total) -> double {
+  return (total == 0)
+             ? 0.0
+             : static_cast<double>(hits) / static_cast<double>(total);
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int try {
+  if (argc < 2) {
+    std::cerr
+        << "usage: vtpc_sim trace [policies] [page sizes] [capacities]\n";
+    return 2;
+  }
+  const std::vector<trace_rec_t> recs = load(argv[1]);
+
+  std::vector<policy_kind_t> kinds;
+  for (const std::string& name :
+       split((argc > 2) ? argv[2] : "random,lru,clock,2q,arc")) {
+    policy_kind_t kind{};
+    if (policy_parse(name.c_str(), &kind) != 0) {
+      throw std::runtime_error("unknown policy " + name);
+    }
+    kinds.push_back(kind);
+  }
+  std::vector<uint64_t> page_sizes;
+  for (const std::string& size : split((argc > 3) ? argv[3] : "4096")) {
+    page_sizes.push_back(std::stoull(size));
+    if (page_sizes.back() == 0) {
+      throw std::runtime_error("page size 0");
+    }
+  }
+
+  std::cout << "page_size\tpages\taccesses";
+  for (policy_kind_t kind : kinds) {
+    std::cout << '\t' << policy_name(kind);
+  }
+  std::cout << "\tbelady\n";
+
+  for (uint64_t page_size : page_sizes) {
+    const access_list a = accesses(recs, page_size);
+    std::vector<uint32_t> capacities;
+    if (argc > 4) {
+      for (const std::string& pages : split(argv[4])) {
+        capacities.push_back(static_cast<uint32_t>(std::stoul(pages)));
+      }
+    } else {
+      for (uint32_t pages = 16;; pages *= 2) {
+        capacities.push_back(pages);
+        if (pages >= a.keys.size()) {
+          break;
+        }
+      }
+    }
+
+    for (uint32_t pages : capacities) {
+      if (pages == 0) {
+        throw std::runtime_error("capacity 0");
+      }
+      std::cout << page_size << '\t' << pages << '\t' << a.ids.size();
+      for (policy_kind_t kind : kinds) {
+        std::cout << '\t' << rate(simulate(a, kind, pages), a.ids.size());
+      }
+      std::cout << '\t' << rate(belady(a, pages), a.ids.size()) << '\n';
+    }
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
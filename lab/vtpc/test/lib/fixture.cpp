@@ -0,0 +1,118 @@
+#include "fixture.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "vtpc.h"
+}
+
+namespace vt {
+
+auto fill(size_t p) -> char {
+  return static_cast<char>('a' + p % 26);
+}
+
+auto make_file(const char* path, size_t pages) -> void {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  for (size_t p = 0; p < pages; ++p) {
+    out << std::string(page, fill(p));
+  }
+  if (!out) {
+    throw vt::exception() << "make " << path;
+  }
+}
+
+auto slurp(const char* path) -> std::string {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), {}};
+}
+
+auto on_disk(const char* path, size_t p) -> std::string {
+  std::ifstream in(path, std::ios::binary);
+  in.seekg(static_cast<std::streamoff>(p * page));
+  std::string buf(page, '\0');
+  in.read(buf.data(), static_cast<std::streamsize>(page));
+  return buf;
+}
+
+auto instance(size_t pages, int flags) -> vtpc_cache_t* {
+  vtpc_cache_t* cache = vtpc_cache_create(pages * page, page, flags);
+  if (!cache) {
+    throw vt::exception() << "create: " << strerror(errno);
+  }
+  return cache;
+}
+
+auto open_in(vtpc_cache_t* cache, const char* path, int mode) -> int {
+  const int fd = vtpc_cache_open(cache, path, mode, 0);
+  if (fd < 0) {
+    throw vt::exception() << "open: " << strerror(errno);
+  }
+  return fd;
+}
+
+auto close_fd(int fd) -> void {
+  if (vtpc_close(fd) != 0) {
+    throw vt::exception() << "close: " << strerror(errno);
+  }
+}
+
+auto done(vtpc_cache_t* cache) -> void {
+  if (vtpc_cache_destroy(cache) != 0) {
+    throw vt::exception() << "destroy: " << strerror(errno);
+  }
+}
+
+auto read_pages(int fd, size_t first, size_t n) -> void {
+  std::string buf(page, '\0');
+  for (size_t p = first; p < first + n; ++p) {
+    if (vtpc_pread(fd, buf.data(), page, static_cast<off_t>(p * page)) !=
+            static_cast<ssize_t>(page) ||
+        buf != std::string(page, fill(p))) {
+      throw vt::exception() << "page " << p << " reads wrong";
+    }
+  }
+}
+
+auto write_page(int fd, size_t p, char ch) -> void {
+  const std::string buf(page, ch);
+  if (vtpc_pwrite(fd, buf.data(), page, static_cast<off_t>(p * page)) !=
+      static_cast<ssize_t>(page)) {
+    throw vt::exception() << "pwrite " << p << ": " << strerror(errno);
+  }
+}
+
+auto stats(vtpc_cache_t* cache) -> vtpc_stats_t {
+  vtpc_stats_t s{};
+  if (vtpc_cache_stats(cache, &s) != 0) {
+    throw vt::exception() << "stats: " << strerror(errno);
+  }
+  return s;
+}
+
+auto stats(int fd) -> vtpc_stats_t {
+  vtpc_stats_t s{};
+  if (vtpc_stats(fd, &s) != 0) {
+    throw vt::exception() << "stats: " << strerror(errno);
+  }
+  return s;
+}
+
+auto check(uint64_t got, uint64_t want, const char* what) -> void {
+  if (got != want) {
+    throw vt::exception() << what << ": " << got << ", not " << want;
+  }
+}
+
+}  // namespace vt
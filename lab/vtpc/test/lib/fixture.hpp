@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace vt {
+
+// The page size of the instances the helpers create.
+constexpr size_t page = 4096;
+
+// What page p of a file made by make_file() is filled with.
+auto fill(size_t p) -> char;
+
+auto make_file(const char* path, size_t pages) -> void;
+auto slurp(const char* path) -> std::string;
+// Page p of the file as it is on disk.
+auto on_disk(const char* path, size_t p) -> std::string;
+
+auto instance(size_t pages, int flags) -> vtpc_cache_t*;
+auto open_in(vtpc_cache_t* cache, const char* path, int mode) -> int;
+auto close_fd(int fd) -> void;
+auto done(vtpc_cache_t* cache) -> void;
+
+// Reads pages [first, first + n) and checks they hold fill(p).
+auto read_pages(int fd, size_t first, size_t n) -> void;
+auto write_page(int fd, size_t p, char ch) -> void;
+
+auto stats(vtpc_cache_t* cache) -> vtpc_stats_t;
+auto stats(int fd) -> vtpc_stats_t;
+
+auto check(uint64_t got, uint64_t want, const char* what) -> void;
+
+}  // namespace vt
@@ -0,0 +1,97 @@
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t cache_pages = 64;
+constexpr size_t file_pages = 256;
+// Far enough off not to pass during the test, however slow it runs.
+constexpr access_hint_t soon = 1'000'000'000'000;
+constexpr access_hint_t later = 1000 * soon;
+constexpr access_hint_t past = 1;
+constexpr const char* path = "/tmp/vtpc_advice";
+
+auto hint(int fd, size_t first, size_t n, access_hint_t next) -> void {
+  if (vtpc_advice(
+          fd, static_cast<off_t>(first * vt::page),
+          static_cast<off_t>(n * vt::page), next
+      ) != 0) {
+    throw vt::exception() << "advice: " << strerror(errno);
+  }
+}
+
+// How many of the pages were not resident, reading them in.
+auto misses(int fd, size_t first, size_t n) -> uint64_t {
+  (void)vtpc_stats_reset(fd);
+  vt::read_pages(fd, first, n);
+  return vt::stats(fd).misses;
+}
+
+}  // namespace
+
+auto main() -> int try {
+  // One shard, so the whole cache is one opt queue.
+  (void)setenv("VTPC_POLICY", "opt", 1);
+  (void)setenv("VTPC_SHARDS", "1", 1);
+  vt::make_file(path, file_pages);
+
+  vtpc_cache_t* cache = vt::instance(cache_pages, VTPC_CACHE_NO_READAHEAD);
+  const int fd = vt::open_in(cache, path, O_RDONLY);
+
+  // Pages never used again go before the ones with no hint.
+  vt::check(misses(fd, 0, cache_pages), cache_pages, "fill");
+  hint(fd, 0, 16, soon);
+  hint(fd, 16, 16, VTPC_ACCESS_NEVER);
+  vt::check(misses(fd, 64, 16), 16, "load");
+  vt::check(misses(fd, 0, 16), 0, "soon");
+  vt::check(misses(fd, 32, 48), 0, "unhinted");
+  vt::check(misses(fd, 16, 16), 16, "never");
+
+  // Pages needed soon outlast a scan of the rest of the file; the last
+  // loads pushed them out, so they are read in again first.
+  vt::check(misses(fd, 0, 16), 16, "reload");
+  hint(fd, 0, 16, soon);
+  vt::check(misses(fd, 100, 156), 156, "scan");
+  vt::check(misses(fd, 0, 16), 0, "soon after scan");
+
+  // With every page hinted, the one needed last goes.
+  vt::check(misses(fd, 16, 48), 48, "refill");
+  hint(fd, 0, 32, soon);
+  hint(fd, 32, 32, later);
+  vt::check(misses(fd, 200, 1), 1, "load");
+  vt::check(misses(fd, 0, 32), 0, "sooner");
+  vt::check(misses(fd, 32, 32), 1, "later");
+
+  // A hint whose time has passed goes before live hints and no hint.
+  (void)misses(fd, 0, cache_pages);
+  vt::check(misses(fd, 0, cache_pages), 0, "resident");
+  hint(fd, 0, 16, past);
+  hint(fd, 16, 16, later);
+  vt::check(misses(fd, 100, 16), 16, "load");
+  vt::check(misses(fd, 16, 16), 0, "live");
+  vt::check(misses(fd, 32, 32), 0, "unhinted after expiry");
+  vt::check(misses(fd, 0, 16), 16, "expired");
+
+  vt::close_fd(fd);
+  vt::done(cache);
+  std::filesystem::remove(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
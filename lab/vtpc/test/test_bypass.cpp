@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t steps = (1U << 11U);
+constexpr size_t size = (1U << 22U);
+
+struct free_deleter {
+  void operator()(char* p) const { std::free(p); }  // NOLINT
+};
+
+auto check(ssize_t lhs, ssize_t rhs, const char* what) -> void {
+  if (lhs != rhs) {
+    throw vt::exception() << what << ": " << lhs << " != " << rhs << ": "
+                          << strerror(errno);
+  }
+}
+
+// Large aligned transfers go around the cache while small ones go through
+// it; both must see each other's data. The fd is O_DIRECT when opened with
+// vtpc_open() and reopened as such when only bound to the cache.
+auto run(bool through_vtpc) -> void {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  const int lhs = open("/tmp/a", O_RDWR | O_CREAT, 0777);  // NOLINT
+  const int rhs = through_vtpc
+                      ? vtpc_open("/tmp/b", O_RDWR | O_CREAT, 0777)  // NOLINT
+                      : open("/tmp/b", O_RDWR | O_CREAT, 0777);      // NOLINT
+  if (lhs < 0 || rhs < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+  const size_t page_size = vtpc_cache_page_size(nullptr);
+  const size_t pages = size / page_size;
+
+  std::unique_ptr<char, free_deleter> a(
+      static_cast<char*>(std::aligned_alloc(page_size, size))
+  );
+  std::unique_ptr<char, free_deleter> b(
+      static_cast<char*>(std::aligned_alloc(page_size, size))
+  );
+  if (!a || !b) {
+    throw std::bad_alloc();
+  }
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<size_t> page_dist(0, pages - 1);
+  std::uniform_int_distribution<size_t> count_dist(64, 256);  // NOLINT
+  std::uniform_int_distribution<size_t> small_dist(1, 3 * page_size);
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+
+  std::string noise(size + size / 2, ' ');
+  for (char& c : noise) {
+    c = static_cast<char>(char_dist(random));
+  }
+
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t point = action_dist(random);
+    const off_t offset = static_cast<off_t>(page_dist(random) * page_size);
+    size_t len = count_dist(random) * page_size;
+    if (offset + len > size) {
+      len = size - offset;
+    }
+    const bool small = point % 2 == 0;
+    const off_t at =
+        small ? offset + static_cast<off_t>(i % page_size) : offset;
+    if (small) {
+      len = small_dist(random);
+    }
+
+    if (point < 50) {  // NOLINT
+      std::memcpy(a.get(), noise.data() + (i * 4099 % size) / 2, len);
+      check(
+          pwrite(lhs, a.get(), len, at),
+          vtpc_pwrite(rhs, a.get(), len, at),
+          "pwrite"
+      );
+    } else {
+      std::memset(a.get(), 0, len);
+      std::memset(b.get(), 0, len);
+      check(
+          pread(lhs, a.get(), len, at),
+          vtpc_pread(rhs, b.get(), len, at),
+          "pread"
+      );
+      if (std::memcmp(a.get(), b.get(), len) != 0) {
+        throw vt::exception() << "data differs at step " << i;
+      }
+    }
+  }
+
+  vtpc_stats_t stats;
+  if (vtpc_stats(rhs, &stats) != 0 || stats.bypassed == 0) {
+    throw vt::exception() << "no transfer went around the cache";
+  }
+  check(vtpc_close(rhs), 0, "close");
+  (void)close(lhs);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run(true);
+  run(false);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,195 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "lz.h"
+#include "vtpc.h"
+}
+
+namespace {
+
+using vt::page;
+
+constexpr size_t cache_pages = 32;
+constexpr size_t file_pages = 256;
+constexpr const char* path = "/tmp/vtpc_compress";
+
+auto round_trip(const std::string& in) -> size_t {
+  std::string packed(lz_bound(in.size()), '\0');
+  const size_t len = lz_compress(in.data(), in.size(), packed.data(), packed.size());
+  std::string out(in.size(), '\0');
+  if (len == 0 ||
+      lz_decompress(packed.data(), len, out.data(), out.size()) != 0 ||
+      out != in) {
+    throw vt::exception() << "round trip of " << in.size() << " bytes failed";
+  }
+
+  // Cut short or cut off, it must not decode.
+  if (len > 1 &&
+      lz_decompress(packed.data(), len - 1, out.data(), out.size()) == 0) {
+    throw vt::exception() << "a truncated block decoded";
+  }
+  if (!in.empty() &&
+      lz_decompress(packed.data(), len, out.data(), out.size() - 1) == 0) {
+    throw vt::exception() << "a block decoded into too little room";
+  }
+  return len;
+}
+
+auto test_codec() -> void {
+  std::default_random_engine random(1);  // NOLINT
+  std::string noise(page, '\0');
+  for (char& ch : noise) {
+    ch = static_cast<char>(random());
+  }
+  std::string text;
+  while (text.size() < page) {
+    text += "line " + std::to_string(text.size()) + " of some text\n";
+  }
+  text.resize(page);
+
+  (void)round_trip("");
+  (void)round_trip("abc");
+  if (round_trip(std::string(page, '\0')) > page / 64) {
+    throw vt::exception() << "zeros did not compress";
+  }
+  if (round_trip(text) > page / 2) {
+    throw vt::exception() << "text did not compress";
+  }
+  (void)round_trip(noise);
+
+  std::string small(16, '\0');
+  if (lz_compress(noise.data(), noise.size(), small.data(), small.size()) != 0) {
+    throw vt::exception() << "compressed into too little room";
+  }
+  const std::string junk(64, '\xff');
+  if (lz_decompress(junk.data(), junk.size(), noise.data(), noise.size()) == 0) {
+    throw vt::exception() << "junk decoded";
+  }
+}
+
+auto page_text(size_t p, char tag) -> std::string {
+  std::string s;
+  while (s.size() < page) {
+    s += std::string("page ") + tag + std::to_string(p) + ' ';
+  }
+  s.resize(page);
+  return s;
+}
+
+auto check(int fd, const std::string& want) -> void {
+  std::string buf(page, '\0');
+  for (size_t p = 0; p < file_pages; ++p) {
+    const auto at = static_cast<off_t>(p * page);
+    if (vtpc_pread(fd, buf.data(), page, at) != static_cast<ssize_t>(page) ||
+        buf != want.substr(p * page, page)) {
+      throw vt::exception() << "page " << p << " reads wrong";
+    }
+  }
+}
+
+auto test_tier() -> void {
+  std::string want;
+  for (size_t p = 0; p < file_pages; ++p) {
+    want += page_text(p, 'a');
+  }
+  std::filesystem::remove(path);
+  {
+    const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ::write(fd, want.data(), want.size()) !=
+                      static_cast<ssize_t>(want.size())) {
+      throw vt::exception() << "prepare: " << strerror(errno);
+    }
+    (void)::close(fd);
+  }
+
+  vtpc_cache_t* cache = vt::instance(
+      cache_pages, VTPC_CACHE_NO_READAHEAD | VTPC_CACHE_NO_BYPASS
+  );
+  if (vtpc_cache_compress(cache, file_pages * page) != 0) {
+    throw vt::exception() << "compress: " << strerror(errno);
+  }
+  const int fd = vt::open_in(cache, path, O_RDWR);
+  if (vtpc_cache_compress(cache, page) == 0 || errno != EBUSY) {
+    throw vt::exception() << "a second tier was taken";
+  }
+
+  // Once to fill the tier, then again from it.
+  check(fd, want);
+  vtpc_stats_t s = vt::stats(cache);
+  if (s.compressed < file_pages - cache_pages ||
+      s.compressed_bytes >= s.compressed * page / 2) {
+    throw vt::exception() << s.compressed << " pages kept in "
+                          << s.compressed_bytes << " bytes";
+  }
+  (void)vtpc_cache_stats_reset(cache);
+  check(fd, want);
+  s = vt::stats(cache);
+  if (s.decompressed < file_pages - cache_pages ||
+      s.miss_ns.count > cache_pages) {
+    throw vt::exception() << s.decompressed << " pages from the tier, "
+                          << s.miss_ns.count << " from disk";
+  }
+
+  // Partial writes to pages held only in the tier keep the rest of them.
+  for (size_t p = 0; p < file_pages; p += 3) {
+    const std::string patch = "patched " + std::to_string(p);
+    const size_t at = p * page + 100;
+    want.replace(at, patch.size(), patch);
+    if (vtpc_pwrite(fd, patch.data(), patch.size(), static_cast<off_t>(at)) !=
+        static_cast<ssize_t>(patch.size())) {
+      throw vt::exception() << "write: " << strerror(errno);
+    }
+  }
+  check(fd, want);
+  check(fd, want);
+
+  // Dropped pages come back from disk, not the tier.
+  if (vtpc_fadvise(fd, 0, 0, VTPC_FADV_DONTNEED) != 0) {
+    throw vt::exception() << "fadvise: " << strerror(errno);
+  }
+  (void)vtpc_cache_stats_reset(cache);
+  check(fd, want);
+  s = vt::stats(cache);
+  if (s.decompressed != 0 || s.miss_ns.count != file_pages) {
+    throw vt::exception() << s.decompressed << " dropped pages came back";
+  }
+
+  vt::close_fd(fd);
+  vt::done(cache);
+
+  std::string disk(want.size(), '\0');
+  const int raw = ::open(path, O_RDONLY);
+  if (raw < 0 || ::read(raw, disk.data(), disk.size()) !=
+                     static_cast<ssize_t>(disk.size()) ||
+      disk != want) {
+    throw vt::exception() << "the file reads wrong after close";
+  }
+  (void)::close(raw);
+  std::filesystem::remove(path);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  test_codec();
+  test_tier();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
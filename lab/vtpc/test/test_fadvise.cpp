@@ -0,0 +1,160 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+using vt::page;
+
+constexpr size_t cache_pages = 256;
+constexpr size_t file_pages = 1024;
+constexpr size_t hot_pages = 32;
+constexpr const char* path = "/tmp/vtpc_fadvise";
+
+auto advise(int fd, size_t first, size_t n, int advice) -> void {
+  if (vtpc_fadvise(
+          fd, static_cast<off_t>(first * page), static_cast<off_t>(n * page),
+          advice
+      ) != 0) {
+    throw vt::exception() << "fadvise " << advice << ": " << strerror(errno);
+  }
+}
+
+// Through the fd offset, which is what readahead follows.
+auto stream_pages(int fd, size_t first, size_t n) -> void {
+  if (vtpc_lseek(fd, static_cast<off_t>(first * page), SEEK_SET) < 0) {
+    throw vt::exception() << "lseek: " << strerror(errno);
+  }
+  std::string buf(page, '\0');
+  for (size_t p = first; p < first + n; ++p) {
+    if (vtpc_read(fd, buf.data(), page) != static_cast<ssize_t>(page) ||
+        buf != std::string(page, vt::fill(p))) {
+      throw vt::exception() << "page " << p << " reads wrong";
+    }
+  }
+}
+
+// WILLNEED reads the range in ahead of its use.
+auto test_willneed() -> void {
+  vtpc_cache_t* cache = vt::instance(cache_pages, VTPC_CACHE_NO_READAHEAD);
+  const int fd = vt::open_in(cache, path, O_RDONLY);
+  advise(fd, 10, hot_pages, VTPC_FADV_WILLNEED);
+  vt::read_pages(fd, 10, hot_pages);
+  const vtpc_stats_t s = vt::stats(fd);
+  if (s.hits != hot_pages || s.misses != 0 || s.readahead != hot_pages) {
+    throw vt::exception() << "willneed: " << s.hits << " hits, " << s.misses
+                          << " misses";
+  }
+  vt::close_fd(fd);
+  vt::done(cache);
+}
+
+// A sequential read ahead of a RANDOM fd loads only what it asks for.
+auto test_random() -> void {
+  vtpc_cache_t* cache = vt::instance(cache_pages, 0);
+  const int normal = vt::open_in(cache, path, O_RDONLY);
+  stream_pages(normal, 0, 64);
+  if (vt::stats(normal).readahead == 0) {
+    throw vt::exception() << "no readahead to turn off";
+  }
+
+  const int fd = vt::open_in(cache, path, O_RDONLY);
+  advise(fd, 0, 0, VTPC_FADV_RANDOM);
+  stream_pages(fd, 512, 64);
+  const vtpc_stats_t s = vt::stats(fd);
+  if (s.readahead != 0 || s.misses != 64) {
+    throw vt::exception() << "random: " << s.readahead << " pages read ahead";
+  }
+  vt::close_fd(fd);
+  vt::close_fd(normal);
+  vt::done(cache);
+}
+
+// A scan of four times the cache under the advice leaves the pages read
+// twice before it resident.
+auto test_scan(int advice) -> void {
+  vtpc_cache_t* cache = vt::instance(cache_pages, VTPC_CACHE_NO_READAHEAD);
+  const int hot = vt::open_in(cache, path, O_RDONLY);
+  vt::read_pages(hot, 0, hot_pages);
+  vt::read_pages(hot, 0, hot_pages);
+
+  const int scan = vt::open_in(cache, path, O_RDONLY);
+  advise(scan, 0, 0, advice);
+  vt::read_pages(scan, hot_pages, file_pages - hot_pages);
+  if (vt::stats(scan).misses != file_pages - hot_pages) {
+    throw vt::exception() << "scan " << advice << " hit pages it never read";
+  }
+
+  (void)vtpc_stats_reset(hot);
+  vt::read_pages(hot, 0, hot_pages);
+  if (vt::stats(hot).misses != 0) {
+    throw vt::exception() << "scan " << advice << " evicted "
+                          << vt::stats(hot).misses << " hot pages";
+  }
+  vt::close_fd(scan);
+  vt::close_fd(hot);
+  vt::done(cache);
+}
+
+// DONTNEED writes a dirty page back before it drops it.
+auto test_dontneed() -> void {
+  vtpc_cache_t* cache = vt::instance(cache_pages, VTPC_CACHE_NO_READAHEAD);
+  const int fd = vt::open_in(cache, path, O_RDWR);
+  const std::string data(page, 'Z');
+  if (vtpc_pwrite(fd, data.data(), page, 5 * page) !=
+      static_cast<ssize_t>(page)) {
+    throw vt::exception() << "pwrite: " << strerror(errno);
+  }
+  advise(fd, 5, 1, VTPC_FADV_DONTNEED);
+  if (vt::stats(fd).writebacks != 1) {
+    throw vt::exception() << "dontneed did not write the page back";
+  }
+
+  // On disk before the fd closes, and read back from there.
+  if (vt::on_disk(path, 5) != data) {
+    throw vt::exception() << "dontneed lost the write";
+  }
+  std::string buf(page, '\0');
+  (void)vtpc_stats_reset(fd);
+  if (vtpc_pread(fd, buf.data(), page, 5 * page) !=
+          static_cast<ssize_t>(page) ||
+      buf != data || vt::stats(fd).misses != 1) {
+    throw vt::exception() << "dontneed did not drop the page";
+  }
+  vt::close_fd(fd);
+  vt::done(cache);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  vt::make_file(path, file_pages);
+
+  test_willneed();
+  test_random();
+  test_scan(VTPC_FADV_SEQUENTIAL);
+  test_scan(VTPC_FADV_NOREUSE);
+  test_dontneed();
+
+  std::filesystem::remove(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,85 @@
+#include <fcntl.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t small_pages = 32;
+constexpr size_t large_pages = 128;
+constexpr size_t file_pages = 128;
+constexpr const char* path = "/tmp/vtpc_instances";
+
+auto page_is(size_t p, char ch) -> bool {
+  return vt::on_disk(path, p) == std::string(vt::page, ch);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  // One shard each, so eviction counts follow from the sizes.
+  (void)setenv("VTPC_SHARDS", "1", 1);
+  vt::make_file(path, file_pages);
+
+  vtpc_cache_t* small = vt::instance(small_pages, VTPC_CACHE_NO_READAHEAD);
+  vtpc_cache_t* large = vt::instance(large_pages, VTPC_CACHE_NO_READAHEAD);
+  const int sfd = vt::open_in(small, path, O_RDWR);
+  const int lfd = vt::open_in(large, path, O_RDWR);
+
+  // The same pages, read in each, are read from disk by each, and only
+  // the small one runs out of room.
+  vt::read_pages(lfd, 0, 64);
+  vt::read_pages(sfd, 0, 64);
+  vt::check(vt::stats(large).misses, 64, "large misses");
+  vt::check(vt::stats(small).misses, 64, "small misses");
+  vt::check(vt::stats(large).evictions, 0, "large evictions");
+  vt::check(vt::stats(small).evictions, 64 - small_pages, "small evictions");
+
+  // What the small one evicted is still in the large one.
+  (void)vtpc_cache_stats_reset(large);
+  vt::read_pages(lfd, 0, 64);
+  vt::check(vt::stats(large).hits, 64, "large hits");
+  vt::check(vt::stats(large).misses, 0, "large misses after the small one");
+  vt::check(vt::stats(small).hits, 0, "small hits");
+
+  // Destroying the small one writes back its dirty pages and leaves the
+  // large one's alone.
+  vt::write_page(sfd, 70, 's');
+  vt::write_page(sfd, 71, 's');
+  vt::write_page(lfd, 80, 'l');
+  vt::close_fd(sfd);
+  vt::done(small);
+  if (!page_is(70, 's') || !page_is(71, 's')) {
+    throw vt::exception() << "the small instance lost its writes";
+  }
+  if (!page_is(80, vt::fill(80)) || vt::stats(large).writebacks != 0) {
+    throw vt::exception() << "the large instance was written back";
+  }
+  (void)vtpc_cache_stats_reset(large);
+  vt::read_pages(lfd, 0, 64);
+  vt::check(
+      vt::stats(large).hits, 64, "large hits after the small one is gone"
+  );
+
+  vt::close_fd(lfd);
+  vt::done(large);
+  if (!page_is(80, 'l')) {
+    throw vt::exception() << "the large instance lost its write";
+  }
+  std::filesystem::remove(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
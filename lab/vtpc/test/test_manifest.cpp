@@ -0,0 +1,122 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "manifest.h"
+#include "vtpc.h"
+}
+
+namespace {
+
+using vt::page;
+
+constexpr size_t file_pages = 64;
+constexpr const char* path = "/tmp/vtpc_manifest_data";
+constexpr const char* manifest_path = "/tmp/vtpc_test.manifest";
+
+// A fresh instance, as a restarted process would have.
+auto instance() -> vtpc_cache_t* {
+  vtpc_cache_t* cache = vt::instance(2 * file_pages, VTPC_CACHE_NO_READAHEAD);
+  if (vtpc_cache_manifest(cache, manifest_path) != 0) {
+    throw vt::exception() << "manifest: " << strerror(errno);
+  }
+  return cache;
+}
+
+// Page number to hotness, for the one file in the manifest.
+auto load() -> std::map<uint64_t, uint64_t> {
+  std::ifstream in(manifest_path, std::ios::binary);
+  manifest_header_t h{};
+  manifest_file_t f{};
+  in.read(reinterpret_cast<char*>(&h), sizeof(h));  // NOLINT
+  in.read(reinterpret_cast<char*>(&f), sizeof(f));  // NOLINT
+  if (!in || h.magic != MANIFEST_MAGIC || h.page_size != page ||
+      h.nfiles != 1 || f.size != static_cast<int64_t>(file_pages * page)) {
+    throw vt::exception() << "bad manifest";
+  }
+  std::map<uint64_t, uint64_t> pages;
+  for (uint64_t i = 0; i < f.npages; ++i) {
+    manifest_page_t p{};
+    in.read(reinterpret_cast<char*>(&p), sizeof(p));  // NOLINT
+    pages[p.page_no] = p.hotness;
+  }
+  if (!in) {
+    throw vt::exception() << "short manifest";
+  }
+  return pages;
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::filesystem::remove(manifest_path);
+  vt::make_file(path, file_pages);
+
+  // A first run reads two hot ranges and records them on close.
+  vtpc_cache_t* cache = instance();
+  int fd = vt::open_in(cache, path, O_RDONLY);
+  for (int round = 0; round < 3; ++round) {
+    vt::read_pages(fd, 10, 10);
+  }
+  vt::read_pages(fd, 40, 5);
+  vt::close_fd(fd);
+  vt::done(cache);
+  std::map<uint64_t, uint64_t> pages = load();
+  if (pages.size() != 15 || pages[10] != 2 || pages[40] != 0) {
+    throw vt::exception() << pages.size() << " pages recorded";
+  }
+
+  // The next one has them read in by the time it gets to them.
+  cache = instance();
+  fd = vt::open_in(cache, path, O_RDONLY);
+  if (vt::stats(cache).readahead != 15) {
+    throw vt::exception() << vt::stats(cache).readahead << " pages warmed";
+  }
+  vt::read_pages(fd, 10, 10);
+  vt::read_pages(fd, 40, 5);
+  vtpc_stats_t s = vt::stats(cache);
+  if (s.hits != 15 || s.misses != 0) {
+    throw vt::exception() << s.hits << " hits, " << s.misses << " misses";
+  }
+  vt::read_pages(fd, 0, 1);
+  vt::close_fd(fd);
+  vt::done(cache);
+  if (load().size() != 16) {
+    throw vt::exception() << "the second run was not recorded";
+  }
+
+  // A file that changed since is not warmed.
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << std::string(page, 'z');
+  }
+  cache = instance();
+  fd = vt::open_in(cache, path, O_RDONLY);
+  if (vt::stats(cache).readahead != 0) {
+    throw vt::exception() << "a stale manifest was used";
+  }
+  vt::close_fd(fd);
+  vt::done(cache);
+
+  std::filesystem::remove(path);
+  std::filesystem::remove(manifest_path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,156 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t steps = (1U << 14U);
+constexpr size_t size = (1U << 21U);
+constexpr size_t record = 100;
+
+auto check(ssize_t lhs, ssize_t rhs, const char* what) -> void {
+  if (lhs != rhs) {
+    throw vt::exception() << what << ": " << lhs << " != " << rhs << ": "
+                          << strerror(errno);
+  }
+}
+
+// Pages read from disk, less those read in to be written back.
+auto fills() -> int64_t {
+  vtpc_stats_t stats;
+  if (vtpc_cache_stats(nullptr, &stats) != 0) {
+    throw vt::exception() << "stats: " << strerror(errno);
+  }
+  return static_cast<int64_t>(stats.miss_ns.count) -
+         static_cast<int64_t>(stats.writebacks);
+}
+
+// Small writes over an existing file leave the rest of each page unread
+// until it is read or written back. Both files start with the same data.
+auto run() -> void {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+  std::string noise(size + size / 2, ' ');
+  for (char& c : noise) {
+    c = static_cast<char>(char_dist(random));
+  }
+  {
+    std::ofstream a("/tmp/a", std::ios::binary);
+    std::ofstream b("/tmp/b", std::ios::binary);
+    a.write(noise.data(), size);
+    b.write(noise.data(), size);
+  }
+
+  const int lhs = open("/tmp/a", O_RDWR);
+  const int rhs = vtpc_open("/tmp/b", O_RDWR, 0);
+  if (lhs < 0 || rhs < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+
+  // Records appended one after another never need the old page contents.
+  const int64_t before = fills();
+  for (size_t at = 0; at + record <= size / 2; at += record) {
+    const char* data = noise.data() + size + at % (size / 4);
+    check(
+        pwrite(lhs, data, record, static_cast<off_t>(at)),
+        vtpc_pwrite(rhs, data, record, static_cast<off_t>(at)),
+        "pwrite"
+    );
+  }
+  if (fills() > before) {
+    throw vt::exception() << "partial writes read " << fills() - before
+                          << " pages";
+  }
+
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<size_t> offset_dist(0, size - 1);
+  std::uniform_int_distribution<size_t> len_dist(1, 700);  // NOLINT
+  std::string a(size, ' ');
+  std::string b(size, ' ');
+
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t point = action_dist(random);
+    const size_t at = offset_dist(random);
+    const size_t len = std::min(len_dist(random), size - at);
+
+    if (point < 60) {  // NOLINT
+      const char* data = noise.data() + (i * 4099 % size);
+      check(
+          pwrite(lhs, data, len, static_cast<off_t>(at)),
+          vtpc_pwrite(rhs, data, len, static_cast<off_t>(at)),
+          "pwrite"
+      );
+    } else if (point < 98) {  // NOLINT
+      check(
+          pread(lhs, a.data(), len, static_cast<off_t>(at)),
+          vtpc_pread(rhs, b.data(), len, static_cast<off_t>(at)),
+          "pread"
+      );
+      if (std::memcmp(a.data(), b.data(), len) != 0) {
+        throw vt::exception() << "data differs at step " << i;
+      }
+    } else {
+      check(vtpc_fsync(rhs), 0, "fsync");
+    }
+  }
+
+  check(vtpc_close(rhs), 0, "close");
+  (void)close(lhs);
+  if (vt::slurp("/tmp/a") != vt::slurp("/tmp/b")) {
+    throw vt::exception() << "files differ";
+  }
+}
+
+// A partial write through a write-only fd cannot read the rest of its
+// page in, but still reaches the file.
+auto write_only() -> void {
+  const std::string before(3 * record, 'o');
+  {
+    std::ofstream out("/tmp/b", std::ios::binary | std::ios::trunc);
+    out << before;
+  }
+  const int fd = vtpc_open("/tmp/b", O_WRONLY, 0);
+  check(fd >= 0 ? 0 : -1, 0, "open");
+  check(vtpc_lseek(fd, record, SEEK_SET), record, "lseek");
+  check(vtpc_write(fd, "hello", 5), 5, "write");
+  check(vtpc_close(fd), 0, "close");
+
+  std::string want = before;
+  want.replace(record, 5, "hello");
+  if (vt::slurp("/tmp/b") != want) {
+    throw vt::exception() << "write-only write was lost";
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  run();
+  write_only();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
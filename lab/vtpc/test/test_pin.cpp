@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t steps = (1U << 13U);
+constexpr size_t size = (1U << 21U);
+constexpr size_t held = 8;
+
+struct pinned {
+  vtpc_pin_t pin;
+  uint64_t page_no;
+  const char* data;
+};
+
+}  // namespace
+
+auto main() -> int try {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  const int lhs = open("/tmp/a", O_RDWR | O_CREAT, 0777);  // NOLINT
+  const int rhs = vtpc_open("/tmp/b", O_RDWR | O_CREAT, 0777);  // NOLINT
+  if (lhs < 0 || rhs < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+  const size_t page_size = vtpc_cache_page_size(nullptr);
+  const uint64_t pages = size / page_size;
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+  std::string text(size, ' ');
+  for (char& c : text) {
+    c = static_cast<char>(char_dist(random));
+  }
+  if (pwrite(lhs, text.data(), size, 0) != static_cast<ssize_t>(size) ||
+      vtpc_pwrite(rhs, text.data(), size, 0) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to fill: " << strerror(errno);
+  }
+
+  std::uniform_int_distribution<uint64_t> page_dist(0, pages - 1);
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<size_t> offset_dist(0, page_size - 1);
+  std::vector<pinned> pins;
+  std::vector<std::string> copies;
+
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t point = action_dist(random);
+    const uint64_t page_no = page_dist(random);
+    const off_t at = static_cast<off_t>(page_no * page_size);
+
+    if (point < 40) {  // NOLINT
+      // Read in place and compare with libc.
+      void* ptr = nullptr;
+      const vtpc_pin_t pin = vtpc_pin(rhs, page_no, 0, &ptr);
+      if (pin < 0) {
+        throw vt::exception() << "pin: " << strerror(errno);
+      }
+      std::string expected(page_size, ' ');
+      (void)pread(lhs, expected.data(), page_size, at);
+      if (std::memcmp(ptr, expected.data(), page_size) != 0) {
+        throw vt::exception() << "page " << page_no << " differs";
+      }
+      if (vtpc_unpin(pin, 0) != 0) {
+        throw vt::exception() << "unpin: " << strerror(errno);
+      }
+    } else if (point < 70) {  // NOLINT
+      // Change a few bytes in place.
+      void* ptr = nullptr;
+      const vtpc_pin_t pin = vtpc_pin(rhs, page_no, VTPC_PIN_WRITE, &ptr);
+      if (pin < 0) {
+        throw vt::exception() << "pin: " << strerror(errno);
+      }
+      const size_t offset = offset_dist(random);
+      const char c = static_cast<char>(char_dist(random));
+      static_cast<char*>(ptr)[offset] = c;
+      (void)pwrite(lhs, &c, 1, at + static_cast<off_t>(offset));
+      for (size_t k = 0; k < pins.size(); ++k) {
+        if (pins[k].page_no == page_no) {
+          copies[k][offset] = c;
+        }
+      }
+      if (vtpc_unpin(pin, 1) != 0) {
+        throw vt::exception() << "unpin: " << strerror(errno);
+      }
+    } else if (point < 80 && pins.size() < held) {  // NOLINT
+      // Hold a page while the rest of the file streams through the cache.
+      void* ptr = nullptr;
+      const vtpc_pin_t pin = vtpc_pin(rhs, page_no, 0, &ptr);
+      if (pin < 0) {
+        throw vt::exception() << "pin: " << strerror(errno);
+      }
+      pins.push_back({pin, page_no, static_cast<const char*>(ptr)});
+      copies.emplace_back(static_cast<const char*>(ptr), page_size);
+    } else if (point < 90 && !pins.empty()) {  // NOLINT
+      if (std::memcmp(pins.back().data, copies.back().data(), page_size) != 0) {
+        throw vt::exception() << "pinned page " << pins.back().page_no
+                              << " changed";
+      }
+      if (vtpc_unpin(pins.back().pin, 0) != 0) {
+        throw vt::exception() << "unpin: " << strerror(errno);
+      }
+      pins.pop_back();
+      copies.pop_back();
+    } else {
+      std::string buf(page_size * 16, ' ');
+      (void)vtpc_pread(rhs, buf.data(), buf.size(), at);
+    }
+  }
+
+  if (!pins.empty() && (vtpc_close(rhs) != -1 || errno != EBUSY)) {
+    throw vt::exception() << "close with pinned pages did not fail";
+  }
+  for (const auto& p : pins) {
+    (void)vtpc_unpin(p.pin, 0);
+  }
+  if (vtpc_unpin(0, 0) != -1 || errno != EINVAL) {
+    throw vt::exception() << "unpin of a stale pin did not fail";
+  }
+  if (vtpc_close(rhs) != 0) {
+    throw vt::exception() << "close: " << strerror(errno);
+  }
+  (void)close(lhs);
+
+  if (vt::slurp("/tmp/a") != vt::slurp("/tmp/b")) {
+    throw vt::exception() << "files differ";
+  }
+
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
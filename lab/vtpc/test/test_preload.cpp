@@ -0,0 +1,193 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+/*
+ * Runs itself again with the shim preloaded and /tmp/b routed through
+ * vtpc, then drives /tmp/a and /tmp/b with the same plain libc calls.
+ */
+
+namespace {
+
+constexpr size_t steps = (1U << 13U);
+constexpr size_t size = (1U << 20U);
+
+auto check(ssize_t lhs, ssize_t rhs, const char* what) -> void {
+  if (lhs != rhs) {
+    throw vt::exception() << what << ": " << lhs << " != " << rhs << ": "
+                          << strerror(errno);
+  }
+}
+
+auto is_direct(int fd) -> bool {
+  return (fcntl(fd, F_GETFL) & O_DIRECT) != 0;  // NOLINT
+}
+
+auto slurp(const char* path) -> std::string {
+  const int fd = open(path, O_RDONLY);  // NOLINT
+  std::string out(size * 2, '\0');
+  const ssize_t n = read(fd, out.data(), out.size());
+  (void)close(fd);
+  out.resize(n < 0 ? 0 : static_cast<size_t>(n));
+  return out;
+}
+
+auto run_fds() -> void {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  const int lhs = open("/tmp/a", O_RDWR | O_CREAT, 0644);  // NOLINT
+  const int rhs = open("/tmp/b", O_RDWR | O_CREAT, 0644);  // NOLINT
+  if (lhs < 0 || rhs < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+  if (is_direct(lhs) || !is_direct(rhs)) {
+    throw vt::exception() << "/tmp/b is not routed, or /tmp/a is";
+  }
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size - 1);
+  std::uniform_int_distribution<size_t> len_dist(1, 9000);  // NOLINT
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+  std::string a(len_dist.max(), ' ');
+  std::string b(len_dist.max(), ' ');
+
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t point = action_dist(random);
+    const off_t offset = offset_dist(random);
+    const size_t len = len_dist(random);
+
+    if (point < 30) {  // NOLINT
+      for (size_t j = 0; j < len; ++j) {
+        a[j] = static_cast<char>(char_dist(random));
+      }
+      check(write(lhs, a.data(), len), write(rhs, a.data(), len), "write");
+    } else if (point < 45) {  // NOLINT
+      check(
+          pwrite(lhs, a.data(), len, offset),
+          pwrite(rhs, a.data(), len, offset),
+          "pwrite"
+      );
+    } else if (point < 70) {  // NOLINT
+      const ssize_t n = read(lhs, a.data(), len);
+      check(n, read(rhs, b.data(), len), "read");
+      if (n > 0 && a.compare(0, n, b, 0, n) != 0) {
+        throw vt::exception() << "read differs at step " << i;
+      }
+    } else if (point < 85) {  // NOLINT
+      const ssize_t n = pread(lhs, a.data(), len, offset);
+      check(n, pread(rhs, b.data(), len, offset), "pread");
+      if (n > 0 && a.compare(0, n, b, 0, n) != 0) {
+        throw vt::exception() << "pread differs at step " << i;
+      }
+    } else if (point < 90) {  // NOLINT
+      check(
+          lseek(lhs, offset, SEEK_SET),
+          lseek(rhs, offset, SEEK_SET),
+          "lseek set"
+      );
+    } else if (point < 94) {  // NOLINT
+      const off_t back = -static_cast<off_t>(len % 4096);
+      check(
+          lseek(lhs, back, SEEK_CUR), lseek(rhs, back, SEEK_CUR), "lseek cur"
+      );
+    } else if (point < 97) {  // NOLINT
+      const off_t back = -static_cast<off_t>(len % 4096);
+      check(
+          lseek(lhs, back, SEEK_END), lseek(rhs, back, SEEK_END), "lseek end"
+      );
+    } else {
+      check(fsync(lhs), fsync(rhs), "fsync");
+    }
+  }
+
+  check(close(lhs), close(rhs), "close");
+  if (slurp("/tmp/a") != slurp("/tmp/b")) {
+    throw vt::exception() << "files differ";
+  }
+
+  const int wronly = open("/tmp/b", O_WRONLY);  // NOLINT
+  if (!is_direct(wronly) || read(wronly, a.data(), 1) != -1 ||
+      errno != EBADF) {
+    throw vt::exception() << "read of a write-only fd did not fail";
+  }
+  (void)close(wronly);
+}
+
+auto run_streams() -> void {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  FILE* lhs = fopen("/tmp/a", "w+");  // NOLINT
+  FILE* rhs = fopen("/tmp/b", "w+");  // NOLINT
+  if (lhs == nullptr || rhs == nullptr) {
+    throw vt::exception() << "failed to fopen: " << strerror(errno);
+  }
+  if (fileno(lhs) < 0 || fileno(rhs) >= 0) {
+    throw vt::exception() << "/tmp/b is not a vtpc stream, or /tmp/a is";
+  }
+
+  // The replace loop of ema-replace-int: read, step back, overwrite.
+  for (int i = 0; i < 100000; ++i) {  // NOLINT
+    check(
+        static_cast<ssize_t>(fwrite(&i, sizeof(i), 1, lhs)),
+        static_cast<ssize_t>(fwrite(&i, sizeof(i), 1, rhs)),
+        "fwrite"
+    );
+  }
+  check(fseek(lhs, 0, SEEK_SET), fseek(rhs, 0, SEEK_SET), "fseek");
+  std::array<int, 2> cur{};
+  while (fread(&cur[0], sizeof(int), 1, lhs) == 1) {
+    if (fread(&cur[1], sizeof(int), 1, rhs) != 1 || cur[0] != cur[1]) {
+      throw vt::exception() << "fread differs at " << cur[0];
+    }
+    if (cur[0] % 7 == 0) {  // NOLINT
+      const int value = -cur[0];
+      const long back = -static_cast<long>(sizeof(int));
+      check(fseek(lhs, back, SEEK_CUR), fseek(rhs, back, SEEK_CUR), "fseek");
+      check(
+          static_cast<ssize_t>(fwrite(&value, sizeof(value), 1, lhs)),
+          static_cast<ssize_t>(fwrite(&value, sizeof(value), 1, rhs)),
+          "fwrite"
+      );
+    }
+  }
+  check(fclose(lhs), fclose(rhs), "fclose");
+  if (slurp("/tmp/a") != slurp("/tmp/b")) {
+    throw vt::exception() << "files differ after streams";
+  }
+}
+
+}  // namespace
+
+auto main(int /*argc*/, char** argv) -> int try {
+  if (std::getenv("VTPC_PRELOAD") == nullptr) {
+    (void)setenv("VTPC_PRELOAD", "/tmp/b", 1);
+    (void)setenv("LD_PRELOAD", VTPC_PRELOAD_LIB, 1);
+    // The shim then loads ahead of a sanitizer runtime linked in here.
+    (void)setenv("ASAN_OPTIONS", "verify_asan_link_order=0", 0);
+    (void)execv("/proc/self/exe", argv);
+    throw vt::exception() << "failed to exec: " << strerror(errno);
+  }
+  run_fds();
+  run_streams();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,172 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cmp_file.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t handles = 3;
+constexpr size_t steps = (1U << 14U);
+constexpr size_t size = (1U << 16U);
+constexpr int high_fd = 2048;
+
+// Pushes the next fds past the old fixed table, if the limit allows it.
+auto occupy_low_fds() -> std::vector<int> {
+  std::vector<int> fds;
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    return fds;
+  }
+  if (limit.rlim_cur < high_fd + 64 && limit.rlim_max >= high_fd + 64) {
+    limit.rlim_cur = high_fd + 64;
+    (void)setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  for (;;) {
+    const int fd = open("/dev/null", O_RDONLY);  // NOLINT
+    if (fd < 0) {
+      break;
+    }
+    fds.push_back(fd);
+    if (fd >= high_fd) {
+      break;
+    }
+  }
+  return fds;
+}
+
+// An open of a file open already sees what was done to it since.
+auto reopen_changed() -> void {
+  constexpr const char* path = "/tmp/vtpc_reopen";
+  constexpr off_t page = 4096;
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << std::string(3 * page, 'x');
+  }
+  std::string buf(page, '\0');
+  const int fd = vtpc_open(path, O_RDWR, 0);
+  if (fd < 0 || vtpc_pread(fd, buf.data(), 100, 0) != 100 ||
+      vtpc_pwrite(fd, "dirty", 5, 2 * page) != 5) {
+    throw vt::exception() << "first handle failed";
+  }
+
+  // Changed from outside, and grown, so it shows.
+  {
+    std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+    out << std::string(page, 'y');
+    out.seekp(3 * page);
+    out << std::string(page, 'z');
+  }
+  int other = vtpc_open(path, O_RDONLY, 0);
+  if (other < 0 || vtpc_pread(fd, buf.data(), 1, 0) != 1 || buf[0] != 'y' ||
+      vtpc_lseek(fd, 0, SEEK_END) != 4 * page ||
+      vtpc_pread(fd, buf.data(), 5, 2 * page) != 5 ||
+      buf.substr(0, 5) != "dirty" || vtpc_close(other) != 0) {
+    throw vt::exception() << "an outside change was not seen";
+  }
+
+  // Truncated by a second handle: nothing is left to read, and the dirty
+  // page of the first is not written back over it.
+  other = vtpc_open(path, O_RDWR | O_TRUNC, 0);
+  if (other < 0 || vtpc_pread(fd, buf.data(), 100, 0) != 0 ||
+      vtpc_lseek(fd, 0, SEEK_END) != 0 ||
+      vtpc_lseek(other, 0, SEEK_END) != 0) {
+    throw vt::exception() << "O_TRUNC left the old contents";
+  }
+  if (vtpc_write(other, "new", 3) != 3 || vtpc_close(other) != 0 ||
+      vtpc_close(fd) != 0) {
+    throw vt::exception() << "closing after O_TRUNC failed";
+  }
+  if (std::filesystem::file_size(path) != 3) {
+    throw vt::exception() << std::filesystem::file_size(path)
+                          << " bytes left after O_TRUNC";
+  }
+  std::filesystem::remove(path);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  reopen_changed();
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+  const std::vector<int> low = occupy_low_fds();
+
+  // Every handle pairs its own fd of /tmp/a with its own fd of /tmp/b, so
+  // both sides must stay coherent across handles of one file.
+  std::array<std::unique_ptr<vt::cmp_file>, handles> files;
+  for (auto& file : files) {
+    file = std::make_unique<vt::cmp_file>(
+        vt::file::open_libc("/tmp/a"), vt::file::open_vtpc("/tmp/b")
+    );
+  }
+
+  std::default_random_engine random(1);  // NOLINT
+
+  std::uniform_int_distribution<size_t> handle_dist(0, handles - 1);
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(0, size / 16);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  const auto random_string = [&](size_t size) {
+    std::string string(size, ' ');
+    for (char& c : string) {
+      c = static_cast<char>(char_dist(random));
+    }
+    return string;
+  };
+
+  files[0]->seek(0);
+  files[0]->write(std::string(size, ' '));
+
+  for (size_t i = 0; i < steps; ++i) {
+    auto& file = files[handle_dist(random)];
+    try {
+      size_t point = action_dist(random);
+      if (point < 40) {  // NOLINT
+        file->read(batch_dist(random));
+      } else if (point < 75) {  // NOLINT
+        file->write(random_string(batch_dist(random)));
+      } else if (point < 97) {  // NOLINT
+        file->seek(offset_dist(random));
+      } else {
+        // Reopening keeps the pages of /tmp/b warm for the other handles.
+        file = std::make_unique<vt::cmp_file>(
+            vt::file::open_libc("/tmp/a"), vt::file::open_vtpc("/tmp/b")
+        );
+      }
+    } catch (vt::file_exception& e) {  // NOLINT
+      // Do nothing
+    }
+  }
+
+  files[0]->seek(0);
+  files[0]->read(size);
+
+  for (const int fd : low) {
+    close(fd);
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
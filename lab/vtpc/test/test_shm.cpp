@@ -0,0 +1,240 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "shared.h"
+#include "vtpc.h"
+}
+
+/*
+ * Every vtpc instance here lives in a child process of its own, so pages
+ * can only get from one to the next through the shared tier. The parent
+ * only uses libc, and the tier itself for the crash test.
+ */
+
+namespace {
+
+constexpr size_t page = 4096;
+constexpr size_t pages = 128;
+constexpr size_t size = pages * page;
+constexpr size_t cache_pages = 32;
+constexpr size_t tier_pages = 1024;
+
+auto noise(size_t n, unsigned seed) -> std::string {
+  std::default_random_engine random(seed);
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+  std::string out(n, ' ');
+  for (char& c : out) {
+    c = static_cast<char>(char_dist(random));
+  }
+  return out;
+}
+
+// Runs fn in a child and fails if it does.
+auto in_child(const std::function<void()>& fn) -> void {
+  const pid_t pid = fork();
+  if (pid < 0) {
+    throw vt::exception() << "fork: " << strerror(errno);
+  }
+  if (pid == 0) {
+    int rc = 0;
+    try {
+      fn();
+    } catch (const std::exception& e) {
+      std::cerr << "exception in child: " << e.what() << '\n';
+      rc = 1;
+    }
+    std::cout.flush();
+    _exit(rc);
+  }
+  int status = 0;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << "child failed";
+  }
+}
+
+struct shared_cache {
+  vtpc_cache_t* cache;
+
+  explicit shared_cache(const std::string& name)
+      : cache(vtpc_cache_create(cache_pages * page, page, 0)) {
+    if (cache == nullptr ||
+        vtpc_cache_share(cache, name.c_str(), tier_pages * page) != 0) {
+      throw vt::exception() << "share: " << strerror(errno);
+    }
+  }
+
+  auto stats() const -> vtpc_stats_t {
+    vtpc_stats_t out;
+    if (vtpc_cache_stats(cache, &out) != 0) {
+      throw vt::exception() << "stats: " << strerror(errno);
+    }
+    return out;
+  }
+};
+
+// Reads the file through a fresh instance and returns its stats.
+auto read_all(const std::string& name, const std::string& want)
+    -> vtpc_stats_t {
+  const shared_cache sc(name);
+  const int fd = vtpc_cache_open(sc.cache, "/tmp/b", O_RDONLY, 0);
+  if (fd < 0) {
+    throw vt::exception() << "open: " << strerror(errno);
+  }
+  std::string got(want.size() + page, ' ');
+  ssize_t n = 0;
+  for (size_t at = 0; at < got.size(); at += static_cast<size_t>(n)) {
+    n = vtpc_read(fd, got.data() + at, page);
+    if (n < 0) {
+      throw vt::exception() << "read: " << strerror(errno);
+    }
+    if (n == 0) {
+      got.resize(at);
+      break;
+    }
+  }
+  if (got != want) {
+    throw vt::exception() << "read differs";
+  }
+  (void)vtpc_close(fd);
+  return sc.stats();
+}
+
+// With the file in the tier, no read waits for the disk. The tier also
+// takes pages this small instance evicts, so some come from it twice.
+auto expect_shared(const std::string& name, const std::string& want, bool all)
+    -> void {
+  const vtpc_stats_t stats = read_all(name, want);
+  const uint64_t total = (want.size() + page - 1) / page;
+  if (all ? (stats.shared < total || stats.miss_ns.count != 0)
+          : stats.miss_ns.count == 0) {
+    throw vt::exception() << stats.shared << " pages from the tier, "
+                          << stats.miss_ns.count << " from disk, of " << total;
+  }
+}
+
+// A second process reads what the first brought in, writes from one reach
+// the next, and a change made behind the tier's back costs it the file.
+auto run_sharing(const std::string& name) -> void {
+  std::string data = noise(size, 1);
+  {
+    std::ofstream b("/tmp/b", std::ios::binary | std::ios::trunc);
+    b.write(data.data(), static_cast<std::streamsize>(data.size()));
+  }
+
+  in_child([&] { expect_shared(name, data, false); });
+  in_child([&] { expect_shared(name, data, true); });
+
+  const std::string patch = noise(size / 4, 2);
+  const size_t at = size / 3;
+  data.replace(at, patch.size(), patch);
+  in_child([&] {
+    const shared_cache sc(name);
+    const int fd = vtpc_cache_open(sc.cache, "/tmp/b", O_RDWR, 0);
+    if (fd < 0 ||
+        vtpc_pwrite(fd, patch.data(), patch.size(), static_cast<off_t>(at)) !=
+            static_cast<ssize_t>(patch.size()) ||
+        vtpc_fsync(fd) != 0 || vtpc_close(fd) != 0) {
+      throw vt::exception() << "write: " << strerror(errno);
+    }
+  });
+  if (vt::slurp("/tmp/b") != data) {
+    throw vt::exception() << "file differs after write";
+  }
+  in_child([&] { expect_shared(name, data, true); });
+
+  const std::string tail = noise(page / 2, 3);
+  data.replace(0, tail.size(), tail);
+  data += tail;
+  {
+    std::fstream b("/tmp/b", std::ios::binary | std::ios::in | std::ios::out);
+    b.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+    b.seekp(0, std::ios::end);
+    b.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+  }
+  in_child([&] { expect_shared(name, data, false); });
+}
+
+// Kills writers of large pages until one dies holding a shard lock, then
+// checks that the next to lock it finds a working, empty shard.
+auto run_crash(const std::string& name) -> void {
+  constexpr uint32_t big = 256U << 10U;
+  constexpr size_t keys = 64;
+  shared_t* tier = shared_attach(name.c_str(), 32 * big, big);
+  if (tier == nullptr) {
+    throw vt::exception() << "attach: " << strerror(errno);
+  }
+  const std::string data = noise(big, 4);
+  std::vector<char> buf(big);
+  uint64_t epoch = 0;
+
+  std::default_random_engine random(5);  // NOLINT
+  std::uniform_int_distribution<useconds_t> delay_dist(0, 2000);  // NOLINT
+  for (int round = 0; shared_recoveries(tier) == 0; ++round) {
+    if (round == 1000) {  // NOLINT
+      throw vt::exception() << "no writer died holding a lock";
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+      throw vt::exception() << "fork: " << strerror(errno);
+    }
+    if (pid == 0) {
+      for (uint64_t i = 0;; ++i) {
+        shared_write(tier, page_key_t{1, 1, i % keys}, 1, data.data());
+      }
+    }
+    (void)usleep(delay_dist(random));
+    (void)kill(pid, SIGKILL);
+    (void)waitpid(pid, nullptr, 0);
+    for (uint64_t i = 0; i < keys; ++i) {
+      (void)shared_get(tier, page_key_t{1, 1, i}, 1, buf.data(), &epoch);
+    }
+  }
+
+  for (uint64_t i = 0; i < keys; ++i) {
+    shared_write(tier, page_key_t{1, 1, i}, 2, data.data());
+    if (shared_get(tier, page_key_t{1, 1, i}, 2, buf.data(), &epoch) != 1 ||
+        std::memcmp(buf.data(), data.data(), big) != 0) {
+      throw vt::exception() << "page " << i << " lost after recovery";
+    }
+  }
+  shared_detach(tier);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  const std::string name = "/vtpc_test_shm." + std::to_string(getpid());
+  const std::string crash = name + ".crash";
+  std::filesystem::remove("/tmp/b");
+
+  run_sharing(name);
+  run_crash(crash);
+
+  (void)vtpc_shared_unlink(name.c_str());
+  (void)vtpc_shared_unlink(crash.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,109 @@
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t cache_pages = 64;
+constexpr size_t file_pages = 32;
+constexpr const char* path = "/tmp/vtpc_stats";
+
+auto check_hist(const vtpc_hist_t& h, uint64_t count, const char* what) -> void {
+  uint64_t sum = 0;
+  for (const uint64_t b : h.buckets) {
+    sum += b;
+  }
+  vt::check(h.count, count, what);
+  vt::check(sum, count, what);
+  if ((count > 0) != (h.total_ns > 0)) {
+    throw vt::exception() << what << ": " << h.total_ns << " ns in all";
+  }
+}
+
+// What the sequence in main leaves, seen from the fd or the instance.
+auto check_all(const vtpc_stats_t& s) -> void {
+  vt::check(s.hits, 3, "hits");
+  vt::check(s.misses, 6, "misses");
+  vt::check(s.readahead, 0, "readahead");
+  vt::check(s.evictions, 0, "evictions");
+  vt::check(s.writebacks, 3, "writebacks");
+  vt::check(s.bytes_read, 6 * vt::page, "bytes read");
+  vt::check(s.bytes_written, 3 * vt::page, "bytes written");
+  vt::check(s.bypassed, 0, "bypassed");
+  check_hist(s.miss_ns, 4, "miss histogram");
+  check_hist(s.flush_ns, 3, "flush histogram");
+}
+
+auto check_zero(const vtpc_stats_t& s, const char* what) -> void {
+  const vtpc_stats_t zero{};
+  if (std::memcmp(&s, &zero, sizeof(s)) != 0) {
+    throw vt::exception() << what << " left counts behind";
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  vt::make_file(path, file_pages);
+
+  vtpc_cache_t* cache = vt::instance(
+      cache_pages, VTPC_CACHE_NO_READAHEAD | VTPC_CACHE_NO_BYPASS
+  );
+  const int fd = vt::open_in(cache, path, O_RDWR);
+
+  // Four misses read from disk, then two hits.
+  vt::read_pages(fd, 0, 4);
+  vt::read_pages(fd, 0, 2);
+
+  // A hit and two misses that overwrite whole pages, so nothing is read.
+  // The dirty pages are apart and go out as three runs.
+  vt::write_page(fd, 2, 'w');
+  vt::write_page(fd, 10, 'w');
+  vt::write_page(fd, 20, 'w');
+  if (vtpc_fsync(fd) != 0) {
+    throw vt::exception() << "fsync: " << strerror(errno);
+  }
+
+  vtpc_stats_t s{};
+  (void)vtpc_stats(fd, &s);
+  check_all(s);
+  (void)vtpc_cache_stats(cache, &s);
+  check_all(s);
+
+  // Each reset clears its own counts only.
+  (void)vtpc_stats_reset(fd);
+  (void)vtpc_stats(fd, &s);
+  check_zero(s, "fd reset");
+  (void)vtpc_cache_stats(cache, &s);
+  check_all(s);
+  (void)vtpc_cache_stats_reset(cache);
+  (void)vtpc_cache_stats(cache, &s);
+  check_zero(s, "instance reset");
+
+  // And counting goes on from there.
+  vt::read_pages(fd, 0, 1);
+  s = vt::stats(fd);
+  vt::check(s.hits, 1, "hits after reset");
+  vt::check(s.bytes_read, vt::page, "bytes read after reset");
+
+  vt::close_fd(fd);
+  vt::done(cache);
+  std::filesystem::remove(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
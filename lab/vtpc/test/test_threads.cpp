@@ -0,0 +1,96 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cmp_file.hpp"
+#include "file.hpp"
+
+namespace {
+
+constexpr size_t threads = 8;
+constexpr size_t steps = (1U << 13U);
+constexpr size_t size = (1U << 19U);
+
+auto worker(size_t id) -> void {
+  const std::string lhs = "/tmp/a." + std::to_string(id);
+  const std::string rhs = "/tmp/b." + std::to_string(id);
+  std::filesystem::remove(lhs);
+  std::filesystem::remove(rhs);
+
+  vt::cmp_file file(vt::file::open_libc(lhs), vt::file::open_vtpc(rhs));
+
+  std::default_random_engine random(id);  // NOLINT
+
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(0, size / 64);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  const auto random_string = [&](size_t size) {
+    std::string string(size, ' ');
+    for (char& c : string) {
+      c = static_cast<char>(char_dist(random));
+    }
+    return string;
+  };
+
+  file.seek(0);
+  file.write(std::string(size, ' '));
+
+  for (size_t i = 0; i < steps; ++i) {
+    try {
+      size_t point = action_dist(random);
+      if (point < 40) {  // NOLINT
+        file.read(batch_dist(random));
+      } else if (point < 75) {  // NOLINT
+        file.write(random_string(batch_dist(random)));
+      } else if (point < 98) {  // NOLINT
+        file.seek(offset_dist(random));
+      } else {
+        file.sync();
+      }
+    } catch (vt::file_exception& e) {  // NOLINT
+      // Do nothing
+    }
+  }
+
+  file.seek(0);
+  file.read(size);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::vector<std::exception_ptr> errors(threads);
+  {
+    std::vector<std::jthread> pool;
+    for (size_t id = 0; id < threads; ++id) {
+      pool.emplace_back([id, &errors] {
+        try {
+          worker(id);
+        } catch (...) {
+          errors[id] = std::current_exception();
+        }
+      });
+    }
+  }
+
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,117 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include "trace.h"
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr const char* trace_path = "/tmp/vtpc_test.trace";
+
+struct expected {
+  uint32_t op;
+  int64_t offset;
+  uint64_t length;
+};
+
+auto load() -> std::vector<trace_rec_t> {
+  std::ifstream in(trace_path, std::ios::binary);
+  trace_header_t h{};
+  in.read(reinterpret_cast<char*>(&h), sizeof(h));  // NOLINT
+  if (!in || h.magic != TRACE_MAGIC || h.version != TRACE_VERSION ||
+      h.record_size != sizeof(trace_rec_t)) {
+    throw vt::exception() << "bad trace header";
+  }
+  std::vector<trace_rec_t> recs;
+  trace_rec_t rec{};
+  while (in.read(reinterpret_cast<char*>(&rec), sizeof(rec))) {  // NOLINT
+    recs.push_back(rec);
+  }
+  return recs;
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::filesystem::remove("/tmp/b");
+  if (vtpc_trace(trace_path) != 0) {
+    throw vt::exception() << "trace: " << strerror(errno);
+  }
+
+  const int fd = vtpc_open("/tmp/b", O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    throw vt::exception() << "open: " << strerror(errno);
+  }
+  struct stat sb {};
+  (void)fstat(fd, &sb);
+
+  const size_t page = vtpc_cache_page_size(nullptr);
+  const std::string data(3 * page + 100, 'x');
+  std::string buf(data.size(), ' ');
+  void* mem = nullptr;
+  if (vtpc_write(fd, data.data(), data.size()) !=
+          static_cast<ssize_t>(data.size()) ||
+      vtpc_lseek(fd, 10, SEEK_SET) != 10 ||
+      vtpc_read(fd, buf.data(), 500) != 500 ||
+      vtpc_pread(fd, buf.data(), buf.size(), 2 * page) !=
+          static_cast<ssize_t>(page + 100) ||
+      vtpc_pwrite(fd, data.data(), 7, 5) != 7 ||
+      vtpc_pread(fd, buf.data(), 1, static_cast<off_t>(data.size())) != 0 ||
+      vtpc_unpin(vtpc_pin(fd, 1, 0, &mem), 0) != 0 || vtpc_fsync(fd) != 0 ||
+      vtpc_close(fd) != 0) {
+    throw vt::exception() << "I/O failed: " << strerror(errno);
+  }
+  // Not traced any more.
+  (void)vtpc_trace(nullptr);
+  const int after = vtpc_open("/tmp/b", O_RDONLY, 0);
+  (void)vtpc_read(after, buf.data(), 1);
+  (void)vtpc_close(after);
+
+  const std::vector<expected> want = {
+      {TRACE_OPEN, static_cast<int64_t>(sb.st_ino),
+       static_cast<uint64_t>(sb.st_dev)},
+      {TRACE_WRITE, 0, data.size()},
+      {TRACE_READ, 10, 500},
+      {TRACE_READ, static_cast<int64_t>(2 * page), page + 100},
+      {TRACE_WRITE, 5, 7},
+      {TRACE_PIN, static_cast<int64_t>(page), page},
+      {TRACE_SYNC, 0, 0},
+      {TRACE_CLOSE, 0, 0},
+  };
+  const std::vector<trace_rec_t> got = load();
+  if (got.size() != want.size()) {
+    throw vt::exception() << got.size() << " records, not " << want.size();
+  }
+  for (size_t i = 0; i < want.size(); ++i) {
+    if (got[i].op != want[i].op || got[i].fd != fd ||
+        got[i].offset != want[i].offset || got[i].length != want[i].length ||
+        (i > 0 && got[i].ns < got[i - 1].ns)) {
+      throw vt::exception() << "record " << i << " is op " << got[i].op
+                            << " at " << got[i].offset << " of "
+                            << got[i].length;
+    }
+  }
+
+  std::filesystem::remove(trace_path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,195 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t steps = (1U << 13U);
+constexpr size_t size = (1U << 18U);
+constexpr size_t max_iov = 32;
+constexpr size_t threads = 8;
+constexpr size_t record = 1000;
+
+// Splits len bytes of buf into random iovecs, some of them empty.
+auto split(std::default_random_engine& random, char* buf, size_t len)
+    -> std::vector<iovec> {
+  std::uniform_int_distribution<size_t> count_dist(1, max_iov);
+  std::vector<iovec> iov(count_dist(random));
+  std::uniform_int_distribution<size_t> cut_dist(0, len);
+  std::vector<size_t> cuts(iov.size() - 1);
+  for (size_t& cut : cuts) {
+    cut = cut_dist(random);
+  }
+  std::ranges::sort(cuts);
+  size_t start = 0;
+  for (size_t i = 0; i < iov.size(); ++i) {
+    const size_t end = (i < cuts.size()) ? cuts[i] : len;
+    iov[i] = iovec{.iov_base = buf + start, .iov_len = end - start};
+    start = end;
+  }
+  return iov;
+}
+
+auto check(ssize_t lhs, ssize_t rhs, const char* what) -> void {
+  if (lhs != rhs) {
+    throw vt::exception() << what << ": " << lhs << " != " << rhs;
+  }
+}
+
+// Threads share one fd and touch disjoint records only through it.
+auto shared_fd_worker(int fd, size_t id) -> void {
+  std::default_random_engine random(id);  // NOLINT
+  constexpr size_t records = size / record / threads;
+  std::uniform_int_distribution<size_t> record_dist(0, records - 1);
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+
+  std::vector<std::string> mine(records, std::string(record, '\0'));
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t r = record_dist(random);
+    const off_t offset = static_cast<off_t>((r * threads + id) * record);
+    if (i % 2 == 0) {
+      for (char& c : mine[r]) {
+        c = static_cast<char>(char_dist(random));
+      }
+      check(vtpc_pwrite(fd, mine[r].data(), record, offset), record, "pwrite");
+    } else {
+      std::string got(record, ' ');
+      check(vtpc_pread(fd, got.data(), record, offset), record, "pread");
+      if (got != mine[r]) {
+        throw vt::exception() << "record " << r << " of thread " << id;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::filesystem::remove("/tmp/a");
+  std::filesystem::remove("/tmp/b");
+
+  const int lhs = open("/tmp/a", O_RDWR | O_CREAT, 0777);  // NOLINT
+  const int rhs = vtpc_open("/tmp/b", O_RDWR | O_CREAT, 0777);  // NOLINT
+  if (lhs < 0 || rhs < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(0, size / 16);
+  std::uniform_int_distribution<int> char_dist(0, 255);  // NOLINT
+
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t point = action_dist(random);
+    const off_t offset = offset_dist(random);
+    const size_t len = batch_dist(random);
+    std::string a(len, ' ');
+    std::string b(len, ' ');
+
+    if (point < 25) {  // NOLINT
+      for (char& c : a) {
+        c = static_cast<char>(char_dist(random));
+      }
+      check(
+          pwrite(lhs, a.data(), len, offset),
+          vtpc_pwrite(rhs, a.data(), len, offset),
+          "pwrite"
+      );
+    } else if (point < 50) {  // NOLINT
+      check(
+          pread(lhs, a.data(), len, offset),
+          vtpc_pread(rhs, b.data(), len, offset),
+          "pread"
+      );
+      if (a != b) {
+        throw vt::exception() << "pread differs at step " << i;
+      }
+    } else if (point < 70) {  // NOLINT
+      for (char& c : a) {
+        c = static_cast<char>(char_dist(random));
+      }
+      const std::vector<iovec> iov = split(random, a.data(), len);
+      const int n = static_cast<int>(iov.size());
+      check(
+          writev(lhs, iov.data(), n), vtpc_writev(rhs, iov.data(), n), "writev"
+      );
+    } else if (point < 90) {  // NOLINT
+      std::default_random_engine same = random;
+      const std::vector<iovec> iov_a = split(random, a.data(), len);
+      const std::vector<iovec> iov_b = split(same, b.data(), len);
+      const int n = static_cast<int>(iov_a.size());
+      check(
+          readv(lhs, iov_a.data(), n),
+          vtpc_readv(rhs, iov_b.data(), n),
+          "readv"
+      );
+      if (a != b) {
+        throw vt::exception() << "readv differs at step " << i;
+      }
+    } else {
+      check(
+          lseek(lhs, offset, SEEK_SET),
+          vtpc_lseek(rhs, offset, SEEK_SET),
+          "lseek"
+      );
+    }
+  }
+
+  check(vtpc_close(rhs), 0, "close");
+  (void)close(lhs);
+
+  // Positional calls on one fd from many threads at once.
+  std::filesystem::remove("/tmp/b");
+  const int fd = vtpc_open("/tmp/b", O_RDWR | O_CREAT, 0777);  // NOLINT
+  if (fd < 0) {
+    throw vt::exception() << "failed to open: " << strerror(errno);
+  }
+  const std::string zero(size, '\0');
+  check(vtpc_pwrite(fd, zero.data(), size, 0), size, "pwrite");
+
+  std::vector<std::thread> pool;
+  std::vector<std::exception_ptr> errors(threads);
+  for (size_t id = 0; id < threads; ++id) {
+    pool.emplace_back([fd, id, &errors] {
+      try {
+        shared_fd_worker(fd, id);
+      } catch (...) {
+        errors[id] = std::current_exception();
+      }
+    });
+  }
+  for (auto& t : pool) {
+    t.join();
+  }
+  for (const auto& e : errors) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+  check(vtpc_close(fd), 0, "close");
+
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}